@@ -21,20 +21,28 @@
 
 #include <cmath>                // std::abs
 #include <algorithm>            // std::minmax
+#include <limits>               // std::numeric_limits
 #include <string.h>             // strlen
 #include <mutex>
+#include <vector>
 
+#include "cpl_multiproc.h"      // for CPLGetNumCPUs
 #include "gdal_priv.h"
 #include "gdalwarper.h"
+#include "gdal_vrt.h"
 #include "ogr_spatialref.h"
 #include "ogr_srs_api.h"
 
 #include "config.hpp"
 #include "CTBException.hpp"
 #include "GDALTiler.hpp"
+#include "HeightConverter.hpp"
 
 using namespace ctb;
 
+/// The scale and offset converting heights in meters to terrain heights
+static const double TERRAIN_SCALE = 5.0, TERRAIN_OFFSET = 5000.0;
+
 GDALTiler::GDALTiler(GDALDataset *poDataset, const Grid &grid, const TilerOptions &options):
   mGrid(grid),
   poDataset(poDataset),
@@ -152,6 +160,7 @@ GDALTiler::GDALTiler(GDALTiler &other):
 
 GDALTiler &
 GDALTiler::operator=(const GDALTiler &other) {
+  clearWarpCache();
   closeDataset();
 
   mGrid = other.mGrid;
@@ -169,6 +178,7 @@ GDALTiler::operator=(const GDALTiler &other) {
 }
 
 GDALTiler::~GDALTiler() {
+  clearWarpCache();
   closeDataset();
 }
 
@@ -198,22 +208,23 @@ GDALTiler::createRasterTile(const TileCoordinate &coord) const {
 }
 
 /**
- * @brief Get an overview dataset which best matches a transformation
+ * @brief Get an overview level which best matches a transformation
  *
  * Try and get an overview from the source dataset that corresponds more closely
  * to the resolution belonging to any output of the transformation.  This will
  * make downsampling operations much quicker and work around integer overflow
  * errors that can occur if downsampling very high resolution source datasets to
- * small scale (low zoom level) tiles.
+ * small scale (low zoom level) tiles.  The transformer must have the
+ * destination geo transform set so that the output resolution is known.
+ *
+ * `-1` is returned if the dataset itself should be used.
  *
  * This code is adapted from that found in `gdalwarp.cpp` implementing the
  * `gdalwarp -ovr` option.
  */
-static
-GDALDatasetH
-getOverviewDataset(GDALDatasetH hSrcDS, GDALTransformerFunc pfnTransformer, void *hTransformerArg) {
+static int
+getOverviewLevel(GDALDatasetH hSrcDS, GDALTransformerFunc pfnTransformer, void *hTransformerArg) {
   GDALDataset* poSrcDS = static_cast<GDALDataset*>(hSrcDS);
-  GDALDataset* poSrcOvrDS = NULL;
   int nOvLevel = -2;
   int nOvCount = poSrcDS->GetRasterBand(1)->GetOverviewCount();
   if( nOvCount > 0 )
@@ -246,13 +257,68 @@ getOverviewDataset(GDALDatasetH hSrcDS, GDALTransformerFunc pfnTransformer, void
               if( iOvr >= 0 )
                 {
                   //std::cout << "CTB WARPING: Selecting overview level " << iOvr << " for output dataset " << nPixels << "x" << nLines << std::endl;
-                  poSrcOvrDS = GDALCreateOverviewDataset( poSrcDS, iOvr, FALSE);
+                  return iOvr;
                 }
             }
         }
     }
 
-  return static_cast<GDALDatasetH>(poSrcOvrDS);
+  return -1;
+}
+
+/// Set the number of threads used by a warp operation
+static void
+setWarpThreads(GDALWarpOptions *psWarpOptions, int nThreads) {
+  CPLStringList warpOptions(psWarpOptions->papszWarpOptions, false);
+  warpOptions.SetNameValue("NUM_THREADS", std::to_string(nThreads).c_str());
+  psWarpOptions->papszWarpOptions = warpOptions.StealList();
+}
+
+/// Create warp options for the first bands of a dataset without setting a transformer
+static GDALWarpOptions *
+createWarpOptions(GDALDatasetH hSrcDS, const TilerOptions &options, int nBandCount, int nThreads) {
+  GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
+  psWarpOptions->eResampleAlg = options.resampleAlg;
+  psWarpOptions->dfWarpMemoryLimit = options.warpMemoryLimit;
+  psWarpOptions->hSrcDS = hSrcDS;
+  psWarpOptions->nBandCount = nBandCount;
+  psWarpOptions->panSrcBands =
+    (int *) CPLMalloc(sizeof(int) * psWarpOptions->nBandCount );
+  psWarpOptions->panDstBands =
+    (int *) CPLMalloc(sizeof(int) * psWarpOptions->nBandCount );
+
+  for (short unsigned int i = 0; i < psWarpOptions->nBandCount; ++i) {
+    psWarpOptions->panDstBands[i] = psWarpOptions->panSrcBands[i] = i + 1;
+  }
+
+  // Specify a multi threaded warp operation
+  setWarpThreads(psWarpOptions, nThreads);
+
+  return psWarpOptions;
+}
+
+/**
+ * @details Each warp operation is multi threaded.  The tiler's
+ * `TilerOptions::threadBudget` is shared between the warps expected to run at
+ * the same time, which is the number of tilers running concurrently
+ * (`TilerOptions::tilerCount`) unless there are fewer destination windows of
+ * the same size covering the dataset.  This means that at low zoom levels,
+ * where there are a few large warps, each warp uses many threads whereas at
+ * high zoom levels, where many tiles are created simultaneously, each warp is
+ * single threaded.  Threads are therefore not oversubscribed.
+ */
+int
+GDALTiler::warpThreadCount(const double (&adfGeoTransform)[6], int nXSize, int nYSize) const {
+  const unsigned int budget = (options.threadBudget > 0) ? options.threadBudget : CPLGetNumCPUs();
+
+  // The number of destination windows needed to cover the dataset
+  const double windows =
+    std::ceil(mBounds.getWidth() / (std::abs(adfGeoTransform[1]) * nXSize)) *
+    std::ceil(mBounds.getHeight() / (std::abs(adfGeoTransform[5]) * nYSize));
+
+  const double concurrentWarps = std::max(1.0, std::min((double) options.tilerCount, windows));
+
+  return std::max(1, (int) (budget / concurrentWarps));
 }
 
 /**
@@ -294,19 +360,9 @@ GDALTiler::createRasterTile(double (&adfGeoTransform)[6]) const {
   }
 
   // Set the warp options
-  GDALWarpOptions *psWarpOptions = GDALCreateWarpOptions();
-  psWarpOptions->eResampleAlg = options.resampleAlg;
-  psWarpOptions->dfWarpMemoryLimit = options.warpMemoryLimit;
-  psWarpOptions->hSrcDS = hSrcDS;
-  psWarpOptions->nBandCount = poDataset->GetRasterCount();
-  psWarpOptions->panSrcBands =
-    (int *) CPLMalloc(sizeof(int) * psWarpOptions->nBandCount );
-  psWarpOptions->panDstBands =
-    (int *) CPLMalloc(sizeof(int) * psWarpOptions->nBandCount );
-
-  for (short unsigned int i = 0; i < psWarpOptions->nBandCount; ++i) {
-    psWarpOptions->panDstBands[i] = psWarpOptions->panSrcBands[i] = i + 1;
-  }
+  GDALWarpOptions *psWarpOptions =
+    createWarpOptions(hSrcDS, options, poDataset->GetRasterCount(),
+                      warpThreadCount(adfGeoTransform, mGrid.tileSize(), mGrid.tileSize()));
 
   // Create the image to image transformer
   void *transformerArg = GDALCreateGenImgProjTransformer2(hSrcDS, NULL, transformOptions.List());
@@ -315,12 +371,21 @@ GDALTiler::createRasterTile(double (&adfGeoTransform)[6]) const {
     throw CTBException("Could not create image to image transformer");
   }
 
+  // Specify the destination geotransform
+  GDALSetGenImgProjTransformerDstGeoTransform(transformerArg, adfGeoTransform );
+
   // Try and get an overview from the source dataset that corresponds more
   // closely to the resolution of this tile.
-  GDALDatasetH hWrkSrcDS = getOverviewDataset(hSrcDS, GDALGenImgProjTransform, transformerArg);
-  if (hWrkSrcDS == NULL) {
-    hWrkSrcDS = psWarpOptions->hSrcDS = hSrcDS;
-  } else {
+  GDALDatasetH hWrkSrcDS = hSrcDS;
+  int overview = getOverviewLevel(hSrcDS, GDALGenImgProjTransform, transformerArg);
+  if (overview >= 0) {
+    hWrkSrcDS = psWarpOptions->hSrcDS = GDALCreateOverviewDataset(poDataset, overview, FALSE);
+    if (hWrkSrcDS == NULL) {
+      GDALDestroyWarpOptions(psWarpOptions);
+      GDALDestroyGenImgProjTransformer(transformerArg);
+      throw CTBException("Could not open overview dataset");
+    }
+
     // We need to recreate the transform when operating on an overview.
     GDALDestroyGenImgProjTransformer( transformerArg );
     transformerArg = GDALCreateGenImgProjTransformer2( hWrkSrcDS, NULL, transformOptions.List() );
@@ -328,10 +393,9 @@ GDALTiler::createRasterTile(double (&adfGeoTransform)[6]) const {
       GDALDestroyWarpOptions(psWarpOptions);
       throw CTBException("Could not create overview image to image transformer");
     }
-  }
 
-  // Specify the destination geotransform
-  GDALSetGenImgProjTransformerDstGeoTransform(transformerArg, adfGeoTransform );
+    GDALSetGenImgProjTransformerDstGeoTransform(transformerArg, adfGeoTransform );
+  }
 
   // Decide if we are doing an approximate or exact transformation
   if (options.errorThreshold) {
@@ -353,11 +417,6 @@ GDALTiler::createRasterTile(double (&adfGeoTransform)[6]) const {
     psWarpOptions->pfnTransformer = GDALGenImgProjTransform;
   }
 
-  // Specify a multi threaded warp operation using all CPU cores
-  CPLStringList warpOptions(psWarpOptions->papszWarpOptions, false);
-  warpOptions.SetNameValue("NUM_THREADS", "ALL_CPUS");
-  psWarpOptions->papszWarpOptions = warpOptions.StealList();
-
   // The raster tile is represented as a VRT dataset
   hDstDS = GDALCreateWarpedVRT(hWrkSrcDS, mGrid.tileSize(), mGrid.tileSize(), adfGeoTransform, psWarpOptions);
 
@@ -389,6 +448,460 @@ GDALTiler::createRasterTile(double (&adfGeoTransform)[6]) const {
                       ? transformerArg : NULL);
 }
 
+/**
+ * @details This bypasses the VRT dataset, along with its bands and block
+ * cache, which `GDALTiler::createRasterTile` would create for the data.
+ * Instead a cached `GDALWarpOperation` warps the first band of the dataset
+ * straight into `pBuffer`, which must hold `nXSize * nYSize` values.
+ *
+ * Source pixels matching the nodata value of the band are not used, and areas
+ * without any source data are set to NaN, so missing data can be told apart
+ * from heights of `0` (`HeightConverter` sets it to sea level).
+ */
+void
+GDALTiler::warpToBuffer(double (&adfGeoTransform)[6], int nXSize, int nYSize, float *pBuffer) const {
+  if (poDataset == NULL) {
+    throw CTBException("No GDAL dataset is set");
+  }
+
+  WarpContext &context = warpContext(adfGeoTransform);
+  const double noData = std::numeric_limits<double>::quiet_NaN();
+  warpBuffer(context, context.floatWarper, context.hSrcDS, adfGeoTransform,
+             nXSize, nYSize, pBuffer, GDT_Float32, noData);
+}
+
+/**
+ * @details This warps heights in meters straight into terrain height units
+ * (see `HeightConverter`), avoiding a buffer of floats and a conversion pass.
+ * The first band of the dataset is scaled by a VRT using the terrain scale
+ * and offset, with values outside the range of terrain heights being clamped
+ * to it as `HeightConverter` does, and the warp works on unsigned 16 bit
+ * integers.
+ *
+ * Every terrain height is valid, so source pixels without data are marked by
+ * a VRT alpha band taken from the mask of the source band rather than by a
+ * nodata value.  The warp skips those pixels and areas left without any data
+ * are set to sea level.  Heights are rounded by GDAL, halfway values being
+ * rounded up.
+ */
+void
+GDALTiler::warpToBuffer(double (&adfGeoTransform)[6], int nXSize, int nYSize, i_terrain_height *pBuffer) const {
+  if (poDataset == NULL) {
+    throw CTBException("No GDAL dataset is set");
+  }
+
+  WarpContext &context = warpContext(adfGeoTransform);
+
+  if (context.hTerrainDS == NULL) {
+    const int nRasterXSize = GDALGetRasterXSize(context.hSrcDS),
+      nRasterYSize = GDALGetRasterYSize(context.hSrcDS);
+    GDALRasterBandH hSrcBand = GDALGetRasterBand(context.hSrcDS, 1);
+    double adfSrcGeoTransform[6];
+
+    VRTDatasetH hVRTDS = VRTCreate(nRasterXSize, nRasterYSize);
+    if (hVRTDS == NULL) {
+      throw CTBException("Could not create the terrain height VRT");
+    }
+
+    if (GDALGetGeoTransform(context.hSrcDS, adfSrcGeoTransform) == CE_None) {
+      GDALSetGeoTransform(hVRTDS, adfSrcGeoTransform);
+    }
+    GDALSetProjection(hVRTDS, GDALGetProjectionRef(context.hSrcDS));
+
+    int hasNoData = FALSE;
+    const double noData = GDALGetRasterNoDataValue(hSrcBand, &hasNoData);
+
+    // The heights, saturated to the terrain height range
+    GDALRasterBandH hBand;
+    if (GDALAddBand(hVRTDS, GDT_UInt16, NULL) != CE_None
+        || (hBand = GDALGetRasterBand(hVRTDS, 1)) == NULL
+        || VRTAddComplexSource((VRTSourcedRasterBandH) hBand, hSrcBand,
+                               0, 0, nRasterXSize, nRasterYSize,
+                               0, 0, nRasterXSize, nRasterYSize,
+                               TERRAIN_OFFSET, TERRAIN_SCALE,
+                               hasNoData ? noData : VRT_NODATA_UNSET) != CE_None) {
+      GDALClose(hVRTDS);
+      throw CTBException("Could not create the terrain height VRT band");
+    }
+
+    // The mask of the source band, marking which heights are valid
+    GDALRasterBandH hAlphaBand;
+    if (GDALAddBand(hVRTDS, GDT_Byte, NULL) != CE_None
+        || (hAlphaBand = GDALGetRasterBand(hVRTDS, 2)) == NULL
+        || GDALSetRasterColorInterpretation(hAlphaBand, GCI_AlphaBand) != CE_None
+        || VRTAddSimpleSource((VRTSourcedRasterBandH) hAlphaBand, GDALGetMaskBand(hSrcBand),
+                              0, 0, nRasterXSize, nRasterYSize,
+                              0, 0, nRasterXSize, nRasterYSize,
+                              NULL, VRT_NODATA_UNSET) != CE_None) {
+      GDALClose(hVRTDS);
+      throw CTBException("Could not create the terrain height VRT mask band");
+    }
+
+    context.hTerrainDS = hVRTDS;
+  }
+
+  warpBuffer(context, context.terrainWarper, context.hTerrainDS, adfGeoTransform,
+             nXSize, nYSize, pBuffer, GDT_UInt16, HeightConverter::SEA_LEVEL, 2);
+}
+
+/**
+ * @details The warp operation is cached in `bufferWarper`, being recreated
+ * when the buffer dimensions or the number of threads change.  `hSrcDS` must
+ * have the same dimensions and georeferencing as the source of the context,
+ * as the context's transformer is used.
+ *
+ * Source pixels without data are not resampled.  Without a source alpha
+ * band these are the pixels matching the nodata value of the band, if any,
+ * and `initValue` is the destination nodata value.  Otherwise
+ * `nSrcAlphaBand` marks the valid source pixels and the sink dataset has an
+ * alpha band recording the valid destination pixels, so every value of the
+ * data type remains valid.  Either way the buffer is initialised with
+ * `initValue`, which is left where there is no data.
+ *
+ * The source window is computed explicitly rather than by passing an empty
+ * window to `GDALWarpOperation::WarpRegionToBuffer`, and a buffer with no
+ * source pixels is filled with `initValue` without warping.
+ */
+void
+GDALTiler::warpBuffer(WarpContext &context, BufferWarper &bufferWarper, GDALDatasetH hSrcDS,
+                      double (&adfGeoTransform)[6], int nXSize, int nYSize,
+                      void *pBuffer, GDALDataType eBufType, double initValue,
+                      int nSrcAlphaBand) const {
+  const int nThreads = warpThreadCount(adfGeoTransform, nXSize, nYSize);
+
+  // The warper is initialised with a sink dataset of the buffer dimensions.
+  // Only its alpha band, if any, is written to but the warper does use its
+  // size and bands.
+  if (bufferWarper.hDstDS == NULL
+      || GDALGetRasterXSize(bufferWarper.hDstDS) != nXSize
+      || GDALGetRasterYSize(bufferWarper.hDstDS) != nYSize
+      || bufferWarper.warperThreads != nThreads) {
+    delete bufferWarper.warper;
+    bufferWarper.warper = NULL;
+
+    if (bufferWarper.hDstDS != NULL) {
+      GDALClose(bufferWarper.hDstDS);
+      bufferWarper.hDstDS = NULL;
+    }
+
+    GDALDriverH hDriver = GDALGetDriverByName("MEM");
+    if (hDriver == NULL) {
+      throw CTBException("Could not retrieve the GDAL MEM driver");
+    }
+
+    bufferWarper.hDstDS = GDALCreate(hDriver, "", nXSize, nYSize, nSrcAlphaBand ? 2 : 1, eBufType, NULL);
+    if (bufferWarper.hDstDS == NULL) {
+      throw CTBException("Could not create the warp sink dataset");
+    }
+
+    // An exact transformer can be used directly as it isn't owned by a VRT
+    if (options.errorThreshold && context.approxTransformer == NULL) {
+      context.approxTransformer =
+        GDALCreateApproxTransformer(GDALGenImgProjTransform, context.transformer, options.errorThreshold);
+
+      if (context.approxTransformer == NULL) {
+        throw CTBException("Could not create linear approximator");
+      }
+    }
+
+    GDALWarpOptions *psWarpOptions = createWarpOptions(hSrcDS, options, 1, nThreads);
+    psWarpOptions->hDstDS = bufferWarper.hDstDS;
+    psWarpOptions->eWorkingDataType = eBufType;
+
+    if (context.approxTransformer != NULL) {
+      psWarpOptions->pTransformerArg = context.approxTransformer;
+      psWarpOptions->pfnTransformer = GDALApproxTransform;
+    } else {
+      psWarpOptions->pTransformerArg = context.transformer;
+      psWarpOptions->pfnTransformer = GDALGenImgProjTransform;
+    }
+
+    // Skip source pixels without data, and initialise the buffer rather than
+    // reading it from the sink
+    CPLStringList warpOptions(psWarpOptions->papszWarpOptions, false);
+    if (nSrcAlphaBand) {
+      psWarpOptions->nSrcAlphaBand = nSrcAlphaBand;
+      psWarpOptions->nDstAlphaBand = 2;
+      warpOptions.SetNameValue("INIT_DEST", CPLSPrintf("%.18g", initValue));
+    } else {
+      int hasNoData = FALSE;
+      const double srcNoData = GDALGetRasterNoDataValue(GDALGetRasterBand(hSrcDS, 1), &hasNoData);
+      if (hasNoData) {
+        psWarpOptions->padfSrcNoDataReal = (double *) CPLMalloc(sizeof(double));
+        psWarpOptions->padfSrcNoDataReal[0] = srcNoData;
+      }
+
+      psWarpOptions->padfDstNoDataReal = (double *) CPLMalloc(sizeof(double));
+      psWarpOptions->padfDstNoDataReal[0] = initValue;
+      warpOptions.SetNameValue("INIT_DEST", "NO_DATA");
+    }
+
+    psWarpOptions->papszWarpOptions = warpOptions.StealList();
+
+    bufferWarper.warper = new GDALWarpOperation();
+    CPLErr err = bufferWarper.warper->Initialize(psWarpOptions); // the options are copied
+    GDALDestroyWarpOptions(psWarpOptions);
+
+    if (err != CE_None) {
+      delete bufferWarper.warper;
+      bufferWarper.warper = NULL;
+      throw CTBException("Could not initialise the warp operation");
+    }
+
+    bufferWarper.warperThreads = nThreads;
+  }
+
+  // Find the source window covering the buffer, with the extra pixels needed
+  // by the resampling kernel
+  int nSrcXOff, nSrcYOff, nSrcXSize, nSrcYSize;
+  double dfSrcXExtraSize, dfSrcYExtraSize, dfSrcFillRatio;
+  if (bufferWarper.warper->ComputeSourceWindow(0, 0, nXSize, nYSize,
+                                               &nSrcXOff, &nSrcYOff, &nSrcXSize, &nSrcYSize,
+                                               &dfSrcXExtraSize, &dfSrcYExtraSize,
+                                               &dfSrcFillRatio) != CE_None) {
+    throw CTBException("Could not compute the source window");
+  }
+
+  // Without any source pixels the buffer is just initialised
+  if (nSrcXSize == 0 || nSrcYSize == 0) {
+    GDALCopyWords(&initValue, GDT_Float64, 0, pBuffer, eBufType,
+                  GDALGetDataTypeSize(eBufType) / 8, nXSize * nYSize);
+    return;
+  }
+
+  if (bufferWarper.warper->WarpRegionToBuffer(0, 0, nXSize, nYSize, pBuffer, eBufType,
+                                              nSrcXOff, nSrcYOff, nSrcXSize, nSrcYSize,
+                                              dfSrcXExtraSize, dfSrcYExtraSize,
+                                              0.0, 1.0) != CE_None) {
+    throw CTBException("Could not warp the source dataset");
+  }
+}
+
+/**
+ * @details This is intended to be called before warping in order to avoid
+ * creating tiles which would contain no data.  The destination window is
+ * mapped to a window on the dataset (or the overview that would be warped
+ * from) using the cached transformer.  If the window lies outside the dataset
+ * it is empty.  Otherwise the mask band of the window is read: this reflects
+ * the nodata value, any alpha band or any dataset mask.  The mask is read at
+ * full resolution, so a single valid pixel is never missed, one block at a
+ * time so that reading stops at the block containing the first valid pixel.
+ * Datasets where all pixels are valid always have data within their extent.
+ *
+ * Where GDAL supports it, sparse datasets report missing blocks without the
+ * mask having to be read.
+ */
+bool
+GDALTiler::hasData(double (&adfGeoTransform)[6], int nXSize, int nYSize) const {
+  if (poDataset == NULL) {
+    throw CTBException("No GDAL dataset is set");
+  }
+
+  WarpContext &context = warpContext(adfGeoTransform);
+  GDALDataset *poSrcDS = (GDALDataset *) context.hSrcDS;
+  GDALRasterBand *poBand = poSrcDS->GetRasterBand(1);
+
+  // Transform a grid of points over the destination window to the source
+  const int nSteps = 8, nPoints = (nSteps + 1) * (nSteps + 1);
+  double x[nPoints], y[nPoints], z[nPoints];
+  int success[nPoints];
+
+  for (int i = 0; i <= nSteps; i++) {
+    for (int j = 0; j <= nSteps; j++) {
+      const int point = (i * (nSteps + 1)) + j;
+      x[point] = ((double) nXSize * i) / nSteps;
+      y[point] = ((double) nYSize * j) / nSteps;
+      z[point] = 0;
+    }
+  }
+
+  GDALGenImgProjTransform(context.transformer, TRUE, nPoints, x, y, z, success);
+
+  double minX = 0, minY = 0, maxX = -1, maxY = -1;
+  bool transformed = false;
+  for (int point = 0; point < nPoints; point++) {
+    if (!success[point])
+      continue;
+
+    if (!transformed) {
+      minX = maxX = x[point];
+      minY = maxY = y[point];
+      transformed = true;
+    } else {
+      minX = std::min(minX, x[point]);
+      maxX = std::max(maxX, x[point]);
+      minY = std::min(minY, y[point]);
+      maxY = std::max(maxY, y[point]);
+    }
+  }
+
+  if (!transformed) {
+    return false;               // the window doesn't map onto the dataset
+  }
+
+  // Clip the window to the source, allowing a pixel for the resampling kernel
+  const int nXOff = std::max(0, (int) std::floor(minX) - 1),
+    nYOff = std::max(0, (int) std::floor(minY) - 1),
+    nXEnd = std::min(poSrcDS->GetRasterXSize(), (int) std::ceil(maxX) + 1),
+    nYEnd = std::min(poSrcDS->GetRasterYSize(), (int) std::ceil(maxY) + 1);
+
+  if (nXOff >= nXEnd || nYOff >= nYEnd) {
+    return false;               // the window is outside the dataset
+  }
+
+  if (poBand->GetMaskFlags() & GMF_ALL_VALID) {
+    return true;                // there is no nodata value or mask
+  }
+
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,2,0)
+  if (poBand->GetDataCoverageStatus(nXOff, nYOff, nXEnd - nXOff, nYEnd - nYOff, 0, NULL)
+      == GDAL_DATA_COVERAGE_STATUS_EMPTY) {
+    return false;               // there are no blocks of data in the window
+  }
+#endif
+
+  // Read the mask of the window at full resolution a block at a time,
+  // stopping at the first valid pixel.  The window should be a similar size
+  // to the destination as an overview is used where available.
+  GDALRasterBand *poMaskBand = poBand->GetMaskBand();
+  int nBlockXSize, nBlockYSize;
+  poMaskBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+  nBlockXSize = std::max(1, nBlockXSize);
+  nBlockYSize = std::max(1, nBlockYSize);
+
+  std::vector<unsigned char> mask;
+  for (int nBlockY = (nYOff / nBlockYSize) * nBlockYSize; nBlockY < nYEnd; nBlockY += nBlockYSize) {
+    const int nReadYOff = std::max(nYOff, nBlockY),
+      nReadYSize = std::min(nYEnd, nBlockY + nBlockYSize) - nReadYOff;
+
+    for (int nBlockX = (nXOff / nBlockXSize) * nBlockXSize; nBlockX < nXEnd; nBlockX += nBlockXSize) {
+      const int nReadXOff = std::max(nXOff, nBlockX),
+        nReadXSize = std::min(nXEnd, nBlockX + nBlockXSize) - nReadXOff;
+
+      mask.resize((size_t) nReadXSize * nReadYSize);
+      if (poMaskBand->RasterIO(GF_Read, nReadXOff, nReadYOff, nReadXSize, nReadYSize,
+                               (void *) mask.data(), nReadXSize, nReadYSize, GDT_Byte,
+                               0, 0) != CE_None) {
+        throw CTBException("Could not read the dataset mask");
+      }
+
+      if (std::find_if(mask.begin(), mask.end(), [](unsigned char value) { return value != 0; })
+          != mask.end()) {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+/**
+ * @details The overview level giving the best match for the destination
+ * resolution is chosen.  As this only depends on the resolution it is only
+ * calculated once for each zoom level.  The transformer of the returned warp
+ * state is set to the destination geo transform.
+ */
+GDALTiler::WarpContext &
+GDALTiler::warpContext(double (&adfGeoTransform)[6]) const {
+  int overview;
+  const double resolution = adfGeoTransform[1];
+  std::map<double, int>::const_iterator cached = mOverviewLevels.find(resolution);
+
+  if (cached == mOverviewLevels.end()) {
+    WarpContext &context = warpContext(-1);
+    GDALSetGenImgProjTransformerDstGeoTransform(context.transformer, adfGeoTransform);
+    overview = mOverviewLevels[resolution] =
+      getOverviewLevel(context.hSrcDS, GDALGenImgProjTransform, context.transformer);
+  } else {
+    overview = cached->second;
+  }
+
+  WarpContext &context = warpContext(overview);
+
+  // Point the cached transformer at the destination
+  GDALSetGenImgProjTransformerDstGeoTransform(context.transformer, adfGeoTransform);
+
+  return context;
+}
+
+/**
+ * @details The warp state is created the first time an overview level is
+ * requested and is retained until `GDALTiler::clearWarpCache` is called.
+ */
+GDALTiler::WarpContext &
+GDALTiler::warpContext(int overview) const {
+  std::map<int, WarpContext>::iterator cached = mWarpContexts.find(overview);
+  if (cached != mWarpContexts.end()) {
+    return cached->second;
+  }
+
+  // The transformation option list
+  CPLStringList transformOptions;
+
+  if (requiresReprojection()) {
+    transformOptions.SetNameValue("SRC_SRS", poDataset->GetProjectionRef());
+    transformOptions.SetNameValue("DST_SRS", crsWKT.c_str());
+  }
+
+  // The dataset or overview to warp from
+  GDALDatasetH hSrcDS = (overview < 0)
+    ? (GDALDatasetH) poDataset
+    : (GDALDatasetH) GDALCreateOverviewDataset(poDataset, overview, FALSE);
+
+  if (hSrcDS == NULL) {
+    throw CTBException("Could not open overview dataset");
+  }
+
+  // Create the image to image transformer
+  void *transformerArg = GDALCreateGenImgProjTransformer2(hSrcDS, NULL, transformOptions.List());
+  if (transformerArg == NULL) {
+    if (overview >= 0) {
+      GDALClose(hSrcDS);
+    }
+    throw CTBException("Could not create image to image transformer");
+  }
+
+  WarpContext &context = mWarpContexts[overview];
+  context.hSrcDS = hSrcDS;
+  context.transformer = transformerArg;
+  context.approxTransformer = NULL;
+  context.floatWarper.warper = context.terrainWarper.warper = NULL;
+  context.floatWarper.warperThreads = context.terrainWarper.warperThreads = 0;
+  context.floatWarper.hDstDS = context.terrainWarper.hDstDS = NULL;
+  context.hTerrainDS = NULL;
+
+  return context;
+}
+
+void
+GDALTiler::clearWarpCache() const {
+  for (std::map<int, WarpContext>::iterator it = mWarpContexts.begin(); it != mWarpContexts.end(); ++it) {
+    WarpContext &context = it->second;
+
+    for (BufferWarper *bufferWarper : {&context.floatWarper, &context.terrainWarper}) {
+      delete bufferWarper->warper;
+      if (bufferWarper->hDstDS != NULL) {
+        GDALClose(bufferWarper->hDstDS);
+      }
+    }
+    if (context.hTerrainDS != NULL) {
+      GDALClose(context.hTerrainDS); // after the warper reading from it
+    }
+    if (context.approxTransformer != NULL) {
+      GDALDestroyApproxTransformer(context.approxTransformer);
+    }
+
+    GDALDestroyGenImgProjTransformer(context.transformer);
+
+    if (it->first >= 0) {
+      GDALClose(context.hSrcDS); // the overview dataset
+    }
+  }
+
+  mWarpContexts.clear();
+  mOverviewLevels.clear();
+}
+
 /**
  * @details This dereferences the underlying GDAL dataset and closes it if the
  * reference count falls below 1.
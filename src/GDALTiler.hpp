@@ -23,6 +23,7 @@
  */
 
 #include <string>
+#include <map>
 #include "gdalwarper.h"
 
 #include "TileCoordinate.hpp"
@@ -33,6 +34,7 @@
 namespace ctb {
   struct TilerOptions;
   class GDALTiler;
+  class WaterMask;
 }
 
 /// Options passed to a `GDALTiler`
@@ -43,6 +45,20 @@ struct ctb::TilerOptions {
   double warpMemoryLimit = 0.0; // default to GDAL internal setting
   /// The warp resampling algorithm
   GDALResampleAlg resampleAlg = GRA_Average; // recommended by GDAL maintainer
+  /// The number of tiles along each side of a block of tiles warped together
+  unsigned int metatileSize = 1; // warp each tile individually
+  /// The number of threads shared by concurrent warp operations
+  unsigned int threadBudget = 0; // default to the number of CPUs
+  /// The number of tilers creating tiles concurrently
+  unsigned int tilerCount = 1;
+  /// Set child tile flags from the data coverage rather than the dataset extent
+  bool dataCoverage = false;
+  /// Warp terrain heights straight into terrain height units
+  bool terrainUnits = false;
+  /// Scales the maximum geometric error of simplified meshes at each zoom level
+  double meshErrorFactor = 1.0;
+  /// Sets the water masks of terrain tiles, which are all land without one
+  const WaterMask *waterMask = NULL;
 };
 
 /**
@@ -61,6 +77,13 @@ struct ctb::TilerOptions {
  * with any other handles that may also be in use.  When the tiler is destroyed
  * the reference count is decremented and, if it reaches `0`, the dataset is
  * closed.
+ *
+ * Derived classes can avoid the VRT dataset altogether by using
+ * `GDALTiler::warpToBuffer`.  This reuses the image transformers and warp
+ * operations created for previous tiles, which are cached by the tiler.  A
+ * tiler using the cache should therefore not be shared between threads: each
+ * thread should use its own copy of the tiler, as copies do not share the
+ * cache.
  */
 class CTB_DLL ctb::GDALTiler {
 public:
@@ -87,7 +110,7 @@ public:
   operator=(const GDALTiler &other);
 
   /// The destructor
-  ~GDALTiler();
+  virtual ~GDALTiler();
 
   /// Create a tile from a tile coordinate
   virtual Tile *
@@ -162,6 +185,58 @@ protected:
   virtual GDALTile *
   createRasterTile(double (&adfGeoTransform)[6]) const;
 
+  /// Warp the first band of the dataset directly into a buffer of floats
+  void
+  warpToBuffer(double (&adfGeoTransform)[6], int nXSize, int nYSize, float *pBuffer) const;
+
+  /// Warp the first band of the dataset directly into a buffer of terrain heights
+  void
+  warpToBuffer(double (&adfGeoTransform)[6], int nXSize, int nYSize, i_terrain_height *pBuffer) const;
+
+  /// Does the first band of the dataset contain any data for a destination window?
+  bool
+  hasData(double (&adfGeoTransform)[6], int nXSize, int nYSize) const;
+
+  /// A warp operation writing directly into buffers of one data type
+  struct BufferWarper {
+    GDALWarpOperation *warper;    ///< Warps directly into a buffer, if used
+    int warperThreads;            ///< The number of threads used by `warper`
+    GDALDatasetH hDstDS;          ///< The sink `warper` was initialised with
+  };
+
+  /// The warp state for the dataset or one of its overviews
+  struct WarpContext {
+    GDALDatasetH hSrcDS;          ///< The dataset or overview warped from
+    void *transformer;            ///< The image to image transformer
+    void *approxTransformer;      ///< The approximator used by the warpers, if any
+    BufferWarper floatWarper;     ///< Warps into buffers of floats
+    BufferWarper terrainWarper;   ///< Warps into buffers of terrain heights
+    GDALDatasetH hTerrainDS;      ///< `hSrcDS` scaled to terrain heights, if used
+  };
+
+  /// Warp the first band of a source into a buffer of a data type
+  void
+  warpBuffer(WarpContext &context, BufferWarper &bufferWarper, GDALDatasetH hSrcDS,
+             double (&adfGeoTransform)[6], int nXSize, int nYSize,
+             void *pBuffer, GDALDataType eBufType, double initValue,
+             int nSrcAlphaBand = 0) const;
+
+  /// Get the number of threads to use when warping a destination window
+  int
+  warpThreadCount(const double (&adfGeoTransform)[6], int nXSize, int nYSize) const;
+
+  /// Get the warp state for an overview level (`-1` being the dataset itself)
+  WarpContext &
+  warpContext(int overview) const;
+
+  /// Get the warp state best suited to a destination geo transform
+  WarpContext &
+  warpContext(double (&adfGeoTransform)[6]) const;
+
+  /// Release all cached warp state
+  void
+  clearWarpCache() const;
+
   /// The grid used for generating tiles
   Grid mGrid;
 
@@ -183,6 +258,12 @@ protected:
    * reference system of the grid being used.
    */
   std::string crsWKT;
+
+  /// The cached warp state indexed by overview level
+  mutable std::map<int, WarpContext> mWarpContexts;
+
+  /// The cached overview level for each tile resolution
+  mutable std::map<double, int> mOverviewLevels;
 };
 
 #endif /* GDALTILER_HPP */
@@ -23,6 +23,8 @@
  */
 
 #include <iterator>
+#include <vector>
+#include <algorithm>            // for std::upper_bound
 
 #include "TileCoordinate.hpp"
 #include "Grid.hpp"
@@ -49,6 +51,12 @@ namespace ctb {
  * By default the iterator iterates over the full extent represented by the
  * grid, but alternative extents can be passed in to the constructor, acting as
  * a spatial filter.
+ *
+ * Every tile visited by the iterator has a linear index between `0` and
+ * `GridIterator::getSize()` corresponding to its position in the iteration
+ * sequence.  The iterator can be moved directly to any index in constant time
+ * using `GridIterator::seek` which allows different iterators (e.g. in
+ * different threads) to cooperatively share out the tiles in a grid.
  */
 class ctb::GridIterator :
   public std::iterator<std::input_iterator_tag, TileCoordinate *>
@@ -66,6 +74,8 @@ public:
   {
     if (startZoom < endZoom)
       throw CTBException("Iterating from a starting zoom level that is less than the end zoom level");
+
+    setZoomIndex();
   }
 
   /// Instantiate an iterator with a grid and separate bounds
@@ -79,6 +89,7 @@ public:
       throw CTBException("Iterating from a starting zoom level that is less than the end zoom level");
 
     currentTile.zoom = startZoom;
+    setZoomIndex();
     setTileBounds();
   }
 
@@ -173,22 +184,113 @@ public:
     currentTile.zoom = startZoom = start;
     endZoom = end;
 
+    setZoomIndex();
     setTileBounds();
   }
 
   /// Get the total number of elements in the iterator
   i_tile
   getSize() const {
-    i_tile size = 0;
-    for (i_zoom zoom = endZoom; zoom <= startZoom; ++zoom) {
-      TileCoordinate ll = grid.crsToTile(gridExtent.getLowerLeft(), zoom),
-        ur = grid.crsToTile(gridExtent.getUpperRight(), zoom);
+    return zoomOffsets.back();
+  }
 
-      TileBounds zoomBound(ll, ur);
-      size += (zoomBound.getWidth() + 1) * (zoomBound.getHeight() + 1);
+  /// Get the zoom level the iteration starts at
+  inline i_zoom
+  getStartZoom() const {
+    return startZoom;
+  }
+
+  /// Get the zoom level the iteration ends at
+  inline i_zoom
+  getEndZoom() const {
+    return endZoom;
+  }
+
+  /// Get the tile bounds iterated over at a zoom level
+  inline const TileBounds &
+  getZoomBounds(i_zoom zoom) const {
+    return zoomBounds[startZoom - zoom];
+  }
+
+  /// Get the index of the first tile in a zoom level
+  inline i_tile
+  getZoomOffset(i_zoom zoom) const {
+    return zoomOffsets[startZoom - zoom];
+  }
+
+  /**
+   * @brief Get the tile coordinate at a position in the iteration sequence
+   *
+   * This maps a linear index to the tile that would be pointed to after
+   * incrementing a fresh iterator `index` times.  The zoom level is found from
+   * the precomputed per zoom tile counts, after which the tile is calculated
+   * directly from the zoom level bounds.
+   */
+  TileCoordinate
+  tileAt(i_tile index) const {
+    if (index >= getSize())
+      throw CTBException("The tile index is beyond the end of the iterator");
+
+    // find the zoom level containing the index
+    std::vector<i_tile>::const_iterator offset =
+      std::upper_bound(zoomOffsets.begin(), zoomOffsets.end(), index) - 1;
+    const size_t level = offset - zoomOffsets.begin();
+    const TileBounds &zoomBound = zoomBounds[level];
+
+    // columns are iterated over first, so the index runs along the y axis
+    const i_tile columnSize = zoomBound.getHeight() + 1,
+      position = index - *offset;
+
+    return TileCoordinate(startZoom - level,
+                          zoomBound.getMinX() + (position / columnSize),
+                          zoomBound.getMinY() + (position % columnSize));
+  }
+
+  /// Is a tile coordinate part of the iteration sequence?
+  bool
+  contains(const TileCoordinate &coord) const {
+    if (coord.zoom > startZoom || coord.zoom < endZoom)
+      return false;
+
+    const TileBounds &zoomBound = getZoomBounds(coord.zoom);
+    return coord.x >= zoomBound.getMinX() && coord.x <= zoomBound.getMaxX()
+      && coord.y >= zoomBound.getMinY() && coord.y <= zoomBound.getMaxY();
+  }
+
+  /// Get the position of a tile coordinate in the iteration sequence
+  i_tile
+  indexOf(const TileCoordinate &coord) const {
+    if (!contains(coord))
+      throw CTBException("The tile coordinate is not part of the iterator");
+
+    const TileBounds &zoomBound = getZoomBounds(coord.zoom);
+    const i_tile columnSize = zoomBound.getHeight() + 1;
+
+    return getZoomOffset(coord.zoom)
+      + ((coord.x - zoomBound.getMinX()) * columnSize)
+      + (coord.y - zoomBound.getMinY());
+  }
+
+  /**
+   * @brief Move the iterator to a position in the iteration sequence
+   *
+   * Seeking to an index greater than or equal to `GridIterator::getSize()`
+   * exhausts the iterator.
+   */
+  GridIterator &
+  seek(i_tile index) {
+    if (index >= getSize()) {
+      // point to the position an exhausted iterator is left in
+      currentTile.zoom = endZoom;
+      bounds = zoomBounds.back();
+      currentTile.x = bounds.getMaxX() + 1;
+      currentTile.y = bounds.getMaxY() + 1;
+    } else {
+      currentTile = tileAt(index);
+      bounds = zoomBounds[startZoom - currentTile.zoom];
     }
 
-    return size;
+    return *this;
   }
 
   /// Get the grid we are iterating over
@@ -202,14 +304,36 @@ protected:
   /// Set the tile bounds of the grid for the current zoom level
   void
   setTileBounds() {
-    TileCoordinate ll = grid.crsToTile(gridExtent.getLowerLeft(), currentTile.zoom),
-      ur = grid.crsToTile(gridExtent.getUpperRight(), currentTile.zoom);
-
     // set the bounds
-    bounds = TileBounds(ll, ur);
+    bounds = zoomBounds[startZoom - currentTile.zoom];
 
     // set the current tile
-    currentTile.setPoint(ll);
+    currentTile.setPoint(bounds.getLowerLeft());
+  }
+
+  /**
+   * @brief Cache the tile bounds and index offsets of each zoom level
+   *
+   * The bounds and offsets are stored from the start zoom level to the end
+   * zoom level, with a final offset representing the total number of tiles.
+   */
+  void
+  setZoomIndex() {
+    zoomBounds.clear();
+    zoomOffsets.assign(1, 0);
+
+    for (i_zoom zoom = startZoom; ; --zoom) {
+      TileCoordinate ll = grid.crsToTile(gridExtent.getLowerLeft(), zoom),
+        ur = grid.crsToTile(gridExtent.getUpperRight(), zoom);
+
+      TileBounds zoomBound(ll, ur);
+      zoomBounds.push_back(zoomBound);
+      zoomOffsets.push_back(zoomOffsets.back() +
+                            (zoomBound.getWidth() + 1) * (zoomBound.getHeight() + 1));
+
+      if (zoom == endZoom)
+        break;
+    }
   }
 
   const Grid &grid;      ///< The grid we are iterating over
@@ -218,6 +342,9 @@ protected:
   CRSBounds gridExtent;  ///< The extent of the underlying grid to iterate over
   TileBounds bounds;     ///< The extent of the currently iterated zoom level
   TileCoordinate currentTile; ///< The identity of the current tile being pointed to
+
+  std::vector<TileBounds> zoomBounds; ///< The tile bounds of each zoom level from the start zoom
+  std::vector<i_tile> zoomOffsets;    ///< The index of the first tile in each zoom level from the start zoom
 };
 
 #endif /* GRIDITERATOR_HPP */
@@ -0,0 +1,273 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file HeightConverter.cpp
+ * @brief This defines the `HeightConverter` class
+ */
+
+#include <cmath>                // for std::nearbyint
+#include <cstring>              // for std::strcmp
+
+// SSE2 is always available on x86-64 and otherwise when enabled by the
+// compiler, while AVX2 is detected at runtime with GCC and clang
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CTB_WITH_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(CTB_WITH_SSE2) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__)) && \
+  (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define CTB_WITH_AVX2
+#include <immintrin.h>
+#endif
+
+#include "HeightConverter.hpp"
+
+using namespace ctb;
+
+/// The scale and offset of terrain heights, and the largest terrain height
+static const float HEIGHT_SCALE = 5.0f, HEIGHT_OFFSET = 1000.0f, HEIGHT_MAX = 65535.0f;
+
+/// Convert a height in meters to a terrain height
+static inline i_terrain_height
+toTerrainHeight(float meters) {
+  if (meters != meters)         // it is not a number
+    return HeightConverter::SEA_LEVEL;
+
+  float value = (meters + HEIGHT_OFFSET) * HEIGHT_SCALE;
+  value = (value > 0.0f) ? value : 0.0f;
+  value = (value < HEIGHT_MAX) ? value : HEIGHT_MAX;
+
+  // Round halfway values to even, as the vector conversions do
+  return (i_terrain_height) std::nearbyint(value);
+}
+
+/// Convert a terrain height to a height in meters
+static inline float
+toMeter(i_terrain_height height) {
+  return ((float) height / HEIGHT_SCALE) - HEIGHT_OFFSET;
+}
+
+void
+HeightConverter::toTerrainHeightsScalar(const float *meters, i_terrain_height *heights, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    heights[i] = toTerrainHeight(meters[i]);
+  }
+}
+
+void
+HeightConverter::toMetersScalar(const i_terrain_height *heights, float *meters, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    meters[i] = toMeter(heights[i]);
+  }
+}
+
+#ifdef CTB_WITH_SSE2
+
+/**
+ * @brief Convert four heights in meters to 32 bit terrain heights
+ *
+ * The heights are clamped before conversion, which rounds to even.  The
+ * maximum and minimum return their second operand for NaN, so missing data
+ * is clamped to zero and then replaced with sea level.
+ */
+static inline __m128i
+toTerrainHeightsSSE2(__m128 meters) {
+  const __m128 missing = _mm_cmpunord_ps(meters, meters);
+  __m128 value = _mm_mul_ps(_mm_add_ps(meters, _mm_set1_ps(HEIGHT_OFFSET)), _mm_set1_ps(HEIGHT_SCALE));
+
+  value = _mm_max_ps(value, _mm_setzero_ps());
+  value = _mm_min_ps(value, _mm_set1_ps(HEIGHT_MAX));
+
+  const __m128i heights = _mm_cvtps_epi32(value);
+  const __m128i seaLevel = _mm_set1_epi32(HeightConverter::SEA_LEVEL);
+
+  return _mm_or_si128(_mm_and_si128(_mm_castps_si128(missing), seaLevel),
+                      _mm_andnot_si128(_mm_castps_si128(missing), heights));
+}
+
+/**
+ * @details SSE2 can only pack signed 16 bit integers with saturation, so the
+ * heights are offset into the signed range and back again.
+ */
+static void
+toTerrainHeightsSSE2(const float *meters, i_terrain_height *heights, size_t count) {
+  const __m128i offset = _mm_set1_epi32(32768), sign = _mm_set1_epi16((short) 0x8000);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const __m128i low = _mm_sub_epi32(toTerrainHeightsSSE2(_mm_loadu_ps(meters + i)), offset),
+      high = _mm_sub_epi32(toTerrainHeightsSSE2(_mm_loadu_ps(meters + i + 4)), offset);
+
+    _mm_storeu_si128((__m128i *) (heights + i), _mm_xor_si128(_mm_packs_epi32(low, high), sign));
+  }
+
+  HeightConverter::toTerrainHeightsScalar(meters + i, heights + i, count - i);
+}
+
+static void
+toMetersSSE2(const i_terrain_height *heights, float *meters, size_t count) {
+  const __m128 scale = _mm_set1_ps(HEIGHT_SCALE), offset = _mm_set1_ps(HEIGHT_OFFSET);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const __m128i values = _mm_loadu_si128((const __m128i *) (heights + i));
+    const __m128 low = _mm_cvtepi32_ps(_mm_unpacklo_epi16(values, zero)),
+      high = _mm_cvtepi32_ps(_mm_unpackhi_epi16(values, zero));
+
+    _mm_storeu_ps(meters + i, _mm_sub_ps(_mm_div_ps(low, scale), offset));
+    _mm_storeu_ps(meters + i + 4, _mm_sub_ps(_mm_div_ps(high, scale), offset));
+  }
+
+  HeightConverter::toMetersScalar(heights + i, meters + i, count - i);
+}
+
+#endif /* CTB_WITH_SSE2 */
+
+#ifdef CTB_WITH_AVX2
+
+/// Convert eight heights in meters to 32 bit terrain heights (see the SSE2 version)
+__attribute__((target("avx2"))) static inline __m256i
+toTerrainHeightsAVX2(__m256 meters) {
+  const __m256 missing = _mm256_cmp_ps(meters, meters, _CMP_UNORD_Q);
+  __m256 value = _mm256_mul_ps(_mm256_add_ps(meters, _mm256_set1_ps(HEIGHT_OFFSET)), _mm256_set1_ps(HEIGHT_SCALE));
+
+  value = _mm256_max_ps(value, _mm256_setzero_ps());
+  value = _mm256_min_ps(value, _mm256_set1_ps(HEIGHT_MAX));
+
+  return _mm256_blendv_epi8(_mm256_cvtps_epi32(value),
+                            _mm256_set1_epi32(HeightConverter::SEA_LEVEL),
+                            _mm256_castps_si256(missing));
+}
+
+/**
+ * @details The 256 bit pack interleaves the 128 bit lanes of its operands,
+ * so the packed heights are permuted back into order.
+ */
+__attribute__((target("avx2"))) static void
+toTerrainHeightsAVX2(const float *meters, i_terrain_height *heights, size_t count) {
+  size_t i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    const __m256i low = toTerrainHeightsAVX2(_mm256_loadu_ps(meters + i)),
+      high = toTerrainHeightsAVX2(_mm256_loadu_ps(meters + i + 8));
+    const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(low, high), 0xD8);
+
+    _mm256_storeu_si256((__m256i *) (heights + i), packed);
+  }
+
+  HeightConverter::toTerrainHeightsScalar(meters + i, heights + i, count - i);
+}
+
+__attribute__((target("avx2"))) static void
+toMetersAVX2(const i_terrain_height *heights, float *meters, size_t count) {
+  const __m256 scale = _mm256_set1_ps(HEIGHT_SCALE), offset = _mm256_set1_ps(HEIGHT_OFFSET);
+  size_t i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    const __m256i values = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) (heights + i)));
+
+    _mm256_storeu_ps(meters + i, _mm256_sub_ps(_mm256_div_ps(_mm256_cvtepi32_ps(values), scale), offset));
+  }
+
+  HeightConverter::toMetersScalar(heights + i, meters + i, count - i);
+}
+
+#endif /* CTB_WITH_AVX2 */
+
+/// The conversions supported by the processor
+struct HeightKernels {
+  void (*toTerrainHeights)(const float *, i_terrain_height *, size_t);
+  void (*toMeters)(const i_terrain_height *, float *, size_t);
+  const char *instructionSet;
+};
+
+/// The conversions of each instruction set, fastest first
+static const HeightKernels ALL_KERNELS[] = {
+#ifdef CTB_WITH_AVX2
+  {toTerrainHeightsAVX2, toMetersAVX2, "avx2"},
+#endif
+#ifdef CTB_WITH_SSE2
+  {toTerrainHeightsSSE2, toMetersSSE2, "sse2"},
+#endif
+  {HeightConverter::toTerrainHeightsScalar, HeightConverter::toMetersScalar, "scalar"}
+};
+
+/// Does the processor support the conversions of an instruction set?
+static bool
+isSupported(const HeightKernels &kernels) {
+#ifdef CTB_WITH_AVX2
+  if (std::strcmp(kernels.instructionSet, "avx2") == 0) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }
+#else
+  (void) kernels;
+#endif
+  return true;
+}
+
+/// The conversions in use, the fastest supported by the processor by default
+static HeightKernels &
+heightKernels() {
+  static HeightKernels kernels = []() {
+    for (const HeightKernels &candidate: ALL_KERNELS) {
+      if (isSupported(candidate)) {
+        return candidate;
+      }
+    }
+    // The scalar conversions, which are last, are always supported
+    return ALL_KERNELS[sizeof(ALL_KERNELS) / sizeof(ALL_KERNELS[0]) - 1];
+  }();
+
+  return kernels;
+}
+
+void
+HeightConverter::toTerrainHeights(const float *meters, i_terrain_height *heights, size_t count) {
+  heightKernels().toTerrainHeights(meters, heights, count);
+}
+
+void
+HeightConverter::toMeters(const i_terrain_height *heights, float *meters, size_t count) {
+  heightKernels().toMeters(heights, meters, count);
+}
+
+const char *
+HeightConverter::instructionSet() {
+  return heightKernels().instructionSet;
+}
+
+/**
+ * @details This is intended for testing and benchmarking the conversions, and
+ * must be called before they are used by other threads.  It returns `false`,
+ * leaving the conversions unchanged, if the instruction set is unknown or
+ * not supported by the processor.
+ */
+bool
+HeightConverter::setInstructionSet(const char *name) {
+  for (const HeightKernels &candidate: ALL_KERNELS) {
+    if (std::strcmp(candidate.instructionSet, name) == 0 && isSupported(candidate)) {
+      heightKernels() = candidate;
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,78 @@
+#ifndef HEIGHTCONVERTER_HPP
+#define HEIGHTCONVERTER_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file HeightConverter.hpp
+ * @brief This declares the `HeightConverter` class
+ */
+
+#include <cstddef>
+
+#include "config.hpp"
+#include "types.hpp"
+
+namespace ctb {
+  class HeightConverter;
+}
+
+/**
+ * @brief Convert between heights in meters and terrain heights
+ *
+ * Terrain heights are the number of 1/5 meter units above -1000 meters.
+ * Heights are rounded to the nearest unit (halfway values to even) and
+ * clamped to the range of a terrain height, so heights below -1000 meters or
+ * above 12107 meters are saturated rather than wrapping around.  Heights that
+ * are not a number are taken to be missing data and set to sea level.
+ *
+ * The conversions use SSE2 or AVX2 instructions where the processor supports
+ * them, chosen when first used, and otherwise a scalar implementation.  All
+ * implementations give identical results.
+ */
+class CTB_DLL ctb::HeightConverter {
+public:
+
+  /// The terrain height of sea level
+  static const i_terrain_height SEA_LEVEL = 5000;
+
+  /// Convert heights in meters to terrain heights
+  static void
+  toTerrainHeights(const float *meters, i_terrain_height *heights, size_t count);
+
+  /// Convert terrain heights to heights in meters
+  static void
+  toMeters(const i_terrain_height *heights, float *meters, size_t count);
+
+  /// Convert heights in meters to terrain heights without vector instructions
+  static void
+  toTerrainHeightsScalar(const float *meters, i_terrain_height *heights, size_t count);
+
+  /// Convert terrain heights to meters without vector instructions
+  static void
+  toMetersScalar(const i_terrain_height *heights, float *meters, size_t count);
+
+  /// Get the name of the instruction set used for the conversions
+  static const char *
+  instructionSet();
+
+  /// Use `scalar`, `sse2` or `avx2` conversions if the processor supports them
+  static bool
+  setInstructionSet(const char *name);
+};
+
+#endif /* HEIGHTCONVERTER_HPP */
@@ -0,0 +1,264 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file MBTilesWriter.cpp
+ * @brief This defines the `MBTilesWriter` class
+ */
+
+#include <string>
+
+#include "sqlite3.h"
+
+#include "CTBException.hpp"
+#include "MBTilesWriter.hpp"
+
+using namespace ctb;
+
+/**
+ * @details The `metadata` and `tiles` tables are created if they don't
+ * already exist, so tiles can be added to an existing database.  The database
+ * is written in WAL mode without syncing on every commit: an interrupted
+ * build may lose its last transactions but leaves a consistent database.
+ */
+MBTilesWriter::MBTilesWriter(const char *fileName, unsigned int batchSize, size_t capacity):
+  mDB(NULL),
+  mInsert(NULL),
+  mBatchSize((batchSize > 0) ? batchSize : 1),
+  mCapacity((capacity > 0) ? capacity : 1),
+  mClosing(false),
+  mTileCount(0)
+{
+  if (sqlite3_open_v2(fileName, &mDB, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK) {
+    std::string message = std::string("Could not open the MBTiles database: ") + sqlite3_errmsg(mDB);
+    sqlite3_close(mDB);
+    throw CTBException(message.c_str());
+  }
+
+  try {
+    execute("PRAGMA journal_mode = WAL");
+    execute("PRAGMA synchronous = NORMAL");
+    execute("CREATE TABLE IF NOT EXISTS metadata (name TEXT, value TEXT)");
+    execute("CREATE UNIQUE INDEX IF NOT EXISTS name ON metadata (name)");
+    execute("CREATE TABLE IF NOT EXISTS tiles "
+            "(zoom_level INTEGER, tile_column INTEGER, tile_row INTEGER, tile_data BLOB)");
+    execute("CREATE UNIQUE INDEX IF NOT EXISTS tile_index ON tiles (zoom_level, tile_column, tile_row)");
+
+    if (sqlite3_prepare_v2(mDB,
+                           "INSERT OR REPLACE INTO tiles (zoom_level, tile_column, tile_row, tile_data) "
+                           "VALUES (?, ?, ?, ?)",
+                           -1, &mInsert, NULL) != SQLITE_OK) {
+      throwError("Could not prepare the tile insert");
+    }
+  } catch (CTBException &e) {
+    sqlite3_finalize(mInsert);
+    sqlite3_close(mDB);
+    throw;
+  }
+
+  mThread = std::thread(&MBTilesWriter::run, this);
+}
+
+/**
+ * @details Any errors are ignored: call `MBTilesWriter::close` first in order
+ * to handle them.
+ */
+MBTilesWriter::~MBTilesWriter() {
+  try {
+    close();
+  } catch (CTBException &e) {}
+}
+
+void
+MBTilesWriter::setMetadata(const std::string &name, const std::string &value) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  mMetadata[name] = value;
+}
+
+/**
+ * @details This is thread safe and returns as soon as the tile is queued,
+ * blocking first if the queue is full.  An exception is thrown if the writer
+ * thread has failed or the writer is closed.
+ */
+void
+MBTilesWriter::writeTile(const TileCoordinate &coord, std::vector<unsigned char> &&data) {
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    mSpaceAvailable.wait(lock, [this]{
+        return mQueue.size() < mCapacity || !mError.empty() || mClosing;
+      });
+
+    if (!mError.empty()) {
+      throw CTBException(mError.c_str());
+    } else if (mClosing) {
+      throw CTBException("The MBTiles database is closed");
+    }
+
+    QueuedTile tile;
+    tile.coord = coord;
+    tile.data.swap(data);
+    mQueue.push_back(std::move(tile));
+  }
+
+  mCondition.notify_one();
+}
+
+/**
+ * @details This waits for the writer thread to write the queued tiles before
+ * writing the metadata and closing the database.  Calling it more than once
+ * has no effect.
+ */
+void
+MBTilesWriter::close() {
+  if (mDB == NULL)
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mClosing = true;
+  }
+
+  mCondition.notify_one();
+  mSpaceAvailable.notify_all();
+  mThread.join();
+
+  std::string error = mError;
+  try {
+    if (error.empty() && !mMetadata.empty()) {
+      sqlite3_stmt *statement = NULL;
+
+      execute("BEGIN");
+      if (sqlite3_prepare_v2(mDB, "INSERT OR REPLACE INTO metadata (name, value) VALUES (?, ?)",
+                             -1, &statement, NULL) != SQLITE_OK) {
+        throwError("Could not prepare the metadata insert");
+      }
+
+      for (auto &entry : mMetadata) {
+        sqlite3_bind_text(statement, 1, entry.first.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(statement, 2, entry.second.c_str(), -1, SQLITE_TRANSIENT);
+
+        if (sqlite3_step(statement) != SQLITE_DONE) {
+          sqlite3_finalize(statement);
+          throwError("Could not write the metadata");
+        }
+
+        sqlite3_reset(statement);
+      }
+
+      sqlite3_finalize(statement);
+      execute("COMMIT");
+    }
+  } catch (CTBException &e) {
+    error = e.what();
+  }
+
+  sqlite3_finalize(mInsert);
+  if (sqlite3_close(mDB) != SQLITE_OK && error.empty()) {
+    error = "Could not close the MBTiles database";
+  }
+  mInsert = NULL;
+  mDB = NULL;
+
+  if (!error.empty()) {
+    throw CTBException(error.c_str());
+  }
+}
+
+i_tile
+MBTilesWriter::tileCount() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mTileCount;
+}
+
+/**
+ * @details This is the body of the writer thread.  All the queued tiles are
+ * taken at once so the workers are blocked for as short a time as possible.
+ * A transaction is left open between batches of tiles so that a trickle of
+ * tiles doesn't result in a commit per tile.
+ */
+void
+MBTilesWriter::run() {
+  std::deque<QueuedTile> batch;
+  unsigned int uncommitted = 0;
+
+  try {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this]{ return mClosing || !mQueue.empty(); });
+
+        if (mQueue.empty())
+          break;                // the writer is closing
+
+        batch.swap(mQueue);
+      }
+      mSpaceAvailable.notify_all();
+
+      for (auto &tile : batch) {
+        if (uncommitted == 0)
+          execute("BEGIN");
+
+        sqlite3_bind_int(mInsert, 1, tile.coord.zoom);
+        sqlite3_bind_int64(mInsert, 2, tile.coord.x);
+        sqlite3_bind_int64(mInsert, 3, tile.coord.y);
+        sqlite3_bind_blob(mInsert, 4, tile.data.data(), (int) tile.data.size(), SQLITE_STATIC);
+
+        if (sqlite3_step(mInsert) != SQLITE_DONE) {
+          throwError("Could not write the tile");
+        }
+        sqlite3_reset(mInsert);
+
+        if (++uncommitted == mBatchSize) {
+          execute("COMMIT");
+          uncommitted = 0;
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTileCount += batch.size();
+      }
+      batch.clear();
+    }
+
+    if (uncommitted > 0)
+      execute("COMMIT");
+
+  } catch (CTBException &e) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mError = e.what();
+    mQueue.clear();
+    mSpaceAvailable.notify_all();
+  }
+}
+
+void
+MBTilesWriter::execute(const char *sql) {
+  char *errorMessage = NULL;
+
+  if (sqlite3_exec(mDB, sql, NULL, NULL, &errorMessage) != SQLITE_OK) {
+    std::string message = std::string("MBTiles database error: ") + errorMessage;
+    sqlite3_free(errorMessage);
+    throw CTBException(message.c_str());
+  }
+}
+
+void
+MBTilesWriter::throwError(const char *message) const {
+  std::string error = std::string(message) + ": " + sqlite3_errmsg(mDB);
+  throw CTBException(error.c_str());
+}
@@ -0,0 +1,151 @@
+#ifndef MBTILESWRITER_HPP
+#define MBTILESWRITER_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file MBTilesWriter.hpp
+ * @brief This declares the `MBTilesWriter` class
+ */
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "config.hpp"
+#include "TileCoordinate.hpp"
+
+// Keep SQLite out of the public headers
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace ctb {
+  class MBTilesWriter;
+}
+
+/**
+ * @brief Write tiles to an MBTiles SQLite database
+ *
+ * This stores a tileset in a single [MBTiles](https://github.com/mapbox/mbtiles-spec)
+ * database file rather than as a file per tile, avoiding the creation of
+ * a file system entry for every tile.  Tiles are addressed using the TMS
+ * scheme of a `TileCoordinate`, as the specification requires.
+ *
+ * Any number of threads can pass encoded tiles to `MBTilesWriter::writeTile`.
+ * The tiles are queued for a single writer thread owned by the instance which
+ * inserts them into the database, committing a transaction every `batchSize`
+ * tiles.  At most `capacity` tiles are queued: once the queue is full
+ * `MBTilesWriter::writeTile` blocks until the writer thread takes the queued
+ * tiles, so tile generation can't outrun the database and exhaust memory.
+ * Metadata values are written when the database is closed.
+ */
+class CTB_DLL ctb::MBTilesWriter {
+public:
+
+  /// Create or open an MBTiles database
+  MBTilesWriter(const char *fileName, unsigned int batchSize = 4096, size_t capacity = 8192);
+
+  /// Write any queued tiles and close the database
+  ~MBTilesWriter();
+
+  /// Set a value to be written to the metadata table
+  void
+  setMetadata(const std::string &name, const std::string &value);
+
+  /// Queue a tile for writing to the database
+  void
+  writeTile(const TileCoordinate &coord, std::vector<unsigned char> &&data);
+
+  /// Write any queued tiles and metadata and close the database
+  void
+  close();
+
+  /// Get the number of tiles written to the database so far
+  i_tile
+  tileCount() const;
+
+protected:
+
+  /// A tile waiting to be written
+  struct QueuedTile {
+    TileCoordinate coord;             ///< The tile location
+    std::vector<unsigned char> data;  ///< The encoded tile
+  };
+
+  /// Write queued tiles until the writer is closed
+  void
+  run();
+
+  /// Execute an SQL statement which returns no rows
+  void
+  execute(const char *sql);
+
+  /// Throw an exception describing the last database error
+  void
+  throwError(const char *message) const;
+
+  /// The database connection
+  sqlite3 *mDB;
+
+  /// The prepared tile insert statement
+  sqlite3_stmt *mInsert;
+
+  /// The number of tiles inserted in each transaction
+  unsigned int mBatchSize;
+
+  /// The metadata values to be written
+  std::map<std::string, std::string> mMetadata;
+
+  /// The tiles waiting for the writer thread
+  std::deque<QueuedTile> mQueue;
+
+  /// The maximum number of tiles waiting for the writer thread
+  size_t mCapacity;
+
+  /// Protects the members shared with the writer thread
+  mutable std::mutex mMutex;
+
+  /// Signals the writer thread that there are tiles or it should finish
+  std::condition_variable mCondition;
+
+  /// Signals the producers that there is space in the queue
+  std::condition_variable mSpaceAvailable;
+
+  /// The thread inserting the queued tiles
+  std::thread mThread;
+
+  /// Has the writer been asked to finish?
+  bool mClosing;
+
+  /// The error that stopped the writer thread, if any
+  std::string mError;
+
+  /// The number of tiles inserted so far
+  i_tile mTileCount;
+
+private:
+
+  /// The writer owns a thread and a connection so it can't be copied
+  MBTilesWriter(const MBTilesWriter &);
+  MBTilesWriter &operator=(const MBTilesWriter &);
+};
+
+#endif /* MBTILESWRITER_HPP */
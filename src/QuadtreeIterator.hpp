@@ -0,0 +1,227 @@
+#ifndef QUADTREEITERATOR_HPP
+#define QUADTREEITERATOR_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file QuadtreeIterator.hpp
+ * @brief This declares and defines the `QuadtreeIterator` class
+ */
+
+#include <iterator>
+#include <vector>
+#include <algorithm>            // for std::min, std::max
+
+#include "CTBException.hpp"
+#include "TileCoordinate.hpp"
+#include "GridIterator.hpp"
+
+namespace ctb {
+  class QuadtreeIterator;
+}
+
+/**
+ * @brief A `QuadtreeIterator` iterates over tiles depth first
+ *
+ * This visits the same tiles as a `GridIterator` but in the order of a depth
+ * first, post order traversal of the tile quadtree: the children of a tile
+ * (south west, south east, north west then north east) are always visited
+ * before the tile itself, and every tile is visited as soon as its last child
+ * has been visited.  e.g.
+ *
+ * \code
+ *    for(QuadtreeIterator iter(grid, extent, maxZoom); !iter.exhausted(); ++iter) {
+ *      const TileCoordinate *tile = *iter;
+ *      // the children of `tile` have already been visited
+ *    }
+ * \endcode
+ *
+ * This means that parent tiles can be built from their children while
+ * holding no more than four child tiles per zoom level in memory.  It also
+ * means that spatially adjacent tiles at the start zoom level are visited
+ * consecutively, following the locality of the source data.
+ *
+ * The traversal can either cover all tiles between the start and end zoom
+ * levels or be restricted to the tiles beneath a single root tile, allowing
+ * different subtrees to be traversed independently (e.g. by different
+ * threads).
+ */
+class ctb::QuadtreeIterator :
+  public std::iterator<std::input_iterator_tag, TileCoordinate *>
+{
+public:
+
+  /// Instantiate an iterator over all tiles in an extent
+  QuadtreeIterator(const Grid &grid, const CRSBounds &extent, i_zoom startZoom, i_zoom endZoom = 0) :
+    tiles(grid, extent, startZoom, endZoom),
+    roots(grid, extent, endZoom, endZoom),
+    singleRoot(false)
+  {
+    pushRoot(**roots);
+  }
+
+  /// Instantiate an iterator over the tiles beneath and including a root tile
+  QuadtreeIterator(const Grid &grid, const CRSBounds &extent, const TileCoordinate &root, i_zoom startZoom) :
+    tiles(grid, extent, startZoom, root.zoom),
+    roots(grid, extent, root.zoom, root.zoom),
+    singleRoot(true)
+  {
+    if (!tiles.contains(root))
+      throw CTBException("The root tile is not within the extent");
+
+    pushRoot(root);
+  }
+
+  /// Override the ++prefix operator
+  QuadtreeIterator &
+  operator++() {
+    // don't increment if exhausted
+    if (exhausted())
+      return *this;
+
+    // The current tile is the top of the stack: it is now done with
+    stack.pop_back();
+
+    if (!stack.empty()) {
+      descend();                // carry on with the parent's children
+    } else if (!singleRoot) {
+      ++roots;                  // move on to the next root
+
+      if (!roots.exhausted())
+        pushRoot(**roots);
+    }
+
+    return *this;
+  }
+
+  /// Override the postfix++ operator
+  QuadtreeIterator
+  operator++(int) {
+    QuadtreeIterator result(*this); // make a copy for returning
+    ++(*this);                      // use the prefix version to do the work
+    return result;                  // return the copy (the old) value.
+  }
+
+  /// Dereference the iterator to retrieve a `TileCoordinate`
+  const TileCoordinate *
+  operator*() const {
+    return &(stack.back().tile);
+  }
+
+  /// Return `true` if the iterator is at the end
+  bool
+  exhausted() const {
+    return stack.empty();
+  }
+
+  /// Get the total number of elements in the iterator
+  i_tile
+  getSize() const {
+    if (!singleRoot)
+      return tiles.getSize();
+
+    // Count the descendants of the root within the extent at each zoom level
+    i_tile size = 0;
+
+    for (i_zoom zoom = root.zoom; zoom <= tiles.getStartZoom(); ++zoom) {
+      const TileBounds &bounds = tiles.getZoomBounds(zoom);
+      const i_zoom depth = zoom - root.zoom;
+      const i_tile minX = std::max(bounds.getMinX(), root.x << depth),
+        maxX = std::min(bounds.getMaxX(), ((root.x + 1) << depth) - 1),
+        minY = std::max(bounds.getMinY(), root.y << depth),
+        maxY = std::min(bounds.getMaxY(), ((root.y + 1) << depth) - 1);
+
+      if (minX <= maxX && minY <= maxY)
+        size += (maxX - minX + 1) * (maxY - minY + 1);
+    }
+
+    return size;
+  }
+
+  /// Get the zoom level the traversal descends to
+  inline i_zoom
+  getStartZoom() const {
+    return tiles.getStartZoom();
+  }
+
+  /// Get the zoom level of the root tiles
+  inline i_zoom
+  getEndZoom() const {
+    return tiles.getEndZoom();
+  }
+
+protected:
+
+  /// A tile on the traversal stack
+  struct Frame {
+    Frame(const TileCoordinate &tile):
+      tile(tile),
+      child(0)
+    {}
+
+    TileCoordinate tile;        ///< The tile being visited
+    unsigned short int child;   ///< The next child of the tile to visit
+  };
+
+  /// Start the traversal of a new subtree
+  void
+  pushRoot(const TileCoordinate &tile) {
+    root = tile;
+    stack.push_back(Frame(tile));
+    descend();
+  }
+
+  /**
+   * @brief Descend the quadtree to the next tile to be visited
+   *
+   * Starting from the top of the stack, the first unvisited child within the
+   * extent is pushed on to the stack until a tile is found at the start zoom
+   * level or a tile whose children have all been visited.  That tile is left
+   * at the top of the stack as the current tile.
+   */
+  void
+  descend() {
+    while (stack.back().tile.zoom < tiles.getStartZoom()) {
+      Frame &frame = stack.back();
+      bool pushed = false;
+
+      while (frame.child < 4) {
+        const unsigned short int child = frame.child++;
+        const TileCoordinate coord(frame.tile.zoom + 1,
+                                   (frame.tile.x * 2) + (child % 2),
+                                   (frame.tile.y * 2) + (child / 2));
+
+        if (tiles.contains(coord)) {
+          stack.push_back(Frame(coord)); // invalidates `frame`
+          pushed = true;
+          break;
+        }
+      }
+
+      if (!pushed)
+        return;                 // all children have been visited
+    }
+  }
+
+  GridIterator tiles;           ///< The tiles within the extent at each zoom level
+  GridIterator roots;           ///< The root tiles at the end zoom level
+  bool singleRoot;              ///< Is only a single subtree being traversed?
+  TileCoordinate root;          ///< The root tile of the current subtree
+  std::vector<Frame> stack;     ///< The path from the root to the current tile
+};
+
+#endif /* QUADTREEITERATOR_HPP */
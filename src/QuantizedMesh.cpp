@@ -0,0 +1,178 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file QuantizedMesh.cpp
+ * @brief This defines the `QuantizedMesh` class
+ */
+
+#include <string.h>             // for memset, memcpy
+#include <cstdio>
+
+#include "CTBException.hpp"
+#include "QuantizedMesh.hpp"
+
+using namespace ctb;
+
+/// The byte size of the encoded header
+static const size_t HEADER_SIZE = 88;
+
+/// Append a value to a buffer in its (little endian) memory representation
+template <typename T>
+static inline void
+append(std::vector<unsigned char> &buffer, T value) {
+  const size_t offset = buffer.size();
+  buffer.resize(offset + sizeof(T));
+  memcpy(buffer.data() + offset, &value, sizeof(T));
+}
+
+/// Append values as the zig-zag encoded differences between them
+static void
+appendZigZagDeltas(std::vector<unsigned char> &buffer, const std::vector<uint16_t> &values) {
+  int previous = 0;
+
+  for (uint16_t value : values) {
+    const int delta = (int) value - previous;
+    append(buffer, (uint16_t) ((delta << 1) ^ (delta >> 31)));
+    previous = value;
+  }
+}
+
+/// Append a list of edge vertex indices preceded by their count
+static void
+appendEdge(std::vector<unsigned char> &buffer, const std::vector<uint32_t> &edge, bool wideIndices) {
+  append(buffer, (uint32_t) edge.size());
+
+  for (uint32_t index : edge) {
+    if (wideIndices)
+      append(buffer, index);
+    else
+      append(buffer, (uint16_t) index);
+  }
+}
+
+QuantizedMesh::QuantizedMesh() {
+  memset(&header, 0, sizeof(header));
+}
+
+/**
+ * @details The data is compressed in the same way as heightmap terrain (see
+ * `Terrain::encode`): Cesium expects quantized mesh tiles to be gzipped.
+ */
+void
+QuantizedMesh::encode(std::vector<unsigned char> &buffer, const TerrainCompression &compression) const {
+  static thread_local std::vector<unsigned char> packed;
+
+  if (compression.method == TerrainCompression::NONE) {
+    pack(buffer);
+  } else {
+    pack(packed);
+    compression.compress(packed, buffer);
+  }
+}
+
+/**
+ * @details The mesh is encoded in memory and written with a single call.
+ */
+void
+QuantizedMesh::writeFile(const char *fileName, const TerrainCompression &compression) const {
+  static thread_local std::vector<unsigned char> buffer;
+  encode(buffer, compression);
+
+  FILE *fp = fopen(fileName, "wb");
+
+  if (fp == NULL) {
+    throw CTBException("Failed to open file");
+  }
+
+  const bool written = fwrite(buffer.data(), buffer.size(), 1, fp) == 1;
+
+  if (fclose(fp) != 0) {
+    throw CTBException("Failed to close file");
+  } else if (!written) {
+    throw CTBException("Failed to write mesh data");
+  }
+}
+
+/**
+ * @details The vertex coordinates and heights are zig-zag delta encoded and
+ * the triangle indices are high water mark encoded.  Indices are 32 bit if
+ * there are more than 65536 vertices, in which case the index data is
+ * aligned to 4 bytes.
+ */
+void
+QuantizedMesh::pack(std::vector<unsigned char> &buffer) const {
+  const size_t count = vertexCount();
+
+  if (v.size() != count || height.size() != count || indices.size() % 3 != 0) {
+    throw CTBException("The quantized mesh vertices are inconsistent");
+  }
+
+  const bool wideIndices = count > 65536;
+
+  buffer.clear();
+  buffer.reserve(HEADER_SIZE + 4 + (count * 6) + 8 + (indices.size() * 4) + 16 +
+                 ((westIndices.size() + southIndices.size() + eastIndices.size() + northIndices.size()) * 4));
+
+  // The header
+  append(buffer, header.centerX);
+  append(buffer, header.centerY);
+  append(buffer, header.centerZ);
+  append(buffer, header.minimumHeight);
+  append(buffer, header.maximumHeight);
+  append(buffer, header.boundingSphereCenterX);
+  append(buffer, header.boundingSphereCenterY);
+  append(buffer, header.boundingSphereCenterZ);
+  append(buffer, header.boundingSphereRadius);
+  append(buffer, header.horizonOcclusionPointX);
+  append(buffer, header.horizonOcclusionPointY);
+  append(buffer, header.horizonOcclusionPointZ);
+
+  // The vertex data
+  append(buffer, (uint32_t) count);
+  appendZigZagDeltas(buffer, u);
+  appendZigZagDeltas(buffer, v);
+  appendZigZagDeltas(buffer, height);
+
+  // The index data
+  if (wideIndices && buffer.size() % 4 != 0) {
+    append(buffer, (uint16_t) 0);
+  }
+
+  append(buffer, (uint32_t) triangleCount());
+
+  uint32_t highest = 0;
+  for (uint32_t index : indices) {
+    if (index > highest) {
+      throw CTBException("The quantized mesh vertices are not in order of first use");
+    }
+
+    const uint32_t code = highest - index;
+    if (code == 0)
+      ++highest;
+
+    if (wideIndices)
+      append(buffer, code);
+    else
+      append(buffer, (uint16_t) code);
+  }
+
+  // The edge indices
+  appendEdge(buffer, westIndices, wideIndices);
+  appendEdge(buffer, southIndices, wideIndices);
+  appendEdge(buffer, eastIndices, wideIndices);
+  appendEdge(buffer, northIndices, wideIndices);
+}
@@ -0,0 +1,128 @@
+#ifndef QUANTIZEDMESH_HPP
+#define QUANTIZEDMESH_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file QuantizedMesh.hpp
+ * @brief This declares the `QuantizedMesh` and `QuantizedMeshTile` classes
+ */
+
+#include <vector>
+
+#include "config.hpp"
+#include "types.hpp"
+#include "Tile.hpp"
+#include "TileCoordinate.hpp"
+#include "TerrainTile.hpp"
+
+namespace ctb {
+  class QuantizedMesh;
+  class QuantizedMeshTile;
+}
+
+/**
+ * @brief Model Cesium's quantized-mesh terrain format
+ *
+ * A quantized mesh is a triangulated irregular network whose vertices are
+ * quantized to the range 0-32767 across the tile (`u` from west to east, `v`
+ * from south to north) and between the minimum and maximum heights of the
+ * tile.  The header locates the tile on the WGS84 ellipsoid in earth centred
+ * earth fixed coordinates for culling.  The vertices on each edge of the tile
+ * are listed so clients can stitch neighbouring tiles together.
+ *
+ * This implements the [quantized-mesh-1.0 terrain
+ * format](https://github.com/CesiumGS/quantized-mesh) without extensions.
+ * The triangles should be counter clockwise and vertices should be numbered in
+ * the order they are first used by the triangles, as required by the high
+ * water mark encoding of the indices.
+ */
+class CTB_DLL ctb::QuantizedMesh {
+public:
+
+  /// The largest quantized vertex coordinate or height
+  static const uint16_t MAX_VALUE = 32767;
+
+  /// The fixed size header of a mesh
+  struct Header {
+    double centerX, centerY, centerZ; ///< The tile centre in ECEF coordinates
+    float minimumHeight;        ///< The minimum height in meters
+    float maximumHeight;        ///< The maximum height in meters
+    double boundingSphereCenterX, boundingSphereCenterY, boundingSphereCenterZ; ///< ECEF
+    double boundingSphereRadius; ///< The bounding sphere radius in meters
+    double horizonOcclusionPointX, horizonOcclusionPointY, horizonOcclusionPointZ; ///< In ellipsoid scaled space
+  };
+
+  /// Create an empty mesh
+  QuantizedMesh();
+
+  /// Encode the mesh in memory as it is written to the filesystem
+  void
+  encode(std::vector<unsigned char> &buffer, const TerrainCompression &compression = TerrainCompression()) const;
+
+  /// Write the mesh to the filesystem
+  void
+  writeFile(const char *fileName, const TerrainCompression &compression = TerrainCompression()) const;
+
+  /// Get the number of vertices
+  inline size_t
+  vertexCount() const {
+    return u.size();
+  }
+
+  /// Get the number of triangles
+  inline size_t
+  triangleCount() const {
+    return indices.size() / 3;
+  }
+
+  Header header;                ///< The mesh header
+
+  std::vector<uint16_t> u;      ///< The quantized vertex longitudes
+  std::vector<uint16_t> v;      ///< The quantized vertex latitudes
+  std::vector<uint16_t> height; ///< The quantized vertex heights
+
+  std::vector<uint32_t> indices; ///< The vertex indices of each triangle
+
+  std::vector<uint32_t> westIndices;  ///< The vertices on the western edge
+  std::vector<uint32_t> southIndices; ///< The vertices on the southern edge
+  std::vector<uint32_t> eastIndices;  ///< The vertices on the eastern edge
+  std::vector<uint32_t> northIndices; ///< The vertices on the northern edge
+
+protected:
+
+  /// Get the uncompressed mesh data
+  void
+  pack(std::vector<unsigned char> &buffer) const;
+};
+
+/**
+ * @brief A `QuantizedMesh` associated with a `Tile`
+ */
+class CTB_DLL ctb::QuantizedMeshTile :
+  public QuantizedMesh, public Tile
+{
+public:
+
+  /// Create an empty mesh tile from a tile coordinate
+  QuantizedMeshTile(const TileCoordinate &coord):
+    QuantizedMesh(),
+    Tile(coord)
+  {}
+};
+
+#endif /* QUANTIZEDMESH_HPP */
@@ -0,0 +1,415 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file QuantizedMeshTiler.cpp
+ * @brief This defines the `QuantizedMeshTiler` class
+ */
+
+#include <cmath>
+#include <algorithm>            // for std::min, std::max, std::fill
+#include <limits>               // for std::numeric_limits
+
+#include "CTBException.hpp"
+#include "QuantizedMeshTiler.hpp"
+
+using namespace ctb;
+
+/// The equatorial radius of the WGS84 ellipsoid in meters
+static const double WGS84_A = 6378137.0;
+
+/// The polar radius of the WGS84 ellipsoid in meters
+static const double WGS84_B = 6356752.3142451793;
+
+/// The first eccentricity squared of the WGS84 ellipsoid
+static const double WGS84_E2 = 0.0066943799901413165;
+
+/// Convert geodetic coordinates in degrees and meters to ECEF coordinates
+static inline void
+geodeticToEcef(double lon, double lat, double height, double (&ecef)[3]) {
+  const double lambda = lon * M_PI / 180.0, phi = lat * M_PI / 180.0,
+    sinPhi = sin(phi), cosPhi = cos(phi),
+    n = WGS84_A / sqrt(1.0 - (WGS84_E2 * sinPhi * sinPhi));
+
+  ecef[0] = (n + height) * cosPhi * cos(lambda);
+  ecef[1] = (n + height) * cosPhi * sin(lambda);
+  ecef[2] = ((n * (1.0 - WGS84_E2)) + height) * sinPhi;
+}
+
+/**
+ * @details This is the magnitude along a direction in ellipsoid scaled space
+ * of the point at which the horizon plane of a position intersects the line
+ * through the direction, as calculated by Cesium's `EllipsoidalOccluder`.  A
+ * non positive value means the position can't be used to cull the tile.
+ */
+static double
+horizonMagnitude(const double (&scaled)[3], const double (&direction)[3]) {
+  const double magnitudeSquared = std::max(1.0, scaled[0] * scaled[0] + scaled[1] * scaled[1] + scaled[2] * scaled[2]),
+    magnitude = sqrt(magnitudeSquared),
+    length = sqrt(scaled[0] * scaled[0] + scaled[1] * scaled[1] + scaled[2] * scaled[2]);
+  const double unit[3] = {scaled[0] / length, scaled[1] / length, scaled[2] / length};
+
+  const double cosAlpha = unit[0] * direction[0] + unit[1] * direction[1] + unit[2] * direction[2],
+    crossX = unit[1] * direction[2] - unit[2] * direction[1],
+    crossY = unit[2] * direction[0] - unit[0] * direction[2],
+    crossZ = unit[0] * direction[1] - unit[1] * direction[0],
+    sinAlpha = sqrt(crossX * crossX + crossY * crossY + crossZ * crossZ),
+    cosBeta = 1.0 / magnitude,
+    sinBeta = sqrt(magnitudeSquared - 1.0) * cosBeta,
+    denominator = (cosAlpha * cosBeta) - (sinAlpha * sinBeta);
+
+  return (denominator > 0) ? 1.0 / denominator : -1.0;
+}
+
+QuantizedMeshTiler::QuantizedMeshTiler(GDALDataset *poDataset, const Grid &grid, const TilerOptions &options):
+  GDALTiler(poDataset, grid, options)
+{
+  const i_tile gridSize = mGrid.tileSize() - 1;
+
+  if (gridSize < 2 || (gridSize & (gridSize - 1)) != 0) {
+    throw CTBException("The tile size of a quantized mesh must be a power of 2 plus 1");
+  } else if (!mGrid.getSRS().IsGeographic()) {
+    throw CTBException("Quantized mesh tiles require a geographic grid");
+  }
+}
+
+QuantizedMeshTiler &
+QuantizedMeshTiler::operator=(const QuantizedMeshTiler &other) {
+  GDALTiler::operator=(other);
+  mTriangleCoords.clear();
+
+  return *this;
+}
+
+/**
+ * @details This follows Cesium's default, where the error at zoom level 0 is
+ * a quarter of the width of a level 0 tile at the equator divided by 65 (the
+ * heightmap tile size), halving with each zoom level.  The factor in the
+ * tiler options scales this: larger factors give simpler meshes.
+ */
+double
+QuantizedMeshTiler::maximumError(i_zoom zoom) const {
+  const double tileWidth = mGrid.tileBounds(TileCoordinate(zoom, 0, 0)).getWidth() * M_PI / 180.0 * WGS84_A;
+  return options.meshErrorFactor * 0.25 * tileWidth / 65.0;
+}
+
+QuantizedMeshTile *
+QuantizedMeshTiler::createTile(const TileCoordinate &coord) const {
+  QuantizedMeshTile *mesh = new QuantizedMeshTile(coord);
+
+  try {
+    createTile(coord, *mesh);
+  } catch (CTBException &) {
+    delete mesh;
+    throw;
+  }
+
+  return mesh;
+}
+
+/**
+ * @details The mesh replaces the contents of `mesh`, whose memory is reused
+ * (see `TilePool`).
+ */
+void
+QuantizedMeshTiler::createTile(const TileCoordinate &coord, QuantizedMeshTile &mesh) const {
+  const i_tile size = mGrid.tileSize(), last = size - 1;
+  mHeights.resize(size * size);
+
+  double adfGeoTransform[6];
+  meshGeoTransform(coord, adfGeoTransform);
+  warpToBuffer(adfGeoTransform, size, size, mHeights.data());
+
+  // Grid points without data are placed at sea level, as in terrain tiles
+  for (float &height : mHeights) {
+    if (height != height)
+      height = 0;
+  }
+
+  computeErrors(mHeights.data());
+
+  // Split the two triangles covering the tile as far as the error requires
+  const float maxError = (float) maximumError(coord.zoom);
+  mTriangles.clear();
+  selectTriangles(0, 0, last, last, last, 0, maxError);
+  selectTriangles(last, last, 0, 0, 0, last, maxError);
+
+  static_cast<TileCoordinate &>(mesh) = coord;
+  mesh.indices.clear();
+  mesh.westIndices.clear();
+  mesh.southIndices.clear();
+  mesh.eastIndices.clear();
+  mesh.northIndices.clear();
+  buildMesh(mesh, mHeights.data());
+}
+
+GDALTile *
+QuantizedMeshTiler::createRasterTile(const TileCoordinate &coord) const {
+  double adfGeoTransform[6];
+  meshGeoTransform(coord, adfGeoTransform);
+
+  return GDALTiler::createRasterTile(adfGeoTransform);
+}
+
+/**
+ * @details The grid points are the pixel centres, so the raster extends half
+ * a pixel beyond the tile on each side.
+ */
+void
+QuantizedMeshTiler::meshGeoTransform(const TileCoordinate &coord, double (&adfGeoTransform)[6]) const {
+  if (poDataset && poDataset->GetRasterCount() < 1) {
+    throw CTBException("At least one band must be present in the GDAL dataset");
+  }
+
+  const CRSBounds tileBounds = mGrid.tileBounds(coord);
+  const double resolution = tileBounds.getWidth() / (mGrid.tileSize() - 1);
+
+  adfGeoTransform[0] = tileBounds.getMinX() - (resolution / 2);
+  adfGeoTransform[1] = resolution;
+  adfGeoTransform[2] = 0;
+  adfGeoTransform[3] = tileBounds.getMaxY() + (resolution / 2);
+  adfGeoTransform[4] = 0;
+  adfGeoTransform[5] = -resolution;
+}
+
+/**
+ * @details Each triangle in the hierarchy is identified by the grid points at
+ * the ends of its hypotenuse, which are cached as they only depend on the
+ * tile size.  Visiting the triangles from the smallest up, the error of a
+ * triangle is the difference between the height at the middle of its
+ * hypotenuse and the interpolated height, or the error of either of its
+ * children if greater.  The error is stored at the middle of the hypotenuse,
+ * which is where the triangle is split.
+ */
+void
+QuantizedMeshTiler::computeErrors(const float *heights) const {
+  const int size = mGrid.tileSize(), tileSize = size - 1,
+    triangleCount = (tileSize * tileSize * 2) - 2,
+    parentCount = triangleCount - (tileSize * tileSize);
+
+  if (mTriangleCoords.empty()) {
+    mTriangleCoords.resize(triangleCount * 4);
+
+    for (int i = 0; i < triangleCount; i++) {
+      int id = i + 2, ax = 0, ay = 0, bx = 0, by = 0, cx = 0, cy = 0;
+
+      if (id & 1) {
+        bx = by = cx = tileSize; // bottom left triangle
+      } else {
+        ax = ay = cy = tileSize; // top right triangle
+      }
+
+      while ((id >>= 1) > 1) {
+        const int mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+
+        if (id & 1) {           // left half
+          bx = ax; by = ay;
+          ax = cx; ay = cy;
+        } else {                // right half
+          ax = bx; ay = by;
+          bx = cx; by = cy;
+        }
+        cx = mx; cy = my;
+      }
+
+      uint16_t *coords = &mTriangleCoords[i * 4];
+      coords[0] = ax; coords[1] = ay; coords[2] = bx; coords[3] = by;
+    }
+  }
+
+  mErrors.assign(size * size, 0);
+
+  for (int i = triangleCount - 1; i >= 0; i--) {
+    const uint16_t *coords = &mTriangleCoords[i * 4];
+    const int ax = coords[0], ay = coords[1], bx = coords[2], by = coords[3],
+      mx = (ax + bx) >> 1, my = (ay + by) >> 1,
+      cx = mx + my - ay, cy = my + ax - mx;
+
+    const float interpolated = (heights[(ay * size) + ax] + heights[(by * size) + bx]) / 2;
+    const int middle = (my * size) + mx;
+    float &error = mErrors[middle];
+
+    error = std::max(error, std::fabs(interpolated - heights[middle]));
+
+    if (i < parentCount) {
+      const int left = (((ay + cy) >> 1) * size) + ((ax + cx) >> 1),
+        right = (((by + cy) >> 1) * size) + ((bx + cx) >> 1);
+      error = std::max(error, std::max(mErrors[left], mErrors[right]));
+    }
+  }
+}
+
+/**
+ * @details `a` and `b` are the ends of the hypotenuse and `c` is the right
+ * angled corner.  The grid point indices of each selected triangle are added
+ * counter clockwise as seen from above, the grid rows running from north to
+ * south.
+ */
+void
+QuantizedMeshTiler::selectTriangles(int ax, int ay, int bx, int by, int cx, int cy, float maxError) const {
+  const int size = mGrid.tileSize(),
+    mx = (ax + bx) >> 1, my = (ay + by) >> 1;
+
+  if (std::abs(ax - cx) + std::abs(ay - cy) > 1 && mErrors[(my * size) + mx] > maxError) {
+    selectTriangles(cx, cy, ax, ay, mx, my, maxError);
+    selectTriangles(bx, by, cx, cy, mx, my, maxError);
+    return;
+  }
+
+  // With y increasing southwards a positive cross product is clockwise
+  const int cross = ((bx - ax) * (cy - ay)) - ((by - ay) * (cx - ax));
+
+  mTriangles.push_back((ay * size) + ax);
+  if (cross > 0) {
+    mTriangles.push_back((cy * size) + cx);
+    mTriangles.push_back((by * size) + bx);
+  } else {
+    mTriangles.push_back((by * size) + bx);
+    mTriangles.push_back((cy * size) + cx);
+  }
+}
+
+/**
+ * @details Vertices are numbered in the order they are first used by the
+ * triangles.  The header is calculated from the vertex positions: the bounding
+ * sphere is centred on the box bounding the vertices and the horizon
+ * occlusion point is the point along the direction of the tile centre that
+ * is only below the horizon when every vertex is, if there is one.
+ */
+void
+QuantizedMeshTiler::buildMesh(QuantizedMeshTile &mesh, const float *heights) const {
+  const i_tile size = mGrid.tileSize(), last = size - 1;
+  std::vector<uint32_t> &gridPoints = mGridPoints;
+  gridPoints.clear();
+
+  // Number the vertices
+  mVertexIndices.assign(size * size, 0);
+  mesh.indices.reserve(mTriangles.size());
+
+  for (uint32_t point : mTriangles) {
+    uint32_t &vertex = mVertexIndices[point];
+
+    if (vertex == 0) {
+      gridPoints.push_back(point);
+      vertex = gridPoints.size();
+    }
+
+    mesh.indices.push_back(vertex - 1);
+  }
+
+  // The height range
+  float minHeight = heights[gridPoints[0]], maxHeight = minHeight;
+  for (uint32_t point : gridPoints) {
+    minHeight = std::min(minHeight, heights[point]);
+    maxHeight = std::max(maxHeight, heights[point]);
+  }
+
+  const CRSBounds tileBounds = mGrid.tileBounds(mesh);
+  const double resolution = tileBounds.getWidth() / last,
+    heightScale = (maxHeight > minHeight) ? QuantizedMesh::MAX_VALUE / (double) (maxHeight - minHeight) : 0;
+
+  mesh.header.minimumHeight = minHeight;
+  mesh.header.maximumHeight = maxHeight;
+
+  double center[3];
+  geodeticToEcef((tileBounds.getMinX() + tileBounds.getMaxX()) / 2,
+                 (tileBounds.getMinY() + tileBounds.getMaxY()) / 2,
+                 (minHeight + maxHeight) / 2.0, center);
+  mesh.header.centerX = center[0];
+  mesh.header.centerY = center[1];
+  mesh.header.centerZ = center[2];
+
+  // Quantize the vertices, recording their positions
+  const size_t count = gridPoints.size();
+  std::vector<double> &positions = mPositions;
+  positions.resize(count * 3);
+  double minimum[3] = {HUGE_VAL, HUGE_VAL, HUGE_VAL}, maximum[3] = {-HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+
+  mesh.u.resize(count);
+  mesh.v.resize(count);
+  mesh.height.resize(count);
+
+  for (size_t i = 0; i < count; i++) {
+    const i_tile x = gridPoints[i] % size, y = gridPoints[i] / size;
+    const float height = heights[gridPoints[i]];
+
+    mesh.u[i] = (uint16_t) ((x * QuantizedMesh::MAX_VALUE + (last / 2)) / last);
+    mesh.v[i] = (uint16_t) (((last - y) * QuantizedMesh::MAX_VALUE + (last / 2)) / last);
+    mesh.height[i] = (uint16_t) std::lround((height - minHeight) * heightScale);
+
+    if (x == 0) mesh.westIndices.push_back(i);
+    if (x == last) mesh.eastIndices.push_back(i);
+    if (y == last) mesh.southIndices.push_back(i);
+    if (y == 0) mesh.northIndices.push_back(i);
+
+    double position[3];
+    geodeticToEcef(tileBounds.getMinX() + (x * resolution), tileBounds.getMaxY() - (y * resolution),
+                   height, position);
+
+    for (int j = 0; j < 3; j++) {
+      positions[(i * 3) + j] = position[j];
+      minimum[j] = std::min(minimum[j], position[j]);
+      maximum[j] = std::max(maximum[j], position[j]);
+    }
+  }
+
+  // The bounding sphere
+  double sphere[3], radiusSquared = 0;
+  for (int j = 0; j < 3; j++) {
+    sphere[j] = (minimum[j] + maximum[j]) / 2;
+  }
+  for (size_t i = 0; i < count; i++) {
+    const double *position = &positions[i * 3],
+      dx = position[0] - sphere[0], dy = position[1] - sphere[1], dz = position[2] - sphere[2];
+    radiusSquared = std::max(radiusSquared, dx * dx + dy * dy + dz * dz);
+  }
+  mesh.header.boundingSphereCenterX = sphere[0];
+  mesh.header.boundingSphereCenterY = sphere[1];
+  mesh.header.boundingSphereCenterZ = sphere[2];
+  mesh.header.boundingSphereRadius = sqrt(radiusSquared);
+
+  // The horizon occlusion point, in ellipsoid scaled space
+  const double radii[3] = {WGS84_A, WGS84_A, WGS84_B};
+  double direction[3], length = 0;
+  for (int j = 0; j < 3; j++) {
+    direction[j] = center[j] / radii[j];
+    length += direction[j] * direction[j];
+  }
+  length = sqrt(length);
+  for (int j = 0; j < 3; j++) {
+    direction[j] /= length;
+  }
+
+  double magnitude = 0;
+  for (size_t i = 0; i < count && magnitude >= 0; i++) {
+    const double scaled[3] = {positions[i * 3] / radii[0], positions[(i * 3) + 1] / radii[1],
+                              positions[(i * 3) + 2] / radii[2]};
+    const double candidate = horizonMagnitude(scaled, direction);
+    magnitude = (candidate < 0) ? -1.0 : std::max(magnitude, candidate);
+  }
+
+  // Cesium leaves the point of a tile too large to be culled by the horizon
+  // undefined, which disables culling.  No position is visible from every
+  // camera, so NaN is used instead: each comparison in Cesium's
+  // `EllipsoidalOccluder.isScaledSpacePointVisible` is then false and the
+  // point is never occluded.
+  if (magnitude < 0)
+    magnitude = std::numeric_limits<double>::quiet_NaN();
+
+  mesh.header.horizonOcclusionPointX = direction[0] * magnitude;
+  mesh.header.horizonOcclusionPointY = direction[1] * magnitude;
+  mesh.header.horizonOcclusionPointZ = direction[2] * magnitude;
+}
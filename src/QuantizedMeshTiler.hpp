@@ -0,0 +1,130 @@
+#ifndef QUANTIZEDMESHTILER_HPP
+#define QUANTIZEDMESHTILER_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file QuantizedMeshTiler.hpp
+ * @brief This declares the `QuantizedMeshTiler` class
+ */
+
+#include <vector>
+
+#include "QuantizedMesh.hpp"
+#include "GDALTiler.hpp"
+
+namespace ctb {
+  class QuantizedMeshTiler;
+}
+
+/**
+ * @brief Create `QuantizedMeshTile`s from a GDAL Dataset
+ *
+ * The heights of a tile are warped onto a grid of `Grid::tileSize` by
+ * `Grid::tileSize` points, the outermost points lying on the tile edges so
+ * neighbouring tiles share their edge vertices.  The tile size must be a
+ * power of two plus one (e.g. 65 or 257).  Grid points without any source
+ * data are set to sea level.
+ *
+ * The grid is simplified to a triangulated irregular network using a right
+ * triangulated irregular network (RTIN): the grid is recursively split into
+ * right angled triangles and the approximation error of each triangle is
+ * computed bottom up in a single pass.  A mesh is then extracted by only
+ * splitting triangles whose error exceeds the maximum geometric error of the
+ * zoom level (see `QuantizedMeshTiler::maximumError`).  Both steps are linear
+ * in the number of grid points.
+ *
+ * The grid must use a geographic coordinate system, as quantized mesh
+ * vertices are linear in longitude and latitude within a tile.
+ */
+class CTB_DLL ctb::QuantizedMeshTiler :
+  public GDALTiler
+{
+public:
+
+  /// Instantiate a tiler with all required arguments
+  QuantizedMeshTiler(GDALDataset *poDataset, const Grid &grid, const TilerOptions &options);
+
+  /// Instantiate a tiler with an empty GDAL dataset
+  QuantizedMeshTiler():
+    GDALTiler() {}
+
+  /// Instantiate a tiler with a dataset and grid but no options
+  QuantizedMeshTiler(GDALDataset *poDataset, const Grid &grid):
+    QuantizedMeshTiler(poDataset, grid, TilerOptions()) {}
+
+  /// Overload the assignment operator
+  QuantizedMeshTiler &
+  operator=(const QuantizedMeshTiler &other);
+
+  /// Override to return a covariant data type
+  QuantizedMeshTile *
+  createTile(const TileCoordinate &coord) const override;
+
+  /// Create a tile in an existing mesh, reusing its memory
+  void
+  createTile(const TileCoordinate &coord, QuantizedMeshTile &mesh) const;
+
+  /// Get the maximum geometric error in meters allowed for a zoom level
+  double
+  maximumError(i_zoom zoom) const;
+
+protected:
+
+  /// Create a `GDALTile` representing the required mesh height data
+  virtual GDALTile *
+  createRasterTile(const TileCoordinate &coord) const override;
+
+  /// Get the geo transform placing grid points on the tile edges
+  void
+  meshGeoTransform(const TileCoordinate &coord, double (&adfGeoTransform)[6]) const;
+
+  /// Calculate the approximation error of every triangle in the RTIN hierarchy
+  void
+  computeErrors(const float *heights) const;
+
+  /// Select the triangles whose parents exceed an error, depth first
+  void
+  selectTriangles(int ax, int ay, int bx, int by, int cx, int cy, float maxError) const;
+
+  /// Build the mesh from the selected triangles
+  void
+  buildMesh(QuantizedMeshTile &mesh, const float *heights) const;
+
+  /// The heights warped for the most recent tile
+  mutable std::vector<float> mHeights;
+
+  /// The grid point of each mesh vertex
+  mutable std::vector<uint32_t> mGridPoints;
+
+  /// The ECEF position of each mesh vertex
+  mutable std::vector<double> mPositions;
+
+  /// The grid point coordinates of the triangles in the RTIN hierarchy
+  mutable std::vector<uint16_t> mTriangleCoords;
+
+  /// The approximation error at each grid point
+  mutable std::vector<float> mErrors;
+
+  /// The grid point indices of the selected triangles
+  mutable std::vector<uint32_t> mTriangles;
+
+  /// The mesh vertex for each grid point, plus one, or zero if unused
+  mutable std::vector<uint32_t> mVertexIndices;
+};
+
+#endif /* QUANTIZEDMESHTILER_HPP */
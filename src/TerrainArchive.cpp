@@ -0,0 +1,490 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TerrainArchive.cpp
+ * @brief This defines the `TerrainArchiveWriter` and `TerrainArchiveReader`
+ * classes
+ */
+
+#include <string.h>             // for memcmp, memcpy
+#include <algorithm>            // for std::stable_sort
+
+#ifndef _WIN32
+#include <fcntl.h>              // for open
+#include <sys/mman.h>           // for mmap
+#include <sys/stat.h>           // for fstat
+#include <unistd.h>             // for close
+#endif
+
+#include "CTBException.hpp"
+#include "TerrainArchive.hpp"
+
+using namespace ctb;
+
+/// The magic bytes identifying a terrain archive, also ending the trailer
+static const char ARCHIVE_MAGIC[8] = {'C', 'T', 'B', 'T', 'E', 'R', 'R', 'A'};
+
+/// The version of the archive format
+static const uint32_t ARCHIVE_VERSION = 1;
+
+/// The byte size of the archive header (magic, version and padding)
+static const size_t HEADER_SIZE = 16;
+
+/// The byte size of the archive trailer (index offset, entry count and magic)
+static const size_t TRAILER_SIZE = 24;
+
+/// The byte size of an index entry (key, offset, size and padding)
+static const size_t ENTRY_SIZE = 24;
+
+/// The number of bits used for each of the x and y values in an index key
+static const unsigned int KEY_COORD_BITS = 29;
+
+/// Store a 32 bit value as little endian bytes
+static inline void
+putUInt32(unsigned char *bytes, uint32_t value) {
+  for (int i = 0; i < 4; ++i) {
+    bytes[i] = (unsigned char) (value >> (8 * i));
+  }
+}
+
+/// Store a 64 bit value as little endian bytes
+static inline void
+putUInt64(unsigned char *bytes, uint64_t value) {
+  for (int i = 0; i < 8; ++i) {
+    bytes[i] = (unsigned char) (value >> (8 * i));
+  }
+}
+
+/// Read a 32 bit value from little endian bytes
+static inline uint32_t
+getUInt32(const unsigned char *bytes) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; --i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+/// Read a 64 bit value from little endian bytes
+static inline uint64_t
+getUInt64(const unsigned char *bytes) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+/// Spread the bits of a value out so they occupy every other bit
+static inline uint64_t
+spreadBits(uint64_t value) {
+  value &= 0x1fffffff;                               // 29 bits
+  value = (value | (value << 16)) & 0x0000ffff0000ffffULL;
+  value = (value | (value << 8)) & 0x00ff00ff00ff00ffULL;
+  value = (value | (value << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+  value = (value | (value << 2)) & 0x3333333333333333ULL;
+  value = (value | (value << 1)) & 0x5555555555555555ULL;
+  return value;
+}
+
+/**
+ * @details The zoom level occupies the top 6 bits of the key, and the bits of
+ * the x and y values are interleaved in the remaining 58 bits.  Sorting by
+ * key therefore sorts by zoom level and then along a Z-order curve.
+ */
+uint64_t
+TerrainArchiveEntry::tileKey(const TileCoordinate &coord) {
+  if (coord.x >> KEY_COORD_BITS || coord.y >> KEY_COORD_BITS || coord.zoom > 63) {
+    throw CTBException("The tile coordinate is too large for a terrain archive");
+  }
+
+  return ((uint64_t) coord.zoom << (KEY_COORD_BITS * 2)) |
+    (spreadBits(coord.y) << 1) | spreadBits(coord.x);
+}
+
+/// Order index entries by their key
+static bool
+entryBefore(const TerrainArchiveEntry &a, const TerrainArchiveEntry &b) {
+  return a.key < b.key;
+}
+
+TerrainArchiveWriter::TerrainArchiveWriter(const char *fileName, bool shareDuplicates,
+                                           const TerrainCompression &compression):
+  mFile(NULL),
+  mOffset(0),
+  mShareDuplicates(shareDuplicates),
+  mCompression(compression),
+  mDuplicateCount(0)
+{
+  mFile = fopen(fileName, "wb");
+  if (mFile == NULL) {
+    throw CTBException("Could not create the terrain archive");
+  }
+
+  // Tiles are appended in large sequential writes
+  setvbuf(mFile, NULL, _IOFBF, 1 << 20);
+
+  unsigned char header[HEADER_SIZE] = {0};
+  memcpy(header, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+  putUInt32(header + sizeof(ARCHIVE_MAGIC), ARCHIVE_VERSION);
+
+  try {
+    write(header, HEADER_SIZE);
+  } catch (CTBException &e) {
+    fclose(mFile);
+    throw;
+  }
+}
+
+/**
+ * @details Any errors are ignored: call `TerrainArchiveWriter::close` first
+ * in order to handle them.
+ */
+TerrainArchiveWriter::~TerrainArchiveWriter() {
+  try {
+    close();
+  } catch (CTBException &e) {}
+}
+
+/**
+ * @details When duplicates are shared the uncompressed tile is hashed and
+ * looked up first, so a duplicate tile is never compressed.  Otherwise the
+ * tile is encoded before the archive is locked so that multiple threads can
+ * compress tiles at the same time, each reusing its own buffer.  The lookup is
+ * repeated once the tile is encoded in case another thread has written an
+ * identical tile in the meantime.
+ */
+void
+TerrainArchiveWriter::writeTile(const TerrainTile &tile) {
+  static thread_local std::vector<unsigned char> data;
+  TerrainHash hash;
+
+  TerrainArchiveEntry entry;
+  entry.key = TerrainArchiveEntry::tileKey(tile);
+  entry.reserved = 0;
+
+  if (mShareDuplicates) {
+    hash = tile.hash();
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mFile == NULL) {
+      throw CTBException("The terrain archive is closed");
+    } else if (addDuplicate(hash, entry)) {
+      return;
+    }
+  }
+
+  tile.encode(data, mCompression);
+
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  if (mFile == NULL) {
+    throw CTBException("The terrain archive is closed");
+  } else if (mShareDuplicates && addDuplicate(hash, entry)) {
+    return;
+  }
+
+  entry.offset = mOffset;
+  entry.size = (uint32_t) data.size();
+  write(data.data(), data.size());
+  mIndex.push_back(entry);
+
+  if (mShareDuplicates)
+    mWritten[hash] = entry;
+}
+
+/**
+ * @details If a tile with the hash has already been written the entry is
+ * indexed as referencing its data.  The archive must be locked by the
+ * caller.
+ */
+bool
+TerrainArchiveWriter::addDuplicate(const TerrainHash &hash, TerrainArchiveEntry &entry) {
+  auto found = mWritten.find(hash);
+  if (found == mWritten.end())
+    return false;
+
+  entry.offset = found->second.offset;
+  entry.size = found->second.size;
+  mIndex.push_back(entry);
+  ++mDuplicateCount;
+
+  return true;
+}
+
+/**
+ * @details The index is written after the tile data, aligned to 8 bytes so
+ * that a reader can use it in place.  Calling this more than once has no
+ * effect.
+ */
+void
+TerrainArchiveWriter::close() {
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  if (mFile == NULL)
+    return;
+
+  try {
+    std::stable_sort(mIndex.begin(), mIndex.end(), entryBefore);
+
+    // A tile written more than once is only indexed once, the last write
+    // winning
+    std::vector<TerrainArchiveEntry>::iterator last = mIndex.begin();
+    for (std::vector<TerrainArchiveEntry>::iterator it = mIndex.begin(); it != mIndex.end(); ++it) {
+      if (it != mIndex.begin() && it->key == (last - 1)->key) {
+        *(last - 1) = *it;
+      } else {
+        *last++ = *it;
+      }
+    }
+    mIndex.erase(last, mIndex.end());
+
+    const unsigned char padding[8] = {0};
+    write(padding, (8 - (mOffset % 8)) % 8);
+
+    const uint64_t indexOffset = mOffset;
+    std::vector<unsigned char> bytes(ENTRY_SIZE);
+    for (const TerrainArchiveEntry &entry : mIndex) {
+      putUInt64(&bytes[0], entry.key);
+      putUInt64(&bytes[8], entry.offset);
+      putUInt32(&bytes[16], entry.size);
+      putUInt32(&bytes[20], entry.reserved);
+      write(bytes.data(), ENTRY_SIZE);
+    }
+
+    unsigned char trailer[TRAILER_SIZE];
+    putUInt64(trailer, indexOffset);
+    putUInt64(trailer + 8, mIndex.size());
+    memcpy(trailer + 16, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    write(trailer, TRAILER_SIZE);
+  } catch (CTBException &e) {
+    fclose(mFile);
+    mFile = NULL;
+    throw;
+  }
+
+  const int status = fclose(mFile);
+  mFile = NULL;
+  mWritten.clear();
+
+  if (status != 0) {
+    throw CTBException("Could not close the terrain archive");
+  }
+}
+
+i_tile
+TerrainArchiveWriter::tileCount() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mIndex.size();
+}
+
+i_tile
+TerrainArchiveWriter::duplicateCount() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mDuplicateCount;
+}
+
+void
+TerrainArchiveWriter::write(const void *data, size_t size) {
+  if (size > 0 && fwrite(data, size, 1, mFile) != 1) {
+    throw CTBException("Could not write to the terrain archive");
+  }
+
+  mOffset += size;
+}
+
+/**
+ * @details The archive is validated against its header and trailer.  The
+ * whole file is mapped into memory, relying on the operating system to page
+ * in the tiles that are actually read.
+ */
+TerrainArchiveReader::TerrainArchiveReader(const char *fileName):
+  mData(NULL),
+  mSize(0),
+  mIndex(NULL),
+  mEntryCount(0)
+{
+#ifdef _WIN32
+  FILE *fp = fopen(fileName, "rb");
+  if (fp == NULL) {
+    throw CTBException("Could not open the terrain archive");
+  }
+
+  fseek(fp, 0, SEEK_END);
+  mBuffer.resize(ftell(fp));
+  fseek(fp, 0, SEEK_SET);
+
+  const bool read = mBuffer.empty() || fread(mBuffer.data(), mBuffer.size(), 1, fp) == 1;
+  fclose(fp);
+  if (!read) {
+    throw CTBException("Could not read the terrain archive");
+  }
+
+  mData = mBuffer.data();
+  mSize = mBuffer.size();
+#else
+  const int fd = open(fileName, O_RDONLY);
+  if (fd == -1) {
+    throw CTBException("Could not open the terrain archive");
+  }
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0) {
+    ::close(fd);
+    throw CTBException("Could not get the size of the terrain archive");
+  }
+  mSize = fileStat.st_size;
+
+  if (mSize > 0) {
+    void *mapping = mmap(NULL, mSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+      ::close(fd);
+      throw CTBException("Could not map the terrain archive into memory");
+    }
+    mData = (const unsigned char *) mapping;
+  }
+
+  ::close(fd);                  // the mapping remains valid
+#endif
+
+  // Check the header and trailer
+  uint32_t version = 0;
+  uint64_t indexOffset = 0;
+  const unsigned char *trailer = NULL;
+
+  if (mSize >= HEADER_SIZE + TRAILER_SIZE) {
+    trailer = mData + mSize - TRAILER_SIZE;
+    version = getUInt32(mData + sizeof(ARCHIVE_MAGIC));
+    indexOffset = getUInt64(trailer);
+    mEntryCount = getUInt64(trailer + 8);
+  }
+
+  const char *error = NULL;
+  if (trailer == NULL ||
+      memcmp(mData, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+      memcmp(trailer + 16, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0) {
+    error = "The file is not a complete terrain archive";
+  } else if (version != ARCHIVE_VERSION) {
+    error = "The terrain archive version is not supported";
+  } else if (indexOffset % 8 != 0 || indexOffset < HEADER_SIZE ||
+             mEntryCount > (mSize - TRAILER_SIZE - indexOffset) / ENTRY_SIZE ||
+             indexOffset + (mEntryCount * ENTRY_SIZE) != mSize - TRAILER_SIZE) {
+    error = "The terrain archive index is corrupt";
+  }
+
+  if (error != NULL) {
+#ifndef _WIN32
+    if (mData != NULL)
+      munmap((void *) mData, mSize);
+#endif
+    throw CTBException(error);
+  }
+
+  mIndex = mData + indexOffset;
+}
+
+TerrainArchiveReader::~TerrainArchiveReader() {
+#ifndef _WIN32
+  if (mData != NULL)
+    munmap((void *) mData, mSize);
+#endif
+}
+
+/**
+ * @details The returned data points into the archive and remains valid for
+ * the lifetime of the reader.
+ */
+bool
+TerrainArchiveReader::getTile(const TileCoordinate &coord, const unsigned char *&data, size_t &size) const {
+  TerrainArchiveEntry entry;
+
+  if (!find(coord, entry))
+    return false;
+
+  if (entry.offset < HEADER_SIZE || entry.offset + entry.size > mSize) {
+    throw CTBException("The terrain archive index is corrupt");
+  }
+
+  data = mData + entry.offset;
+  size = entry.size;
+
+  return true;
+}
+
+/**
+ * @details This returns `NULL` if the tile is not present.  Otherwise the
+ * caller is responsible for deleting the tile.
+ */
+TerrainTile *
+TerrainArchiveReader::readTile(const TileCoordinate &coord) const {
+  const unsigned char *data;
+  size_t size;
+
+  if (!getTile(coord, data, size))
+    return NULL;
+
+  TerrainTile *tile = new TerrainTile(coord);
+  try {
+    tile->decode(data, size);
+  } catch (CTBException &e) {
+    delete tile;
+    throw;
+  }
+
+  return tile;
+}
+
+bool
+TerrainArchiveReader::contains(const TileCoordinate &coord) const {
+  TerrainArchiveEntry entry;
+  return find(coord, entry);
+}
+
+/**
+ * @details The index is binary searched in place, decoding only the keys of
+ * the entries visited.
+ */
+bool
+TerrainArchiveReader::find(const TileCoordinate &coord, TerrainArchiveEntry &entry) const {
+  const uint64_t key = TerrainArchiveEntry::tileKey(coord);
+  uint64_t first = 0, count = mEntryCount;
+
+  while (count > 0) {
+    const uint64_t step = count / 2, middle = first + step;
+
+    if (getUInt64(mIndex + (middle * ENTRY_SIZE)) < key) {
+      first = middle + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+
+  if (first == mEntryCount)
+    return false;
+
+  const unsigned char *bytes = mIndex + (first * ENTRY_SIZE);
+  entry.key = getUInt64(bytes);
+  if (entry.key != key)
+    return false;
+
+  entry.offset = getUInt64(bytes + 8);
+  entry.size = getUInt32(bytes + 16);
+  entry.reserved = getUInt32(bytes + 20);
+
+  return true;
+}
@@ -0,0 +1,215 @@
+#ifndef TERRAINARCHIVE_HPP
+#define TERRAINARCHIVE_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TerrainArchive.hpp
+ * @brief This declares the `TerrainArchiveWriter` and `TerrainArchiveReader`
+ * classes
+ */
+
+#include <cstdio>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+
+#include "config.hpp"
+#include "types.hpp"
+#include "TileCoordinate.hpp"
+#include "TerrainTile.hpp"
+
+namespace ctb {
+  struct TerrainArchiveEntry;
+  class TerrainArchiveWriter;
+  class TerrainArchiveReader;
+}
+
+/**
+ * @brief An entry in the index of a terrain archive
+ *
+ * A terrain archive is a single file containing a tileset.  It consists of a
+ * 16 byte header, the encoded tiles in the order they were written, an index
+ * of `TerrainArchiveEntry` records and a 24 byte trailer locating the index.
+ * The index is sorted by zoom level and then by the Morton code of the tile
+ * (i.e. quadkey order) so tiles can be found by a binary search, and
+ * spatially close tiles have nearby entries.  Identical tiles can share the
+ * same data.  All values are serialised as little endian, each entry
+ * occupying 24 bytes in the order of the fields below, whatever the byte
+ * order and structure layout of the host.
+ */
+struct ctb::TerrainArchiveEntry {
+  uint64_t key;                 ///< The zoom level and Morton code of the tile
+  uint64_t offset;              ///< The position of the tile data in the file
+  uint32_t size;                ///< The byte size of the tile data
+  uint32_t reserved;            ///< Padding, set to zero
+
+  /// Create the index key for a tile coordinate
+  static uint64_t
+  tileKey(const TileCoordinate &coord);
+};
+
+/**
+ * @brief Write terrain tiles to a terrain archive
+ *
+ * Tiles are appended to the archive as they are written, which is thread
+ * safe.  The index is only written when the archive is closed, so an archive
+ * that is not closed cannot be read.  If duplicate tiles are being shared,
+ * a tile that is identical to one already written is only added to the
+ * index, referencing the existing data.
+ */
+class CTB_DLL ctb::TerrainArchiveWriter {
+public:
+
+  /// Create a terrain archive, replacing any existing file
+  TerrainArchiveWriter(const char *fileName, bool shareDuplicates = true,
+                       const TerrainCompression &compression = TerrainCompression());
+
+  /// Close the archive
+  ~TerrainArchiveWriter();
+
+  /// Append a terrain tile to the archive
+  void
+  writeTile(const TerrainTile &tile);
+
+  /// Write the index and close the archive
+  void
+  close();
+
+  /// Get the number of tiles written to the archive
+  i_tile
+  tileCount() const;
+
+  /// Get the number of tiles written that share the data of another tile
+  i_tile
+  duplicateCount() const;
+
+protected:
+
+  /// Hash a `TerrainHash` for use as an unordered map key
+  struct HashHasher {
+    size_t
+    operator()(const TerrainHash &hash) const {
+      return (size_t) hash.first;
+    }
+  };
+
+  /// Write bytes to the archive
+  void
+  write(const void *data, size_t size);
+
+  /// Index a tile as a duplicate if identical data has been written
+  bool
+  addDuplicate(const TerrainHash &hash, TerrainArchiveEntry &entry);
+
+  /// The archive file
+  FILE *mFile;
+
+  /// The position at which the next tile will be written
+  uint64_t mOffset;
+
+  /// Should identical tiles share their data?
+  bool mShareDuplicates;
+
+  /// How the tiles are compressed
+  TerrainCompression mCompression;
+
+  /// The index entries for the tiles written so far
+  std::vector<TerrainArchiveEntry> mIndex;
+
+  /// The location of the data written for each distinct tile
+  std::unordered_map<TerrainHash, TerrainArchiveEntry, HashHasher> mWritten;
+
+  /// The number of tiles sharing the data of another tile
+  i_tile mDuplicateCount;
+
+  /// Serialises writes to the archive
+  mutable std::mutex mMutex;
+
+private:
+
+  /// The writer owns a file handle so it can't be copied
+  TerrainArchiveWriter(const TerrainArchiveWriter &);
+  TerrainArchiveWriter &operator=(const TerrainArchiveWriter &);
+};
+
+/**
+ * @brief Read terrain tiles from a terrain archive
+ *
+ * The archive is memory mapped so tile data is returned as a pointer into the
+ * mapping without being copied, e.g. for sending to a client as is.  It can
+ * also be decoded into a `Terrain` object.  A reader can be shared between
+ * threads.
+ */
+class CTB_DLL ctb::TerrainArchiveReader {
+public:
+
+  /// Open a terrain archive
+  TerrainArchiveReader(const char *fileName);
+
+  /// Unmap the archive
+  ~TerrainArchiveReader();
+
+  /// Get the encoded data for a tile, returning `false` if it is not present
+  bool
+  getTile(const TileCoordinate &coord, const unsigned char *&data, size_t &size) const;
+
+  /// Read a tile from the archive
+  TerrainTile *
+  readTile(const TileCoordinate &coord) const;
+
+  /// Is a tile present in the archive?
+  bool
+  contains(const TileCoordinate &coord) const;
+
+  /// Get the number of tiles in the archive
+  i_tile
+  tileCount() const {
+    return mEntryCount;
+  }
+
+protected:
+
+  /// Find the index entry for a tile, returning `false` if it is not present
+  bool
+  find(const TileCoordinate &coord, TerrainArchiveEntry &entry) const;
+
+  /// The start of the archive in memory
+  const unsigned char *mData;
+
+  /// The byte size of the archive
+  size_t mSize;
+
+  /// The sorted index, as serialised in the archive
+  const unsigned char *mIndex;
+
+  /// The number of entries in the index
+  uint64_t mEntryCount;
+
+#ifdef _WIN32
+  /// The archive contents if memory mapping isn't available
+  std::vector<unsigned char> mBuffer;
+#endif
+
+private:
+
+  /// The reader owns a mapping so it can't be copied
+  TerrainArchiveReader(const TerrainArchiveReader &);
+  TerrainArchiveReader &operator=(const TerrainArchiveReader &);
+};
+
+#endif /* TERRAINARCHIVE_HPP */
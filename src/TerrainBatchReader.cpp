@@ -0,0 +1,245 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TerrainBatchReader.cpp
+ * @brief This defines the `TerrainBatchReader` class
+ */
+
+#include <string.h>             // for memset, memcpy
+#include <cstdio>
+
+#ifndef _WIN32
+#include <fcntl.h>              // for open
+#include <sys/stat.h>           // for fstat
+#include <unistd.h>             // for read, close
+#endif
+
+#include "CTBException.hpp"
+#include "TerrainBatchReader.hpp"
+
+using namespace ctb;
+
+/// The byte size of uncompressed terrain data with a full water mask
+static const size_t MAX_TERRAIN_SIZE =
+  (TerrainBatchReader::TILE_CELL_COUNT * 2) + 1 + TerrainBatchReader::MASK_CELL_COUNT;
+
+/// The byte size of uncompressed terrain data with a single water mask value
+static const size_t MIN_TERRAIN_SIZE = (TerrainBatchReader::TILE_CELL_COUNT * 2) + 2;
+
+TerrainBatchReader::TerrainBatchReader():
+  mInflateBuffer(MAX_TERRAIN_SIZE + 1)
+{
+  memset(&mStream, 0, sizeof(mStream));
+
+  // A window size of 15 plus 32 detects either a gzip or zlib wrapper
+  if (inflateInit2(&mStream, 15 + 32) != Z_OK) {
+    throw CTBException("Failed to initialise decompression");
+  }
+}
+
+TerrainBatchReader::~TerrainBatchReader() {
+  inflateEnd(&mStream);
+}
+
+/**
+ * @details The data is either gzipped, as written by `Terrain::writeFile`, or
+ * uncompressed.  The heights are written to `heights`, which must have room
+ * for `TILE_CELL_COUNT` values.  The child flags and the water mask are only
+ * returned if `children` and `mask` are not `NULL`, `mask` having room for
+ * `MASK_CELL_COUNT` values.
+ */
+size_t
+TerrainBatchReader::decode(const unsigned char *data, size_t size, i_terrain_height *heights,
+                           unsigned char *children, unsigned char *mask) {
+  size_t inflatedSize;
+  const unsigned char *terrain = inflateData(data, size, inflatedSize);
+
+  return unpack(terrain, inflatedSize, heights, children, mask);
+}
+
+size_t
+TerrainBatchReader::read(const char *fileName, i_terrain_height *heights,
+                         unsigned char *children, unsigned char *mask) {
+  load(fileName);
+  return decode(mFileBuffer.data(), mFileBuffer.size(), heights, children, mask);
+}
+
+/**
+ * @details `heights` must have room for `TILE_CELL_COUNT` values per file and
+ * `children`, if it is not `NULL`, for one value per file.  If `errors` is
+ * `NULL` the first error is thrown, otherwise it is set to contain an error
+ * message for each file, which is empty for files read successfully, and the
+ * values for the files that failed are left unchanged.
+ */
+size_t
+TerrainBatchReader::read(const std::vector<std::string> &fileNames, i_terrain_height *heights,
+                         unsigned char *children, std::vector<std::string> *errors) {
+  size_t count = 0;
+
+  if (errors != NULL) {
+    errors->assign(fileNames.size(), std::string());
+  }
+
+  for (size_t i = 0; i < fileNames.size(); ++i) {
+    try {
+      read(fileNames[i].c_str(), heights + (i * TILE_CELL_COUNT),
+           (children == NULL) ? NULL : children + i);
+      ++count;
+    } catch (CTBException &e) {
+      if (errors == NULL)
+        throw;
+
+      (*errors)[i] = e.what();
+    }
+  }
+
+  return count;
+}
+
+/**
+ * @details Terrain files are small so the whole file is read with a single
+ * call into a buffer that is reused between files, avoiding the overhead of
+ * mapping each file or of buffered stream reads.
+ */
+void
+TerrainBatchReader::load(const char *fileName) {
+#ifdef _WIN32
+  FILE *fp = fopen(fileName, "rb");
+  if (fp == NULL) {
+    throw CTBException("Failed to open file");
+  }
+
+  mFileBuffer.resize(MAX_TERRAIN_SIZE + 1024);
+  size_t size = 0, count;
+  while ((count = fread(mFileBuffer.data() + size, 1, mFileBuffer.size() - size, fp)) > 0) {
+    size += count;
+    if (size == mFileBuffer.size())
+      mFileBuffer.resize(size * 2);
+  }
+
+  const bool failed = ferror(fp) != 0;
+  fclose(fp);
+  if (failed) {
+    throw CTBException("Failed to read file");
+  }
+
+  mFileBuffer.resize(size);
+#else
+  const int fd = open(fileName, O_RDONLY);
+  if (fd < 0) {
+    throw CTBException("Failed to open file");
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw CTBException("Failed to read file");
+  }
+
+  mFileBuffer.resize(info.st_size);
+  size_t size = 0;
+  while (size < mFileBuffer.size()) {
+    const ssize_t count = ::read(fd, mFileBuffer.data() + size, mFileBuffer.size() - size);
+    if (count <= 0)
+      break;
+    size += count;
+  }
+
+  close(fd);
+  if (size != mFileBuffer.size()) {
+    throw CTBException("Failed to read file");
+  }
+#endif
+}
+
+/**
+ * @details Uncompressed data is returned as is, otherwise it is decompressed
+ * into the inflate buffer using the reused decompression state.
+ *
+ * Uncompressed data starts with the gzip magic bytes when the first height is
+ * `0x8b1f`, so data of exactly an uncompressed terrain size that doesn't
+ * decompress to a terrain is taken to be uncompressed rather than reported
+ * as an error.
+ */
+const unsigned char *
+TerrainBatchReader::inflateData(const unsigned char *data, size_t size, size_t &inflatedSize) {
+  const bool gzipped = size >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+  const bool terrainSized = size == MAX_TERRAIN_SIZE || size == MIN_TERRAIN_SIZE;
+
+  if (!gzipped && terrainSized) {
+    inflatedSize = size;        // it is uncompressed
+    return data;
+  }
+
+  if (inflateReset(&mStream) != Z_OK) {
+    throw CTBException("Failed to reset decompression");
+  }
+
+  mStream.next_in = (Bytef *) data;
+  mStream.avail_in = size;
+  mStream.next_out = mInflateBuffer.data();
+  mStream.avail_out = mInflateBuffer.size();
+
+  const int status = inflate(&mStream, Z_FINISH);
+  inflatedSize = mStream.total_out;
+
+  if (terrainSized && (status != Z_STREAM_END ||
+                       (inflatedSize != MAX_TERRAIN_SIZE && inflatedSize != MIN_TERRAIN_SIZE))) {
+    inflatedSize = size;        // uncompressed heights starting with the magic
+    return data;
+  } else if (inflatedSize > MAX_TERRAIN_SIZE) {
+    throw CTBException("Data has too many bytes to be a valid terrain");
+  } else if (status != Z_STREAM_END) {
+    throw CTBException("Failed to decompress terrain data");
+  }
+
+  return mInflateBuffer.data();
+}
+
+/**
+ * @details The heights are little endian 16 bit values, followed by the child
+ * flags and either a single water mask value or a full water mask.
+ */
+size_t
+TerrainBatchReader::unpack(const unsigned char *data, size_t size, i_terrain_height *heights,
+                           unsigned char *children, unsigned char *mask) const {
+  size_t maskLength;
+
+  switch (size) {
+  case MAX_TERRAIN_SIZE:        // a water mask is present
+    maskLength = MASK_CELL_COUNT;
+    break;
+  case MIN_TERRAIN_SIZE:        // there is no water mask
+    maskLength = 1;
+    break;
+  default:                      // it can't be terrain data
+    throw CTBException("File has wrong file size to be a valid terrain");
+  }
+
+  // A simple loop that compilers turn into vector loads
+  for (unsigned int i = 0; i < TILE_CELL_COUNT; ++i) {
+    heights[i] = (i_terrain_height) (data[i * 2] | (data[(i * 2) + 1] << 8));
+  }
+
+  if (children != NULL)
+    *children = data[TILE_CELL_COUNT * 2];
+
+  if (mask != NULL)
+    memcpy(mask, data + (TILE_CELL_COUNT * 2) + 1, maskLength);
+
+  return maskLength;
+}
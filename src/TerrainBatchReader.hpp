@@ -0,0 +1,113 @@
+#ifndef TERRAINBATCHREADER_HPP
+#define TERRAINBATCHREADER_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TerrainBatchReader.hpp
+ * @brief This declares the `TerrainBatchReader` class
+ */
+
+#include <string>
+#include <vector>
+
+#include "zlib.h"
+
+#include "config.hpp"
+#include "types.hpp"
+
+namespace ctb {
+  class TerrainBatchReader;
+}
+
+/**
+ * @brief Decode many terrain tiles into caller owned arrays
+ *
+ * This is intended for reading large numbers of existing terrain tiles, for
+ * instance to validate a tileset, gather statistics or build parent tiles.
+ * The reader reuses its file buffer, decompression state and decompression
+ * buffer for every tile, and heights are decoded straight into arrays owned
+ * by the caller rather than into `Terrain` objects.
+ *
+ * Batches of tiles are decoded as a structure of arrays: the heights of tile
+ * `i` occupy `TILE_CELL_COUNT` values starting at `heights + (i *
+ * TILE_CELL_COUNT)` and its child flags are `children[i]`.
+ *
+ * A reader is not thread safe: use one reader per thread.
+ */
+class CTB_DLL ctb::TerrainBatchReader {
+public:
+
+  /// The number of height values in a terrain tile
+  static const unsigned int TILE_CELL_COUNT = TILE_SIZE * TILE_SIZE;
+
+  /// The number of values in a full water mask
+  static const unsigned int MASK_CELL_COUNT = MASK_SIZE * MASK_SIZE;
+
+  /// Initialise the decompression state
+  TerrainBatchReader();
+
+  /// Release the decompression state
+  ~TerrainBatchReader();
+
+  /// Decode terrain data in memory, returning the water mask length
+  size_t
+  decode(const unsigned char *data, size_t size, i_terrain_height *heights,
+         unsigned char *children = NULL, unsigned char *mask = NULL);
+
+  /// Read a terrain file, returning the water mask length
+  size_t
+  read(const char *fileName, i_terrain_height *heights,
+       unsigned char *children = NULL, unsigned char *mask = NULL);
+
+  /// Read a batch of terrain files, returning the number read successfully
+  size_t
+  read(const std::vector<std::string> &fileNames, i_terrain_height *heights,
+       unsigned char *children = NULL, std::vector<std::string> *errors = NULL);
+
+protected:
+
+  /// Read the contents of a file into the file buffer
+  void
+  load(const char *fileName);
+
+  /// Get uncompressed terrain data, decompressing it if necessary
+  const unsigned char *
+  inflateData(const unsigned char *data, size_t size, size_t &inflatedSize);
+
+  /// Copy the fields of uncompressed terrain data to the caller's arrays
+  size_t
+  unpack(const unsigned char *data, size_t size, i_terrain_height *heights,
+         unsigned char *children, unsigned char *mask) const;
+
+  /// The decompression state, reset for each tile
+  z_stream mStream;
+
+  /// The contents of the file last read
+  std::vector<unsigned char> mFileBuffer;
+
+  /// The uncompressed terrain data
+  std::vector<unsigned char> mInflateBuffer;
+
+private:
+
+  /// The reader owns decompression state so it can't be copied
+  TerrainBatchReader(const TerrainBatchReader &);
+  TerrainBatchReader &operator=(const TerrainBatchReader &);
+};
+
+#endif /* TERRAINBATCHREADER_HPP */
@@ -24,6 +24,7 @@
 
 #include "TerrainTile.hpp"
 #include "TerrainTiler.hpp"
+#include "TilePool.hpp"
 
 namespace ctb {
   class TerrainIterator;
@@ -33,9 +34,11 @@ namespace ctb {
  * @brief This forward iterates over all `TerrainTile`s in a `TerrainTiler`
  *
  * Instances of this class take a `TerrainTiler` in the constructor and are used
- * to forward iterate over all tiles in the tiler, returning a `TerrainTile *`
- * when dereferenced.  It is the caller's responsibility to call `delete` on the
- * tile.
+ * to forward iterate over all tiles in the tiler.  Tiles should be created in
+ * tiles recycled from a `TilePool` using `TerrainIterator::createTile`, which
+ * returns a handle giving the tile back to the pool.  Dereferencing the
+ * iterator allocates a new `TerrainTile` which the caller must `delete`: this
+ * is deprecated.
  */
 class ctb::TerrainIterator :
   public TilerIterator
@@ -52,10 +55,23 @@ public:
     TilerIterator(tiler, startZoom, endZoom)
   {}
 
+  /// Create the current tile in a new allocation which the caller must delete
+  /// @deprecated Use `TerrainIterator::createTile` to recycle tiles instead
+  CTB_DEPRECATED("use TerrainIterator::createTile with a TilePool instead")
   virtual TerrainTile *
   operator*() const override {
     return static_cast<TerrainTile *>(TilerIterator::operator*());
   }
+
+  /// Create the current tile in a tile from a pool
+  TilePool<TerrainTile>::Handle
+  createTile(TilePool<TerrainTile> &pool) const {
+    const TileCoordinate &coord = *(GridIterator::operator*());
+    TilePool<TerrainTile>::Handle tile = pool.acquire(coord);
+
+    static_cast<const TerrainTiler &>(tiler).createTile(coord, *tile);
+    return tile;
+  }
 };
 
 #endif /* TERRAINITERATOR_HPP */
@@ -20,52 +20,151 @@
  */
 
 #include <string.h>             // for memcpy
+#include <stdlib.h>             // for strtol
+#include <algorithm>            // for std::find_if
 
 #include "zlib.h"
 #include "ogr_spatialref.h"
 
+#include "config.hpp"
+#ifdef CTB_WITH_LIBDEFLATE
+#include "libdeflate.h"
+#endif
+
 #include "CTBException.hpp"
 #include "TerrainTile.hpp"
+#include "TerrainBatchReader.hpp"
+#include "HeightConverter.hpp"
 #include "GlobalGeodetic.hpp"
 #include "Bounds.hpp"
 
 using namespace ctb;
 
+/**
+ * @details The method is one of `zlib`, `libdeflate` or `none`, optionally
+ * followed by a colon and the compression level (e.g. `zlib:1`).  zlib levels
+ * range from 0 to 9 and libdeflate levels from 0 to 12.
+ */
+TerrainCompression
+TerrainCompression::parse(const char *description) {
+  TerrainCompression compression;
+  const char *separator = strchr(description, ':');
+  const std::string method = (separator == NULL)
+    ? std::string(description)
+    : std::string(description, separator - description);
+  int maxLevel;
+
+  if (method == "zlib") {
+    compression.method = ZLIB;
+    maxLevel = 9;
+  } else if (method == "libdeflate") {
+#ifdef CTB_WITH_LIBDEFLATE
+    compression.method = LIBDEFLATE;
+    maxLevel = 12;
+#else
+    throw CTBException("libdeflate compression is not available in this build");
+#endif
+  } else if (method == "none") {
+    compression.method = NONE;
+    maxLevel = 0;
+  } else {
+    throw CTBException("Unknown compression method");
+  }
+
+  if (separator != NULL) {
+    char *end;
+    compression.level = strtol(separator + 1, &end, 10);
+
+    if (*(separator + 1) == '\0' || *end != '\0' || compression.level < 0 || compression.level > maxLevel) {
+      throw CTBException("Invalid compression level");
+    }
+  }
+
+  return compression;
+}
+
 Terrain::Terrain():
-  mHeights(TILE_CELL_SIZE),
+  mHeights(),
   mChildren(0)
 {
   setIsLand();
 }
 
+/**
+ * @details A full water mask is copied into a new allocation.
+ */
+Terrain::Terrain(const Terrain &other):
+  mHeights(other.mHeights),
+  mChildren(other.mChildren)
+{
+  setMask(other.maskData(), other.mMaskLength);
+}
+
+Terrain &
+Terrain::operator=(const Terrain &other) {
+  if (this != &other) {
+    mHeights = other.mHeights;
+    mChildren = other.mChildren;
+    setMask(other.maskData(), other.mMaskLength);
+  }
+
+  return *this;
+}
+
+/**
+ * @details A full water mask is taken over without being copied.  The other
+ * terrain is left with a valid all land water mask.
+ */
+Terrain::Terrain(Terrain &&other):
+  mHeights(other.mHeights),
+  mChildren(other.mChildren),
+  mMaskValue(other.mMaskValue),
+  mMask(std::move(other.mMask)),
+  mMaskLength(other.mMaskLength)
+{
+  other.setIsLand();
+}
+
+Terrain &
+Terrain::operator=(Terrain &&other) {
+  if (this != &other) {
+    mHeights = other.mHeights;
+    mChildren = other.mChildren;
+    mMaskValue = other.mMaskValue;
+    mMask = std::move(other.mMask);
+    mMaskLength = other.mMaskLength;
+    other.setIsLand();
+  }
+
+  return *this;
+}
+
 /**
  * @details This reads gzipped terrain data from a file.
  */
 Terrain::Terrain(const char *fileName):
-  mHeights(TILE_CELL_SIZE)
+  mChildren(0)
 {
   readFile(fileName);
 }
 
 /**
- * @details This reads raw uncompressed terrain data from a file handle.
+ * @details This reads raw uncompressed terrain data from a file handle.  The
+ * heights are read with a single call and a full water mask is only
+ * allocated if the data contains one.
  */
 Terrain::Terrain(FILE *fp):
-  mHeights(TILE_CELL_SIZE)
+  mChildren(0)
 {
-  unsigned char bytes[2];
-  int count = 0;
+  unsigned char bytes[TILE_CELL_SIZE * 2];
 
   // Get the height data from the file handle
-  while ( count < TILE_CELL_SIZE && fread(bytes, 2, 1, fp) != 0) {
-    /* adapted from
-       <http://stackoverflow.com/questions/13001183/how-to-read-little-endian-integers-from-file-in-c> */
-    mHeights[count++] = bytes[0] | (bytes[1]<<8);
+  if (fread(bytes, 2, TILE_CELL_SIZE, fp) != TILE_CELL_SIZE) {
+    throw CTBException("Not enough height data");
   }
 
-  // Check we have the expected amound of height data
-  if (count+1 != TILE_CELL_SIZE) {
-    throw CTBException("Not enough height data");
+  for (unsigned int i = 0; i < TILE_CELL_SIZE; ++i) {
+    mHeights[i] = (i_terrain_height) (bytes[i * 2] | (bytes[(i * 2) + 1] << 8));
   }
 
   // Get the child flag
@@ -73,62 +172,71 @@ Terrain::Terrain(FILE *fp):
     throw CTBException("Could not read child tile byte");
   }
 
-  // Get the water mask
-  mMaskLength = fread(mMask, 1, MASK_CELL_SIZE, fp);
-  switch (mMaskLength) {
-  case MASK_CELL_SIZE:
-    break;
-  case 1:
-    break;
-  default:
+  // Get the water mask: either a single value or a full mask
+  if (fread(&mMaskValue, 1, 1, fp) != 1) {
     throw CTBException("Not contain enough water mask data");
   }
+  mMaskLength = 1;
+
+  const int next = fgetc(fp);
+  if (next != EOF) {
+    mMask.reset(new char[MASK_CELL_SIZE]);
+    mMask[0] = mMaskValue;
+    mMask[1] = (char) next;
+
+    if (fread(mMask.get() + 2, 1, MASK_CELL_SIZE - 2, fp) != MASK_CELL_SIZE - 2) {
+      throw CTBException("Not contain enough water mask data");
+    }
+    mMaskLength = MASK_CELL_SIZE;
+  }
 }
 
 /**
- * @details This reads gzipped terrain data from a file.
+ * @details A full water mask is allocated if it isn't already, while the
+ * mask of an all land or water tile is held inline.
  */
 void
-Terrain::readFile(const char *fileName) {
-  unsigned char inflateBuffer[MAX_TERRAIN_SIZE];
-  unsigned int inflatedBytes;
-  gzFile terrainFile = gzopen(fileName, "rb");
-
-  if (terrainFile == NULL) {
-    throw CTBException("Failed to open file");
+Terrain::setMask(const char *mask, size_t length) {
+  if (length == MASK_CELL_SIZE) {
+    if (!mMask)
+      mMask.reset(new char[MASK_CELL_SIZE]);
+    if (mask != mMask.get())
+      memcpy(mMask.get(), mask, MASK_CELL_SIZE);
+  } else {
+    mMaskValue = mask[0];
+    mMask.reset();
   }
 
-  // Uncompress the file into the buffer
-  inflatedBytes = gzread(terrainFile, inflateBuffer, MAX_TERRAIN_SIZE);
-  if (gzread(terrainFile, inflateBuffer, 1) != 0) {
-    gzclose(terrainFile);
-    throw CTBException("File has too many bytes to be a valid terrain");
-  }
-  gzclose(terrainFile);
+  mMaskLength = length;
+}
 
-  // Check the water mask type
-  switch(inflatedBytes) {
-  case MAX_TERRAIN_SIZE:      // a water mask is present
-    mMaskLength = MASK_CELL_SIZE;
-    break;
-  case (TILE_CELL_SIZE * 2) + 2:   // there is no water mask
-    mMaskLength = 1;
-    break;
-  default:                    // it can't be a terrain file
-    throw CTBException("File has wrong file size to be a valid terrain");
-  }
+/**
+ * @details This reads gzipped terrain data from a file.  Each thread reuses
+ * the buffers and decompression state of its own `TerrainBatchReader`.
+ */
+void
+Terrain::readFile(const char *fileName) {
+  static thread_local TerrainBatchReader reader;
+  static thread_local std::vector<char> mask(MASK_CELL_SIZE);
 
-  // Get the height data
-  short int byteCount = 0;
-  for (short int i = 0; i < TILE_CELL_SIZE; i++, byteCount = i * 2) {
-    mHeights[i] = inflateBuffer[byteCount] | (inflateBuffer[byteCount + 1]<<8);
-  }
+  const size_t maskLength = reader.read(fileName, mHeights.data(), (unsigned char *) &mChildren,
+                                        (unsigned char *) mask.data());
+  setMask(mask.data(), maskLength);
+}
 
-  // Get the child flag
-  mChildren = inflateBuffer[byteCount]; // byte 8451
+/**
+ * @details This reads gzipped terrain data from memory, such as the data
+ * created by `Terrain::encode` or stored in a `TerrainArchiveReader`.  Data
+ * encoded without compression is also accepted.
+ */
+void
+Terrain::decode(const unsigned char *data, size_t size) {
+  static thread_local TerrainBatchReader reader;
+  static thread_local std::vector<char> mask(MASK_CELL_SIZE);
 
-  // Get the water mask
-  memcpy(mMask, &(inflateBuffer[++byteCount]), mMaskLength);
+  const size_t maskLength = reader.decode(data, size, mHeights.data(), (unsigned char *) &mChildren,
+                                          (unsigned char *) mask.data());
+  setMask(mask.data(), maskLength);
 }
 
 /**
@@ -138,55 +246,225 @@ void
 Terrain::writeFile(FILE *fp) const {
   fwrite(mHeights.data(), TILE_CELL_SIZE * 2, 1, fp);
   fwrite(&mChildren, 1, 1, fp);
-  fwrite(mMask, mMaskLength, 1, fp);
+  fwrite(maskData(), mMaskLength, 1, fp);
 }
 
 /**
- * @details This writes gzipped terrain data to a file.
+ * @details This writes gzipped terrain data to a file, or uncompressed data
+ * if no compression is specified.  The data is compressed in memory (see
+ * `Terrain::encode`) into a buffer reused by the calling thread, and then
+ * written with a single call.
  */
 void 
-Terrain::writeFile(const char *fileName) const {
-  gzFile terrainFile = gzopen(fileName, "wb");
+Terrain::writeFile(const char *fileName, const TerrainCompression &compression) const {
+  static thread_local std::vector<unsigned char> buffer;
+  encode(buffer, compression);
 
-  if (terrainFile == NULL) {
+  FILE *fp = fopen(fileName, "wb");
+  if (fp == NULL) {
     throw CTBException("Failed to open file");
   }
 
-  // Write the height data
-  if (gzwrite(terrainFile, mHeights.data(), TILE_CELL_SIZE * 2) == 0) {
-    gzclose(terrainFile);
-    throw CTBException("Failed to write height data");
+  const bool written = fwrite(buffer.data(), buffer.size(), 1, fp) == 1;
+
+  // Try and close the file
+  if (fclose(fp) != 0) {
+    throw CTBException("Failed to close file");
+  } else if (!written) {
+    throw CTBException("Failed to write terrain data");
+  }
+}
+
+/// Gzip terrain data using zlib
+static void
+deflateZlib(const void *const data[], const uInt sizes[], int count, int level,
+            std::vector<unsigned char> &buffer) {
+  // The compressor state is large and expensive to initialise, so each
+  // thread keeps its own and resets it for every tile
+  struct Deflater {
+    Deflater() {
+      memset(&stream, 0, sizeof(stream));
+      level = Z_DEFAULT_COMPRESSION;
+      // A window size of 15 plus 16 gives a gzip rather than a zlib wrapper
+      status = deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    }
+
+    ~Deflater() {
+      if (status == Z_OK)
+        deflateEnd(&stream);
+    }
+
+    z_stream stream;
+    int level;
+    int status;
+  };
+  static thread_local Deflater deflater;
+  z_stream &stream = deflater.stream;
+
+  if (deflater.status != Z_OK || deflateReset(&stream) != Z_OK) {
+    throw CTBException("Failed to initialise compression");
   }
 
-  // Write the child flags
-  if (gzputc(terrainFile, mChildren) == -1) {
-    gzclose(terrainFile);
-    throw CTBException("Failed to write child flags");
+  // The level can be changed as no data has been compressed since the reset
+  if (level != deflater.level) {
+    if (deflateParams(&stream, level, Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw CTBException("Failed to set the compression level");
+    }
+    deflater.level = level;
   }
 
-  // Write the water mask
-  if (gzwrite(terrainFile, mMask, mMaskLength) == 0) {
-    gzclose(terrainFile);
-    throw CTBException("Failed to write water mask");
+  uLong totalSize = 0;
+  for (int i = 0; i < count; i++) {
+    totalSize += sizes[i];
   }
 
-  // Try and close the file
-  switch (gzclose(terrainFile)) {
-  case Z_OK:
+  buffer.resize(deflateBound(&stream, totalSize));
+  stream.next_out = buffer.data();
+  stream.avail_out = buffer.size();
+
+  // Compress each part of the data in a single stream
+  int status = Z_OK;
+  for (int i = 0; i < count && status == Z_OK; i++) {
+    stream.next_in = (Bytef *) data[i];
+    stream.avail_in = sizes[i];
+    status = deflate(&stream, (i == count - 1) ? Z_FINISH : Z_NO_FLUSH);
+  }
+
+  buffer.resize(stream.total_out);
+
+  if (status != Z_STREAM_END) {
+    throw CTBException("Failed to compress terrain data");
+  }
+}
+
+#ifdef CTB_WITH_LIBDEFLATE
+/// Gzip terrain data using libdeflate
+static void
+deflateLibdeflate(const std::vector<unsigned char> &data, int level, std::vector<unsigned char> &buffer) {
+  // Each thread keeps a compressor for each level used
+  struct Compressors {
+    Compressors() {
+      memset(compressors, 0, sizeof(compressors));
+    }
+
+    ~Compressors() {
+      for (int i = 0; i <= 12; i++) {
+        if (compressors[i] != NULL)
+          libdeflate_free_compressor(compressors[i]);
+      }
+    }
+
+    struct libdeflate_compressor *compressors[13];
+  };
+  static thread_local Compressors cache;
+
+  struct libdeflate_compressor *&compressor = cache.compressors[level];
+  if (compressor == NULL) {
+    compressor = libdeflate_alloc_compressor(level);
+    if (compressor == NULL) {
+      throw CTBException("Failed to initialise compression");
+    }
+  }
+
+  buffer.resize(libdeflate_gzip_compress_bound(compressor, data.size()));
+  const size_t size = libdeflate_gzip_compress(compressor, data.data(), data.size(),
+                                               buffer.data(), buffer.size());
+  if (size == 0) {
+    throw CTBException("Failed to compress terrain data");
+  }
+
+  buffer.resize(size);
+}
+#endif
+
+/**
+ * @details This compresses data other than heightmap terrain, such as
+ * quantized mesh tiles, in the same way as `Terrain::encode`.
+ */
+void
+TerrainCompression::compress(const std::vector<unsigned char> &data, std::vector<unsigned char> &buffer) const {
+  switch (method) {
+  case NONE:
+    buffer = data;
     break;
-  case Z_STREAM_ERROR:
-  case Z_ERRNO:
-  case Z_MEM_ERROR:
-  case Z_BUF_ERROR:
-  default:
-    throw CTBException("Failed to close file");
+
+  case LIBDEFLATE:
+#ifdef CTB_WITH_LIBDEFLATE
+    deflateLibdeflate(data, (level < 0) ? 6 : level, buffer);
+    break;
+#else
+    throw CTBException("libdeflate compression is not available in this build");
+#endif
+
+  case ZLIB:
+  default: {
+    const void *parts[] = {data.data()};
+    const uInt sizes[] = {(uInt) data.size()};
+    deflateZlib(parts, sizes, 1, (level < 0) ? Z_DEFAULT_COMPRESSION : level, buffer);
+    break;
+  }
   }
 }
 
+/**
+ * @details This encodes the terrain data into a buffer, replacing its
+ * contents.  The result is the contents of a file written by
+ * `Terrain::writeFile` with the same compression, allowing tiles to be stored
+ * somewhere other than the filesystem (e.g. a database).  The capacity of the
+ * buffer is reused, so passing the same buffer for each tile avoids
+ * reallocating it.
+ *
+ * Both zlib and libdeflate create gzipped data, which is what the terrain
+ * format specifies.  libdeflate is considerably faster for buffers the size
+ * of a terrain tile.  Uncompressed data is intended for servers which
+ * compress responses themselves.
+ */
+void
+Terrain::encode(std::vector<unsigned char> &buffer, const TerrainCompression &compression) const {
+  switch (compression.method) {
+  case TerrainCompression::NONE:
+    pack(buffer);
+    break;
+
+  case TerrainCompression::LIBDEFLATE: {
+#ifdef CTB_WITH_LIBDEFLATE
+    static thread_local std::vector<unsigned char> packed;
+    pack(packed);               // libdeflate needs contiguous input
+    deflateLibdeflate(packed, (compression.level < 0) ? 6 : compression.level, buffer);
+    break;
+#else
+    throw CTBException("libdeflate compression is not available in this build");
+#endif
+  }
+
+  case TerrainCompression::ZLIB:
+  default: {
+    const void *data[] = {mHeights.data(), &mChildren, maskData()};
+    const uInt sizes[] = {TILE_CELL_SIZE * 2, 1, (uInt) mMaskLength};
+    deflateZlib(data, sizes, 3, (compression.level < 0) ? Z_DEFAULT_COMPRESSION : compression.level, buffer);
+    break;
+  }
+  }
+}
+
+/**
+ * @details This copies the heights, child flags and water mask into a
+ * buffer, replacing its contents, in the byte order they are encoded.
+ */
+void
+Terrain::pack(std::vector<unsigned char> &buffer) const {
+  buffer.resize((TILE_CELL_SIZE * 2) + 1 + mMaskLength);
+
+  memcpy(buffer.data(), mHeights.data(), TILE_CELL_SIZE * 2);
+  buffer[TILE_CELL_SIZE * 2] = mChildren;
+  memcpy(buffer.data() + (TILE_CELL_SIZE * 2) + 1, maskData(), mMaskLength);
+}
+
 std::vector<bool>
 Terrain::mask() {
   std::vector<bool> mask;
-  mask.assign(mMask, mMask + mMaskLength);
+  const char *data = maskData();
+  mask.assign(data, data + mMaskLength);
   return mask;
 }
 
@@ -262,24 +540,24 @@ Terrain::setAllChildren(bool on) {
 
 void
 Terrain::setIsWater() {
-  mMask[0] = 1;
-  mMaskLength = 1;
+  const char water = 1;
+  setMask(&water, 1);
 }
 
 bool
 Terrain::isWater() const {
-  return mMaskLength == 1 && (bool) mMask[0];
+  return mMaskLength == 1 && (bool) mMaskValue;
 }
 
 void
 Terrain::setIsLand() {
-  mMask[0] = 0;
-  mMaskLength = 1;
+  const char land = 0;
+  setMask(&land, 1);
 }
 
 bool
 Terrain::isLand() const {
-  return mMaskLength == 1 && ! (bool) mMask[0];
+  return mMaskLength == 1 && ! (bool) mMaskValue;
 }
 
 bool
@@ -287,20 +565,117 @@ Terrain::hasWaterMask() const {
   return mMaskLength == MASK_CELL_SIZE;
 }
 
-const std::vector<i_terrain_height> &
+/**
+ * @details The mask has `MASK_SIZE` by `MASK_SIZE` values in rows from north
+ * to south.  A mask that is all land or all water is stored as a single value
+ * rather than in full.
+ */
+void
+Terrain::setWaterMask(const unsigned char *mask) {
+  const unsigned char *end = mask + MASK_CELL_SIZE;
+
+  if (std::find_if(mask, end, [mask](unsigned char value) { return value != mask[0]; }) != end) {
+    setMask((const char *) mask, MASK_CELL_SIZE);
+  } else if (mask[0] == 0) {
+    setIsLand();
+  } else {
+    setIsWater();
+  }
+}
+
+const Terrain::Heights &
 Terrain::getHeights() const {
   return mHeights;
 }
 
-/**
- * @details The data in the returned vector can be altered but do not alter
- * the number of elements in the vector.
- */
-std::vector<i_terrain_height> &
+Terrain::Heights &
 Terrain::getHeights() {
   return mHeights;
 }
 
+/// Rotate a 64 bit integer left
+static inline uint64_t
+rotateLeft(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+/// Finalise a 64 bit MurmurHash3 state
+static inline uint64_t
+finalMix(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+/**
+ * @brief Calculate the 128 bit x64 variant of MurmurHash3
+ *
+ * This is a fast non-cryptographic hash designed by Austin Appleby and placed
+ * in the public domain.
+ */
+static TerrainHash
+murmurHash3(const unsigned char *data, size_t length) {
+  const uint64_t c1 = 0x87c37b91114253d5ULL, c2 = 0x4cf5ad432745937fULL;
+  const size_t blockCount = length / 16;
+  uint64_t h1 = 0, h2 = 0, k1, k2;
+
+  // The body, in 16 byte blocks
+  for (size_t i = 0; i < blockCount; i++) {
+    memcpy(&k1, data + (i * 16), 8);
+    memcpy(&k2, data + (i * 16) + 8, 8);
+
+    k1 *= c1; k1 = rotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+    h1 = rotateLeft(h1, 27); h1 += h2; h1 = (h1 * 5) + 0x52dce729;
+
+    k2 *= c2; k2 = rotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+    h2 = rotateLeft(h2, 31); h2 += h1; h2 = (h2 * 5) + 0x38495ab5;
+  }
+
+  // The remaining bytes
+  const unsigned char *tail = data + (blockCount * 16);
+  const size_t tailLength = length & 15;
+
+  k1 = k2 = 0;
+  for (size_t i = tailLength; i > 8; i--) {
+    k2 ^= ((uint64_t) tail[i - 1]) << ((i - 9) * 8);
+  }
+  if (tailLength > 8) {
+    k2 *= c2; k2 = rotateLeft(k2, 33); k2 *= c1; h2 ^= k2;
+  }
+
+  for (size_t i = (tailLength > 8) ? 8 : tailLength; i > 0; i--) {
+    k1 ^= ((uint64_t) tail[i - 1]) << ((i - 1) * 8);
+  }
+  if (tailLength > 0) {
+    k1 *= c1; k1 = rotateLeft(k1, 31); k1 *= c2; h1 ^= k1;
+  }
+
+  // Finalisation
+  h1 ^= length; h2 ^= length;
+  h1 += h2; h2 += h1;
+  h1 = finalMix(h1); h2 = finalMix(h2);
+  h1 += h2; h2 += h1;
+
+  return TerrainHash(h1, h2);
+}
+
+/**
+ * @details The hash covers the heights, child flags and water mask as they
+ * are written by `Terrain::writeFile`.  Terrain with the same hash can be
+ * considered identical: the 128 bit hash makes accidental collisions
+ * vanishingly unlikely.
+ */
+TerrainHash
+Terrain::hash() const {
+  static thread_local std::vector<unsigned char> buffer;
+  pack(buffer);
+
+  return murmurHash3(buffer.data(), buffer.size());
+}
+
 TerrainTile::TerrainTile(const TileCoordinate &coord):
   Terrain(),
   Tile(coord)
@@ -349,7 +724,7 @@ TerrainTile::heightsToRaster() const {
   GDALDatasetH hDstDS;
   GDALRasterBandH hBand;
 
-  hDstDS = GDALCreate(hDriver, "", tileSize, tileSize, 1, GDT_Int16, NULL );
+  hDstDS = GDALCreate(hDriver, "", tileSize, tileSize, 1, GDT_Float32, NULL );
   if (hDstDS == NULL) {
     CPLFree( pszDstWKT );
     throw CTBException("Could not create in memory raster");
@@ -369,10 +744,13 @@ TerrainTile::heightsToRaster() const {
     throw CTBException("Could not set projection on VRT");
   }
 
-  // Finally write the height data
+  // Finally write the height data in meters
+  float meters[TILE_CELL_SIZE];
+  HeightConverter::toMeters(mHeights.data(), meters, TILE_CELL_SIZE);
+
   hBand = GDALGetRasterBand( hDstDS, 1 );
   if (GDALRasterIO( hBand, GF_Write, 0, 0, tileSize, tileSize,
-                    (void *) mHeights.data(), tileSize, tileSize, GDT_Int16, 0, 0 ) != CE_None) {
+                    (void *) meters, tileSize, tileSize, GDT_Float32, 0, 0 ) != CE_None) {
     GDALClose(hDstDS);
     throw CTBException("Could not write heights to in memory raster");
   }
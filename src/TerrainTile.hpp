@@ -22,6 +22,8 @@
  * @brief This declares the `Terrain` and `TerrainTile` classes
  */
 
+#include <array>
+#include <memory>
 #include <vector>
 
 #include "gdal_priv.h"
@@ -31,22 +33,67 @@
 #include "TileCoordinate.hpp"
 
 namespace ctb {
+  struct TerrainCompression;
   class Terrain;
   class TerrainTile;
 }
 
+/// How terrain data is compressed when it is encoded
+struct ctb::TerrainCompression {
+  /// The available compression methods
+  enum Method {
+    ZLIB,                       ///< gzip using zlib
+    LIBDEFLATE,                 ///< gzip using libdeflate, if available
+    NONE                        ///< no compression
+  };
+
+  /// The compression method
+  Method method = ZLIB;         // the format's gzip
+  /// The compression level, or `-1` for the default level of the method
+  int level = -1;
+
+  /// Create the compression described by a string of the form `method[:level]`
+  static TerrainCompression
+  parse(const char *description);
+
+  /// Compress data into a buffer, replacing its contents
+  void
+  compress(const std::vector<unsigned char> &data, std::vector<unsigned char> &buffer) const;
+};
+
 /**
  * @brief Model the terrain heightmap specification
  *
  * This aims to implement the Cesium [heightmap-1.0 terrain
  * format](http://cesiumjs.org/data-and-assets/terrain/formats/heightmap-1.0.html).
+ *
+ * The heights are held inline in a fixed size array while a full water mask
+ * is only allocated for tiles that have one, so most terrain objects occupy
+ * little more than their heights and are cheap to copy and move.
  */
 class CTB_DLL ctb::Terrain {
 public:
 
+  /// The height data of a terrain tile
+  typedef std::array<i_terrain_height, TILE_SIZE * TILE_SIZE> Heights;
+
   /// Create an empty terrain object
   Terrain();
 
+  /// Copy the terrain data, including any water mask
+  Terrain(const Terrain &other);
+
+  /// Take over the terrain data of another object, leaving it all land
+  Terrain(Terrain &&other);
+
+  /// Copy the terrain data, including any water mask
+  Terrain &
+  operator=(const Terrain &other);
+
+  /// Take over the terrain data of another object, leaving it all land
+  Terrain &
+  operator=(Terrain &&other);
+
   /// Instantiate using terrain data on the file system
   Terrain(const char *fileName);
 
@@ -63,7 +110,15 @@ public:
 
   /// Write terrain data to the filesystem
   void
-  writeFile(const char *fileName) const;
+  writeFile(const char *fileName, const TerrainCompression &compression = TerrainCompression()) const;
+
+  /// Encode the terrain data in memory as it is written to the filesystem
+  void
+  encode(std::vector<unsigned char> &buffer, const TerrainCompression &compression = TerrainCompression()) const;
+
+  /// Read terrain data encoded in memory
+  void
+  decode(const unsigned char *data, size_t size);
 
   /// Get the water mask as a boolean mask
   std::vector<bool>
@@ -129,17 +184,29 @@ public:
   bool
   hasWaterMask() const;
 
-  /// Get the height data as a const vector
-  const std::vector<i_terrain_height> &
+  /// Set the water mask from a full mask, 0 for land and 255 for water
+  void
+  setWaterMask(const unsigned char *mask);
+
+  /// Get the height data as a const array
+  const Heights &
   getHeights() const;
 
-  /// Get the height data as a vector
-  std::vector<i_terrain_height> &
+  /// Get the height data as an array
+  Heights &
   getHeights();
 
+  /// Get a hash of the terrain data as it is written to file
+  TerrainHash
+  hash() const;
+
 protected:
+  /// Get the uncompressed terrain data
+  void
+  pack(std::vector<unsigned char> &buffer) const;
+
   /// The terrain height data
-  std::vector<i_terrain_height> mHeights; // replace with `std::array` in C++11
+  Heights mHeights;
 
   /// The number of height cells within a terrain tile
   static const unsigned short int TILE_CELL_SIZE = TILE_SIZE * TILE_SIZE;
@@ -156,8 +223,19 @@ protected:
 
 private:
 
+  /// Set the water mask from data read into a buffer
+  void
+  setMask(const char *mask, size_t length);
+
+  /// Get the water mask data, of `mMaskLength` bytes
+  inline const char *
+  maskData() const {
+    return mMask ? mMask.get() : &mMaskValue;
+  }
+
   char mChildren;               ///< The child flags
-  char mMask[MASK_CELL_SIZE];   ///< The water mask
+  char mMaskValue;              ///< The water mask of an all land or water tile
+  std::unique_ptr<char[]> mMask; ///< A full water mask, if there is one
   size_t mMaskLength;           ///< What size is the water mask?
 
   /**
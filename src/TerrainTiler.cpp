@@ -19,35 +19,66 @@
  * @brief This defines the `TerrainTiler` class
  */
 
+#include <algorithm>            // for std::min, std::max
+
 #include "CTBException.hpp"
+#include "HeightConverter.hpp"
 #include "TerrainTiler.hpp"
+#include "WaterMask.hpp"
 
 using namespace ctb;
 
+/// The terrain height representing sea level, which is used where data is missing
+static const i_terrain_height SEA_LEVEL_HEIGHT = HeightConverter::SEA_LEVEL;
+
 TerrainTile *
 ctb::TerrainTiler::createTile(const TileCoordinate &coord) const {
   // Get a terrain tile represented by the tile coordinate
   TerrainTile *terrainTile = new TerrainTile(coord);
-  GDALTile *rasterTile = createRasterTile(coord); // the raster associated with this tile coordinate
-  GDALRasterBand *heightsBand = rasterTile->dataset->GetRasterBand(1);
-
-  // Copy the raster data into an array
-  float rasterHeights[TerrainTile::TILE_CELL_SIZE];
-  if (heightsBand->RasterIO(GF_Read, 0, 0, TILE_SIZE, TILE_SIZE,
-                            (void *) rasterHeights, TILE_SIZE, TILE_SIZE, GDT_Float32,
-                            0, 0) != CE_None) {
-    throw CTBException("Could not read heights from raster");
+
+  try {
+    createTile(coord, *terrainTile);
+  } catch (CTBException &) {
+    delete terrainTile;
+    throw;
   }
 
-  delete rasterTile;
+  return terrainTile;
+}
+
+/**
+ * @details The heights, child flags and water mask of `tile` are all
+ * replaced, so a tile can be reused for any coordinate (see `TilePool`).
+ */
+void
+ctb::TerrainTiler::createTile(const TileCoordinate &coord, TerrainTile &tile) const {
+  static_cast<TileCoordinate &>(tile) = coord;
+  tile.setAllChildren(false);
+  tile.setIsLand();
+
+  // Warp the raster data associated with this tile coordinate.  This assumes
+  // the input raster data represents meters above sea level. Each terrain
+  // height value is the number of 1/5 meter units above -1000 meters.
+  if (options.terrainUnits) {
+    // The warp converts the heights to terrain heights itself
+    if (options.metatileSize > 1) {
+      metatileHeights(coord, tile.mHeights.data(), mMetatileTerrainHeights);
+    } else {
+      double adfGeoTransform[6];
+      terrainTileGeoTransform(coord, adfGeoTransform);
+      warpToBuffer(adfGeoTransform, TILE_SIZE, TILE_SIZE, tile.mHeights.data());
+    }
+  } else {
+    float rasterHeights[TerrainTile::TILE_CELL_SIZE];
+    if (options.metatileSize > 1) {
+      metatileHeights(coord, rasterHeights, mMetatileHeights);
+    } else {
+      double adfGeoTransform[6];
+      terrainTileGeoTransform(coord, adfGeoTransform);
+      warpToBuffer(adfGeoTransform, TILE_SIZE, TILE_SIZE, rasterHeights);
+    }
 
-  // Convert the raster data into the terrain tile heights.  This assumes the
-  // input raster data represents meters above sea level. Each terrain height
-  // value is the number of 1/5 meter units above -1000 meters.
-  // TODO: try doing this using a VRT derived band:
-  // (http://www.gdal.org/gdal_vrttut.html)
-  for (unsigned short int i = 0; i < TerrainTile::TILE_CELL_SIZE; i++) {
-    terrainTile->mHeights[i] = (i_terrain_height) ((rasterHeights[i] + 1000) * 5);
+    HeightConverter::toTerrainHeights(rasterHeights, tile.mHeights.data(), TerrainTile::TILE_CELL_SIZE);
   }
 
   // If we are not at the maximum zoom level we need to set child flags on the
@@ -56,28 +87,196 @@ ctb::TerrainTiler::createTile(const TileCoordinate &coord) const {
     CRSBounds tileBounds = mGrid.tileBounds(coord);
 
     if (! (bounds().overlaps(tileBounds))) {
-      terrainTile->setAllChildren(false);
+      tile.setAllChildren(false);
+    } else if (options.dataCoverage) {
+      // Only flag the children that will contain data
+      tile.setChildSW(tileHasData(TileCoordinate(coord.zoom + 1, coord.x * 2, coord.y * 2)));
+      tile.setChildSE(tileHasData(TileCoordinate(coord.zoom + 1, (coord.x * 2) + 1, coord.y * 2)));
+      tile.setChildNW(tileHasData(TileCoordinate(coord.zoom + 1, coord.x * 2, (coord.y * 2) + 1)));
+      tile.setChildNE(tileHasData(TileCoordinate(coord.zoom + 1, (coord.x * 2) + 1, (coord.y * 2) + 1)));
     } else {
       if (bounds().overlaps(tileBounds.getSW())) {
-        terrainTile->setChildSW();
+        tile.setChildSW();
       }
       if (bounds().overlaps(tileBounds.getNW())) {
-        terrainTile->setChildNW();
+        tile.setChildNW();
       }
       if (bounds().overlaps(tileBounds.getNE())) {
-        terrainTile->setChildNE();
+        tile.setChildNE();
       }
       if (bounds().overlaps(tileBounds.getSE())) {
-        terrainTile->setChildSE();
+        tile.setChildSE();
+      }
+    }
+  }
+
+  if (options.waterMask != NULL) {
+    options.waterMask->apply(tile);
+  }
+}
+
+/**
+ * @details A tile has data if it overlaps the dataset extent and the area of
+ * the dataset it is created from contains at least one pixel that is not
+ * masked out or set to the nodata value (see `GDALTiler::hasData`).
+ *
+ * The same tile is typically asked about twice: once when deciding whether
+ * to create it and again when its parent sets its child flags.  The first
+ * result is therefore cached and removed when it is used the second time.
+ * Results more than one zoom level above the tile being asked about are no
+ * longer needed by a parent so are discarded, and the cache is emptied if it
+ * grows large (e.g. when the parents are created by another tiler).
+ */
+bool
+ctb::TerrainTiler::tileHasData(const TileCoordinate &coord) const {
+  const std::uint64_t key = ((std::uint64_t) coord.x << 32) | coord.y;
+
+  mHasDataCache.erase(mHasDataCache.upper_bound(coord.zoom + 1), mHasDataCache.end());
+
+  std::unordered_map<std::uint64_t, bool> &cache = mHasDataCache[coord.zoom];
+  std::unordered_map<std::uint64_t, bool>::iterator cached = cache.find(key);
+  if (cached != cache.end()) {
+    const bool result = cached->second;
+    cache.erase(cached);
+    return result;
+  }
+
+  bool result = false;
+  if (bounds().overlaps(mGrid.tileBounds(coord))) {
+    double adfGeoTransform[6];
+    terrainTileGeoTransform(coord, adfGeoTransform);
+    result = hasData(adfGeoTransform, TILE_SIZE, TILE_SIZE);
+  }
+
+  if (cache.size() >= 65536) {
+    cache.clear();
+  }
+  cache[key] = result;
+
+  return result;
+}
+
+/**
+ * @details The tile heights are calculated by combining the heights of the
+ * child tiles covering each parent cell.  The combination corresponds to the
+ * resampling algorithm in the tiler options: `GRA_Min` and `GRA_Max` take the
+ * minimum and maximum heights, `GRA_NearestNeighbour` takes a single height
+ * and all other algorithms average the heights.
+ *
+ * Each tile includes a column of cells to the west and a row of cells to the
+ * north from the neighbouring tiles (see `TerrainTiler::terrainTileBounds`).
+ * A parent cell therefore covers the child cells on either side of it.  The
+ * children share the overlapping cells along their common edges.  The
+ * westernmost column and northernmost row of the parent extend half a cell
+ * beyond its children, so these cells are made from the overlapping child
+ * cells alone.
+ *
+ * A child which is `NULL` is treated as being at sea level, which is the
+ * same as resampling an area of the source dataset that does not contain any
+ * data.  Child flags are set on the tile for each child that is present.
+ *
+ * The heights, child flags and water mask of `tile` are all replaced, so a
+ * tile can be reused for any coordinate (see `TilePool`).  It must not be one
+ * of the children.
+ */
+void
+ctb::TerrainTiler::createTileFromChildren(const TileCoordinate &coord,
+                                          const TerrainTile *sw, const TerrainTile *se,
+                                          const TerrainTile *nw, const TerrainTile *ne,
+                                          TerrainTile &tile) const {
+  static_cast<TileCoordinate &>(tile) = coord;
+  const unsigned short int lastCell = TILE_SIZE - 1; // the index of the overlapping cell
+
+  // Children indexed by [south][east]
+  const TerrainTile *children[2][2] = { { nw, ne }, { sw, se } };
+
+  for (unsigned short int row = 0; row < TILE_SIZE; row++) {
+    for (unsigned short int col = 0; col < TILE_SIZE; col++) {
+      unsigned int count = 0, sum = 0;
+      i_terrain_height minHeight = 0, maxHeight = 0, nearest = 0;
+
+      // Visit the child cells covered by this parent cell.  Child cell
+      // coordinates run from 0 to (2 * lastCell) across both children.
+      for (int childRow = (2 * row) - 1; childRow <= 2 * row; childRow++) {
+        if (childRow < 0)
+          continue;             // beyond the northern edge of the children
+
+        const bool south = childRow > lastCell;
+        const unsigned short int y = south ? childRow - lastCell : childRow;
+
+        for (int childCol = (2 * col) - 1; childCol <= 2 * col; childCol++) {
+          if (childCol < 0)
+            continue;           // beyond the western edge of the children
+
+          const bool east = childCol > lastCell;
+          const unsigned short int x = east ? childCol - lastCell : childCol;
+          const TerrainTile *child = children[south][east];
+          const i_terrain_height height = child
+            ? child->mHeights[(y * TILE_SIZE) + x]
+            : SEA_LEVEL_HEIGHT;
+
+          if (count++ == 0) {
+            minHeight = maxHeight = height;
+          } else {
+            minHeight = std::min(minHeight, height);
+            maxHeight = std::max(maxHeight, height);
+          }
+          sum += height;
+          nearest = height;     // the south east child cell
+        }
+      }
+
+      i_terrain_height &height = tile.mHeights[(row * TILE_SIZE) + col];
+      switch (options.resampleAlg) {
+      case GRA_Min:
+        height = minHeight;
+        break;
+      case GRA_Max:
+        height = maxHeight;
+        break;
+      case GRA_NearestNeighbour:
+        height = nearest;
+        break;
+      default:
+        height = (i_terrain_height) ((sum + (count / 2)) / count);
+        break;
       }
     }
   }
 
+  // Flag the children that exist
+  tile.setChildSW(sw != NULL);
+  tile.setChildSE(se != NULL);
+  tile.setChildNW(nw != NULL);
+  tile.setChildNE(ne != NULL);
+
+  // The water mask is created from its source rather than the children's
+  // masks, so it keeps its full resolution
+  if (options.waterMask != NULL) {
+    options.waterMask->apply(tile);
+  } else {
+    tile.setIsLand();
+  }
+}
+
+TerrainTile *
+ctb::TerrainTiler::createTileFromChildren(const TileCoordinate &coord,
+                                          const TerrainTile *sw, const TerrainTile *se,
+                                          const TerrainTile *nw, const TerrainTile *ne) const {
+  TerrainTile *terrainTile = new TerrainTile(coord);
+
+  try {
+    createTileFromChildren(coord, sw, se, nw, ne, *terrainTile);
+  } catch (CTBException &) {
+    delete terrainTile;
+    throw;
+  }
+
   return terrainTile;
 }
 
-GDALTile *
-ctb::TerrainTiler::createRasterTile(const TileCoordinate &coord) const {
+void
+ctb::TerrainTiler::terrainTileGeoTransform(const TileCoordinate &coord, double (&adfGeoTransform)[6]) const {
   // Ensure we have some data from which to create a tile
   if (poDataset && poDataset->GetRasterCount() < 1) {
     throw CTBException("At least one band must be present in the GDAL dataset");
@@ -89,21 +288,85 @@ ctb::TerrainTiler::createRasterTile(const TileCoordinate &coord) const {
   CRSBounds tileBounds = terrainTileBounds(coord, resolution);
 
   // Convert the tile bounds into a geo transform
-  double adfGeoTransform[6];
   adfGeoTransform[0] = tileBounds.getMinX(); // min longitude
   adfGeoTransform[1] = resolution;
   adfGeoTransform[2] = 0;
   adfGeoTransform[3] = tileBounds.getMaxY(); // max latitude
   adfGeoTransform[4] = 0;
   adfGeoTransform[5] = -resolution;
+}
+
+/**
+ * @details A metatile is the block of `TilerOptions::metatileSize` by
+ * `TilerOptions::metatileSize` tiles, aligned to multiples of the metatile
+ * size, which contains the tile.  It is clipped to the tiles covering the
+ * dataset.  The heights of the whole metatile, including the overlapping
+ * column to the west and row to the north, are warped in one operation unless
+ * the metatile is the one already cached.  As each tile starts a tile width
+ * (minus the overlap) from its neighbour the heights of the tile can then be
+ * copied straight out of the metatile, with neighbouring tiles sharing
+ * exactly the same overlapping heights.
+ */
+template <typename T> void
+ctb::TerrainTiler::metatileHeights(const TileCoordinate &coord, T *heights, std::vector<T> &metatile) const {
+  const i_tile tileStep = TILE_SIZE - 1; // tiles overlap by a cell
+
+  if (metatile.empty()
+      || coord.zoom != mMetatileZoom
+      || coord.x < mMetatileBounds.getMinX() || coord.x > mMetatileBounds.getMaxX()
+      || coord.y < mMetatileBounds.getMinY() || coord.y > mMetatileBounds.getMaxY()) {
+    const i_tile metatileSize = options.metatileSize,
+      blockX = coord.x - (coord.x % metatileSize),
+      blockY = coord.y - (coord.y % metatileSize);
+    const TileBounds zoomBounds = tileBoundsForZoom(coord.zoom);
+
+    // Clip the block to the dataset tiles, always including the requested tile
+    mMetatileBounds = TileBounds(std::max(blockX, std::min(coord.x, zoomBounds.getMinX())),
+                                 std::max(blockY, std::min(coord.y, zoomBounds.getMinY())),
+                                 std::min(blockX + metatileSize - 1, std::max(coord.x, zoomBounds.getMaxX())),
+                                 std::min(blockY + metatileSize - 1, std::max(coord.y, zoomBounds.getMaxY())));
+    mMetatileZoom = coord.zoom;
+
+    // The metatile is georeferenced from its north west tile
+    double adfGeoTransform[6];
+    terrainTileGeoTransform(TileCoordinate(coord.zoom, mMetatileBounds.getMinX(), mMetatileBounds.getMaxY()),
+                            adfGeoTransform);
+
+    const int nXSize = ((mMetatileBounds.getWidth() + 1) * tileStep) + 1,
+      nYSize = ((mMetatileBounds.getHeight() + 1) * tileStep) + 1;
+
+    metatile.resize(nXSize * nYSize);
+    try {
+      warpToBuffer(adfGeoTransform, nXSize, nYSize, metatile.data());
+    } catch (CTBException &) {
+      metatile.clear();
+      throw;
+    }
+  }
+
+  // Copy the tile out of the metatile, which is ordered from north to south
+  const i_tile metatileWidth = ((mMetatileBounds.getWidth() + 1) * tileStep) + 1,
+    offsetX = (coord.x - mMetatileBounds.getMinX()) * tileStep,
+    offsetY = (mMetatileBounds.getMaxY() - coord.y) * tileStep;
+
+  for (unsigned short int row = 0; row < TILE_SIZE; row++) {
+    const T *source = &metatile[((offsetY + row) * metatileWidth) + offsetX];
+    std::copy(source, source + TILE_SIZE, heights + (row * TILE_SIZE));
+  }
+}
+
+GDALTile *
+ctb::TerrainTiler::createRasterTile(const TileCoordinate &coord) const {
+  double adfGeoTransform[6];
+  terrainTileGeoTransform(coord, adfGeoTransform);
 
   GDALTile *tile = GDALTiler::createRasterTile(adfGeoTransform);
 
   // The previous geotransform represented the data with an overlap as required
   // by the terrain specification.  This now needs to be overwritten so that
   // the data is shifted to the bounds defined by tile itself.
-  tileBounds = mGrid.tileBounds(coord);
-  resolution = mGrid.resolution(coord.zoom);
+  CRSBounds tileBounds = mGrid.tileBounds(coord);
+  double resolution = mGrid.resolution(coord.zoom);
   adfGeoTransform[0] = tileBounds.getMinX(); // min longitude
   adfGeoTransform[1] = resolution;
   adfGeoTransform[2] = 0;
@@ -122,6 +385,8 @@ ctb::TerrainTiler::createRasterTile(const TileCoordinate &coord) const {
 TerrainTiler &
 ctb::TerrainTiler::operator=(const TerrainTiler &other) {
   GDALTiler::operator=(other);
+  mMetatileHeights.clear();
+  mMetatileTerrainHeights.clear();
 
   return *this;
 }
@@ -22,6 +22,11 @@
  * @brief This declares the `TerrainTiler` class
  */
 
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
 #include "TerrainTile.hpp"
 #include "GDALTiler.hpp"
 
@@ -35,6 +40,19 @@ namespace ctb {
  * This class derives from `GDALTiler` and adds the
  * `GDALTiler::createTerrainTile` method enabling `TerrainTile`s to be created
  * for a specific `TileCoordinate`.
+ *
+ * Tiles below the maximum zoom level can alternatively be created from their
+ * four child tiles using `TerrainTiler::createTileFromChildren`.  This avoids
+ * resampling large areas of the source dataset when building low zoom levels.
+ *
+ * If the `TilerOptions::metatileSize` is greater than `1` the heights for a
+ * block of adjacent tiles (a metatile) are warped in a single operation and
+ * cached, with subsequent tiles in the block being cut from the cache.  Tiles
+ * should therefore be created a metatile at a time.
+ *
+ * Tiles are all land unless `TilerOptions::waterMask` is set, in which case
+ * it sets the water mask of each tile, including those created from their
+ * children.
  */
 class CTB_DLL ctb::TerrainTiler :
   public GDALTiler
@@ -61,12 +79,41 @@ public:
   TerrainTile *
   createTile(const TileCoordinate &coord) const override;
 
+  /// Create a tile in an existing terrain tile, reusing its memory
+  void
+  createTile(const TileCoordinate &coord, TerrainTile &tile) const;
+
+  /// Does the dataset contain any data for a tile?
+  bool
+  tileHasData(const TileCoordinate &coord) const;
+
+  /// Create a tile by downsampling the tiles at the next zoom level
+  TerrainTile *
+  createTileFromChildren(const TileCoordinate &coord,
+                         const TerrainTile *sw, const TerrainTile *se,
+                         const TerrainTile *nw, const TerrainTile *ne) const;
+
+  /// Create a tile from its children in an existing terrain tile, reusing its memory
+  void
+  createTileFromChildren(const TileCoordinate &coord,
+                         const TerrainTile *sw, const TerrainTile *se,
+                         const TerrainTile *nw, const TerrainTile *ne,
+                         TerrainTile &tile) const;
+
 protected:
 
   /// Create a `GDALTile` representing the required terrain tile data
   virtual GDALTile *
   createRasterTile(const TileCoordinate &coord) const override;
 
+  /// Get the geo transform of the terrain tile data including the overlap
+  void
+  terrainTileGeoTransform(const TileCoordinate &coord, double (&adfGeoTransform)[6]) const;
+
+  /// Get the heights of a tile from the cached metatile containing it
+  template <typename T> void
+  metatileHeights(const TileCoordinate &coord, T *heights, std::vector<T> &metatile) const;
+
   /**
    * @brief Get terrain bounds shifted to introduce a pixel overlap
    *
@@ -97,6 +144,23 @@ protected:
 
     return tile;
   }
+
+  /// The raster heights of the most recently warped metatile
+  mutable std::vector<float> mMetatileHeights;
+
+  /// The terrain heights of the most recently warped metatile, when warping
+  /// terrain heights directly
+  mutable std::vector<i_terrain_height> mMetatileTerrainHeights;
+
+  /// The zoom level of the cached metatile
+  mutable i_zoom mMetatileZoom = 0;
+
+  /// The tiles covered by the cached metatile
+  mutable TileBounds mMetatileBounds;
+
+  /// Results of `tileHasData` waiting to be used again, by zoom level and
+  /// then by tile x and y
+  mutable std::map<i_zoom, std::unordered_map<std::uint64_t, bool>> mHasDataCache;
 };
 
 #endif /* TERRAINTILER_HPP */
@@ -0,0 +1,220 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TileAvailability.cpp
+ * @brief This defines the `TileAvailability` class
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+#include "ogr_spatialref.h"
+
+#include "CTBException.hpp"
+#include "TileAvailability.hpp"
+
+using namespace ctb;
+
+/// Write a string to a file as a JSON string
+static void
+writeJsonString(FILE *fp, const char *value) {
+  fputc('"', fp);
+
+  for (const char *c = value; *c != '\0'; ++c) {
+    if (*c == '"' || *c == '\\') {
+      fputc('\\', fp);
+      fputc(*c, fp);
+    } else if ((unsigned char) *c < 0x20) {
+      fprintf(fp, "\\u%04x", (unsigned int) *c);
+    } else {
+      fputc(*c, fp);
+    }
+  }
+
+  fputc('"', fp);
+}
+
+TileAvailability::TileAvailability(const GDALTiler &tiler, i_zoom startZoom, i_zoom endZoom):
+  mStartZoom(startZoom),
+  mEndZoom(endZoom),
+  mExtent(tiler.bounds()),
+  mGeographic(tiler.grid().getSRS().IsGeographic())
+{
+  for (i_zoom zoom = endZoom; zoom <= startZoom; ++zoom) {
+    mBounds.push_back(tiler.tileBoundsForZoom(zoom));
+    mLevels.emplace_back(new Level());
+  }
+}
+
+/**
+ * @details The tile is merged with the runs either side of it in its row.
+ * Tiles outside the tileset are ignored.  This is safe to call from multiple
+ * threads.
+ */
+void
+TileAvailability::add(const TileCoordinate &coord) {
+  if (coord.zoom < mEndZoom || coord.zoom > mStartZoom)
+    return;
+
+  const TileBounds &bounds = mBounds[coord.zoom - mEndZoom];
+  if (coord.x < bounds.getMinX() || coord.x > bounds.getMaxX() ||
+      coord.y < bounds.getMinY() || coord.y > bounds.getMaxY())
+    return;
+
+  Level &level = *mLevels[coord.zoom - mEndZoom];
+  std::lock_guard<std::mutex> lock(level.mutex);
+  std::map<i_tile, i_tile> &runs = level.rows[coord.y];
+
+  // The first run starting after the tile
+  auto next = runs.upper_bound(coord.x);
+  const bool joinsNext = next != runs.end() && next->first == coord.x + 1;
+
+  if (next != runs.begin()) {
+    auto previous = std::prev(next);
+
+    if (previous->second >= coord.x) {
+      return;                   // the tile is already available
+    } else if (previous->second + 1 == coord.x) {
+      previous->second = joinsNext ? next->second : coord.x;
+      if (joinsNext)
+        runs.erase(next);
+      return;
+    }
+  }
+
+  if (joinsNext) {
+    const i_tile last = next->second;
+    runs.erase(next);
+    runs[coord.x] = last;
+  } else {
+    runs[coord.x] = coord.x;
+  }
+}
+
+/**
+ * @details The rows are visited from south to north, each run extending the
+ * rectangle with the same columns that ended in the row below or otherwise
+ * starting a new rectangle.  The rectangles are ordered by their lower left
+ * tile.
+ */
+std::vector<TileBounds>
+TileAvailability::ranges(i_zoom zoom) const {
+  std::vector<TileBounds> ranges;
+
+  if (zoom < mEndZoom || zoom > mStartZoom)
+    return ranges;
+
+  // The rectangles ending in the previous row, by their columns
+  typedef std::map<std::pair<i_tile, i_tile>, TileBounds> OpenRanges;
+  OpenRanges open, current;
+
+  const Level &level = *mLevels[zoom - mEndZoom];
+  std::lock_guard<std::mutex> lock(level.mutex);
+
+  for (const auto &row : level.rows) {
+    const i_tile y = row.first;
+
+    for (const auto &run : row.second) {
+      const std::pair<i_tile, i_tile> columns(run.first, run.second);
+      auto found = open.find(columns);
+
+      if (found != open.end() && found->second.getMaxY() + 1 == y) {
+        TileBounds extended = found->second;
+        extended.setMaxY(y);
+        current[columns] = extended;
+        open.erase(found);
+      } else {
+        current[columns] = TileBounds(run.first, y, run.second, y);
+      }
+    }
+
+    // Rectangles not continued by this row are complete
+    for (const auto &range : open) {
+      ranges.push_back(range.second);
+    }
+
+    open.swap(current);
+    current.clear();
+  }
+
+  for (const auto &range : open) {
+    ranges.push_back(range.second);
+  }
+
+  std::sort(ranges.begin(), ranges.end(), [](const TileBounds &a, const TileBounds &b) {
+      return (a.getMinY() == b.getMinY()) ? a.getMinX() < b.getMinX() : a.getMinY() < b.getMinY();
+    });
+
+  return ranges;
+}
+
+/**
+ * @details The `available` property lists the rectangles of each zoom level
+ * from zoom level 0 to the start zoom level, zoom levels that weren't built
+ * having none.  `format` is either `heightmap-1.0` or `quantized-mesh-1.0`.
+ */
+void
+TileAvailability::writeLayerJson(const char *fileName, const char *name, const char *format) const {
+  FILE *fp = fopen(fileName, "w");
+
+  if (fp == NULL) {
+    throw CTBException("Failed to open file");
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"tilejson\": \"2.1.0\",\n");
+  fprintf(fp, "  \"name\": ");
+  writeJsonString(fp, name);
+  fprintf(fp, ",\n");
+  fprintf(fp, "  \"version\": \"1.0.0\",\n");
+  fprintf(fp, "  \"format\": \"%s\",\n", format);
+  fprintf(fp, "  \"scheme\": \"tms\",\n");
+  fprintf(fp, "  \"tiles\": [\"{z}/{x}/{y}.terrain?v={version}\"],\n");
+  fprintf(fp, "  \"projection\": \"%s\",\n", mGeographic ? "EPSG:4326" : "EPSG:3857");
+
+  // The bounds are only in longitude and latitude for a geographic grid
+  if (mGeographic) {
+    fprintf(fp, "  \"bounds\": [%.8f, %.8f, %.8f, %.8f],\n",
+            mExtent.getMinX(), mExtent.getMinY(), mExtent.getMaxX(), mExtent.getMaxY());
+  }
+
+  fprintf(fp, "  \"minzoom\": %u,\n", (unsigned int) mEndZoom);
+  fprintf(fp, "  \"maxzoom\": %u,\n", (unsigned int) mStartZoom);
+  fprintf(fp, "  \"available\": [");
+
+  for (i_zoom zoom = 0; zoom <= mStartZoom; ++zoom) {
+    const std::vector<TileBounds> zoomRanges = ranges(zoom);
+
+    fprintf(fp, "%s\n    [", (zoom > 0) ? "," : "");
+    for (size_t i = 0; i < zoomRanges.size(); ++i) {
+      const TileBounds &range = zoomRanges[i];
+      fprintf(fp, "%s{\"startX\": %u, \"startY\": %u, \"endX\": %u, \"endY\": %u}",
+              (i > 0) ? ", " : "",
+              range.getMinX(), range.getMinY(), range.getMaxX(), range.getMaxY());
+    }
+    fprintf(fp, "]");
+  }
+
+  fprintf(fp, "\n  ]\n}\n");
+
+  const bool written = ferror(fp) == 0;
+
+  if (fclose(fp) != 0 || !written) {
+    throw CTBException("Failed to write layer.json");
+  }
+}
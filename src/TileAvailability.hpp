@@ -0,0 +1,98 @@
+#ifndef TILEAVAILABILITY_HPP
+#define TILEAVAILABILITY_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TileAvailability.hpp
+ * @brief This declares the `TileAvailability` class
+ */
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "config.hpp"
+#include "types.hpp"
+#include "TileCoordinate.hpp"
+#include "GDALTiler.hpp"
+
+namespace ctb {
+  class TileAvailability;
+}
+
+/**
+ * @brief Collect the tiles available in a tileset as it is built
+ *
+ * Cesium terrain servers describe a tileset with a `layer.json` file listing
+ * the rectangles of tiles available at each zoom level.  Rather than scanning
+ * the tileset once it is built, each tile is added as it is written: adjacent
+ * tiles in a row are merged into runs as they are added, and rows with the
+ * same runs are merged into rectangles when the availability is requested.
+ * The memory used is proportional to the number of runs, not the number of
+ * tiles.
+ */
+class CTB_DLL ctb::TileAvailability {
+public:
+
+  /// Collect the available tiles of a tiler between two zoom levels
+  TileAvailability(const GDALTiler &tiler, i_zoom startZoom, i_zoom endZoom);
+
+  /// Add an available tile
+  void
+  add(const TileCoordinate &coord);
+
+  /// Get the rectangles of available tiles in a zoom level
+  std::vector<TileBounds>
+  ranges(i_zoom zoom) const;
+
+  /// Write the availability as a Cesium `layer.json` file
+  void
+  writeLayerJson(const char *fileName, const char *name, const char *format) const;
+
+protected:
+
+  /// The runs of available tiles in each row of a zoom level
+  struct Level {
+    /// The last column of each run by its first column, by row
+    std::map<i_tile, std::map<i_tile, i_tile>> rows;
+
+    /// Serialises access to the rows
+    mutable std::mutex mutex;
+  };
+
+  /// The first zoom level of the tileset
+  i_zoom mStartZoom;
+
+  /// The last zoom level of the tileset
+  i_zoom mEndZoom;
+
+  /// The tile bounds of each zoom level from the end zoom level up
+  std::vector<TileBounds> mBounds;
+
+  /// The available tiles of each zoom level from the end zoom level up
+  std::vector<std::unique_ptr<Level>> mLevels;
+
+  /// The bounds of the tileset in its coordinate system
+  CRSBounds mExtent;
+
+  /// Does the tileset use a geographic coordinate system?
+  bool mGeographic;
+};
+
+#endif /* TILEAVAILABILITY_HPP */
@@ -0,0 +1,312 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TileJournal.cpp
+ * @brief This defines the `TileJournal` class
+ */
+
+// Journals of large tilesets exceed 2 GiB, so use 64 bit file offsets
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>              // for fseeko
+#include <string.h>             // for memcmp, memcpy
+
+#ifndef _WIN32
+#include <sys/types.h>          // for off_t
+#endif
+
+#include "CTBException.hpp"
+#include "TileJournal.hpp"
+
+using namespace ctb;
+
+/// The magic bytes identifying a tile journal
+static const char JOURNAL_MAGIC[8] = {'C', 'T', 'B', 'J', 'R', 'N', 'A', 'L'};
+
+/// The version of the journal format
+static const uint32_t JOURNAL_VERSION = 1;
+
+/// The byte size of the journal header
+static const size_t HEADER_SIZE = 32;
+
+/// The number of completed tiles buffered before they are written
+static const size_t BUFFER_SIZE = 4096;
+
+/// The longest time completed tiles are buffered before they are written
+static const std::chrono::seconds FLUSH_INTERVAL(1);
+
+/**
+ * @details The header consists of the magic bytes, the format version, the
+ * start and end zoom levels, the number of tiles and a hash of the tile bounds
+ * of each zoom level.
+ */
+static void
+createHeader(unsigned char (&header)[HEADER_SIZE], i_zoom startZoom, i_zoom endZoom,
+             uint64_t tileCount, const std::vector<TileBounds> &bounds) {
+  const uint16_t zooms[2] = {startZoom, endZoom};
+  uint64_t boundsHash = 14695981039346656037ULL; // FNV-1a
+
+  for (const TileBounds &zoomBounds : bounds) {
+    const i_tile values[4] = {zoomBounds.getMinX(), zoomBounds.getMinY(),
+                              zoomBounds.getMaxX(), zoomBounds.getMaxY()};
+    for (i_tile value : values) {
+      boundsHash = (boundsHash ^ value) * 1099511628211ULL;
+    }
+  }
+
+  memset(header, 0, HEADER_SIZE);
+  memcpy(header, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+  memcpy(header + 8, &JOURNAL_VERSION, sizeof(JOURNAL_VERSION));
+  memcpy(header + 12, zooms, sizeof(zooms));
+  memcpy(header + 16, &tileCount, sizeof(tileCount));
+  memcpy(header + 24, &boundsHash, sizeof(boundsHash));
+}
+
+/**
+ * @details If `resume` is set and an existing journal for the same tileset is
+ * found then its tiles are loaded and new tiles are appended to it, otherwise
+ * a new journal is created in its place.
+ */
+TileJournal::TileJournal(const char *fileName, const GDALTiler &tiler,
+                         i_zoom startZoom, i_zoom endZoom, bool resume):
+  mStartZoom(startZoom),
+  mTileCount(0),
+  mLoaded(false),
+  mLoadedCount(0),
+  mLoadedRecords(0),
+  mFile(NULL),
+  mLastFlush(std::chrono::steady_clock::now())
+{
+  if (startZoom < endZoom) {
+    throw CTBException("The journal start zoom level is less than the end zoom level");
+  }
+
+  for (int zoom = startZoom; zoom >= endZoom; --zoom) {
+    const TileBounds zoomBounds = tiler.tileBoundsForZoom(zoom);
+
+    mBounds.push_back(zoomBounds);
+    mOffsets.push_back(mTileCount);
+    mTileCount += (uint64_t) (zoomBounds.getMaxX() - zoomBounds.getMinX() + 1) *
+      (zoomBounds.getMaxY() - zoomBounds.getMinY() + 1);
+  }
+
+  if (resume) {
+    mBitmap.assign((mTileCount + 63) / 64, 0);
+    mLoaded = load(fileName);
+  }
+
+  if (mLoaded) {
+    mFile = fopen(fileName, "r+b");
+    if (mFile == NULL) {
+      throw CTBException("Could not open the tile journal");
+    }
+
+    // Append after the last complete record, overwriting any partial record
+    const uint64_t end = HEADER_SIZE + mLoadedRecords * sizeof(uint64_t);
+#ifdef _WIN32
+    const int status = _fseeki64(mFile, (__int64) end, SEEK_SET);
+#else
+    const int status = fseeko(mFile, (off_t) end, SEEK_SET);
+#endif
+    if (status != 0) {
+      fclose(mFile);
+      throw CTBException("Could not seek to the end of the tile journal");
+    }
+  } else {
+    mBitmap.clear();
+
+    mFile = fopen(fileName, "wb");
+    if (mFile == NULL) {
+      throw CTBException("Could not create the tile journal");
+    }
+
+    unsigned char header[HEADER_SIZE];
+    createHeader(header, startZoom, endZoom, mTileCount, mBounds);
+
+    if (fwrite(header, 1, HEADER_SIZE, mFile) != HEADER_SIZE || fflush(mFile) != 0) {
+      fclose(mFile);
+      throw CTBException("Could not write the tile journal header");
+    }
+  }
+
+  mBuffer.reserve(BUFFER_SIZE);
+}
+
+/**
+ * @details Any errors are ignored: call `TileJournal::close` first in order
+ * to handle them.
+ */
+TileJournal::~TileJournal() {
+  try {
+    close();
+  } catch (CTBException &e) {}
+}
+
+/**
+ * @details Zoom levels are indexed from the start zoom level down, and tiles
+ * within a zoom level by row from the bottom of the tile bounds.
+ */
+uint64_t
+TileJournal::tileIndex(const TileCoordinate &coord) const {
+  if (coord.zoom > mStartZoom || (size_t) (mStartZoom - coord.zoom) >= mBounds.size())
+    return mTileCount;
+
+  const size_t level = mStartZoom - coord.zoom;
+  const TileBounds &bounds = mBounds[level];
+
+  if (coord.x < bounds.getMinX() || coord.x > bounds.getMaxX() ||
+      coord.y < bounds.getMinY() || coord.y > bounds.getMaxY())
+    return mTileCount;
+
+  const uint64_t width = bounds.getMaxX() - bounds.getMinX() + 1;
+  return mOffsets[level] + (coord.y - bounds.getMinY()) * width + (coord.x - bounds.getMinX());
+}
+
+/**
+ * @details This is thread safe as the bitmap is only modified when the journal
+ * is opened.
+ */
+bool
+TileJournal::isComplete(const TileCoordinate &coord) const {
+  if (!mLoaded)
+    return false;
+
+  const uint64_t index = tileIndex(coord);
+  if (index >= mTileCount)
+    return false;
+
+  return (mBitmap[index / 64] >> (index % 64)) & 1;
+}
+
+/**
+ * @details This is thread safe.  Tiles outside the tileset are ignored.
+ */
+void
+TileJournal::complete(const TileCoordinate &coord) {
+  const uint64_t index = tileIndex(coord);
+  if (index >= mTileCount)
+    return;
+
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  if (mFile == NULL) {
+    throw CTBException("The tile journal is closed");
+  }
+
+  mBuffer.push_back(index);
+
+  if (mBuffer.size() >= BUFFER_SIZE ||
+      std::chrono::steady_clock::now() - mLastFlush >= FLUSH_INTERVAL) {
+    writeBuffer();
+  }
+}
+
+void
+TileJournal::flush() {
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  if (mFile != NULL)
+    writeBuffer();
+}
+
+/**
+ * @details Calling this more than once has no effect.
+ */
+void
+TileJournal::close() {
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  if (mFile == NULL)
+    return;
+
+  try {
+    writeBuffer();
+  } catch (CTBException &e) {
+    fclose(mFile);
+    mFile = NULL;
+    throw;
+  }
+
+  const int result = fclose(mFile);
+  mFile = NULL;
+
+  if (result != 0) {
+    throw CTBException("Could not close the tile journal");
+  }
+}
+
+/**
+ * @details Records beyond the tileset or following a truncated record are
+ * ignored, as they can only result from an interrupted write.
+ */
+bool
+TileJournal::load(const char *fileName) {
+  FILE *fp = fopen(fileName, "rb");
+  if (fp == NULL)
+    return false;
+
+  unsigned char header[HEADER_SIZE], expected[HEADER_SIZE];
+  createHeader(expected, mStartZoom, mStartZoom - (i_zoom) (mBounds.size() - 1), mTileCount, mBounds);
+
+  if (fread(header, 1, HEADER_SIZE, fp) != HEADER_SIZE || memcmp(header, expected, HEADER_SIZE) != 0) {
+    fclose(fp);
+    return false;
+  }
+
+  std::vector<uint64_t> records(1 << 16);
+  size_t count;
+
+  while ((count = fread(records.data(), sizeof(uint64_t), records.size(), fp)) > 0) {
+    for (size_t i = 0; i < count; ++i) {
+      const uint64_t index = records[i];
+      if (index >= mTileCount)
+        continue;
+
+      uint64_t &word = mBitmap[index / 64];
+      const uint64_t bit = 1ULL << (index % 64);
+      if (!(word & bit)) {
+        word |= bit;
+        ++mLoadedCount;
+      }
+    }
+
+    mLoadedRecords += count;
+  }
+
+  fclose(fp);
+  return true;
+}
+
+/**
+ * @details The data is flushed to the operating system so it survives the
+ * process being killed.
+ */
+void
+TileJournal::writeBuffer() {
+  if (!mBuffer.empty()) {
+    if (fwrite(mBuffer.data(), sizeof(uint64_t), mBuffer.size(), mFile) != mBuffer.size()
+        || fflush(mFile) != 0) {
+      throw CTBException("Could not write to the tile journal");
+    }
+
+    mBuffer.clear();
+  }
+
+  mLastFlush = std::chrono::steady_clock::now();
+}
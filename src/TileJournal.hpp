@@ -0,0 +1,159 @@
+#ifndef TILEJOURNAL_HPP
+#define TILEJOURNAL_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TileJournal.hpp
+ * @brief This declares the `TileJournal` class
+ */
+
+#include <cstdio>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+#include "config.hpp"
+#include "types.hpp"
+#include "TileCoordinate.hpp"
+#include "GDALTiler.hpp"
+
+namespace ctb {
+  class TileJournal;
+}
+
+/**
+ * @brief Record the tiles of a tileset that have been completed
+ *
+ * The journal is an append only file listing the index of each tile once it
+ * has been written, so an interrupted tiling operation can be resumed without
+ * checking the filesystem for every tile.  Tiles are indexed by zoom level,
+ * from the start zoom level down, and then by row and column within the tile
+ * bounds of the zoom level.
+ *
+ * When resuming, the tiles recorded by the existing journal are loaded into a
+ * bitmap so checking whether a tile was completed is a constant time lookup.
+ * Completed tiles are buffered and appended to the journal periodically:
+ * tiles that were completed but not recorded before an interruption are
+ * simply created again.
+ *
+ * The journal header identifies the tileset so a journal for different zoom
+ * levels or a different extent is not used.
+ */
+class CTB_DLL ctb::TileJournal {
+public:
+
+  /// Open a journal for the tiles of a tiler between two zoom levels
+  TileJournal(const char *fileName, const GDALTiler &tiler,
+              i_zoom startZoom, i_zoom endZoom, bool resume);
+
+  /// Flush and close the journal
+  ~TileJournal();
+
+  /// Was the tile completed before the journal was opened?
+  bool
+  isComplete(const TileCoordinate &coord) const;
+
+  /// Record that a tile has been completed
+  void
+  complete(const TileCoordinate &coord);
+
+  /// Append the buffered tiles to the journal file
+  void
+  flush();
+
+  /// Flush and close the journal file
+  void
+  close();
+
+  /// Were the tiles recorded by an existing journal loaded?
+  inline bool
+  loaded() const {
+    return mLoaded;
+  }
+
+  /// Get the number of tiles loaded from an existing journal
+  inline uint64_t
+  loadedCount() const {
+    return mLoadedCount;
+  }
+
+  /// Get the number of tiles in the tileset
+  inline uint64_t
+  tileCount() const {
+    return mTileCount;
+  }
+
+protected:
+
+  /// Get the index of a tile, or `tileCount()` if it isn't in the tileset
+  uint64_t
+  tileIndex(const TileCoordinate &coord) const;
+
+  /// Load the tiles recorded by an existing journal, returning `false` if it
+  /// doesn't match the tileset
+  bool
+  load(const char *fileName);
+
+  /// Write the buffered tiles, the mutex being held
+  void
+  writeBuffer();
+
+  /// The first zoom level of the tileset
+  i_zoom mStartZoom;
+
+  /// The tile bounds of each zoom level from the start zoom level down
+  std::vector<TileBounds> mBounds;
+
+  /// The index of the first tile in each zoom level
+  std::vector<uint64_t> mOffsets;
+
+  /// The number of tiles in the tileset
+  uint64_t mTileCount;
+
+  /// The tiles completed before the journal was opened, one bit per tile
+  std::vector<uint64_t> mBitmap;
+
+  /// Was an existing journal loaded?
+  bool mLoaded;
+
+  /// The number of tiles loaded from an existing journal
+  uint64_t mLoadedCount;
+
+  /// The number of complete records in an existing journal
+  uint64_t mLoadedRecords;
+
+  /// The journal file
+  FILE *mFile;
+
+  /// The completed tiles waiting to be written
+  std::vector<uint64_t> mBuffer;
+
+  /// When the buffer was last written
+  std::chrono::steady_clock::time_point mLastFlush;
+
+  /// Serialises access to the buffer and file
+  std::mutex mMutex;
+
+private:
+
+  /// The journal owns a file handle so it can't be copied
+  TileJournal(const TileJournal &);
+  TileJournal &operator=(const TileJournal &);
+};
+
+#endif /* TILEJOURNAL_HPP */
@@ -0,0 +1,136 @@
+#ifndef TILEPOOL_HPP
+#define TILEPOOL_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TilePool.hpp
+ * @brief This declares and defines the `TilePool` class
+ */
+
+#include <memory>
+#include <vector>
+
+#include "TileCoordinate.hpp"
+
+namespace ctb {
+  template <class T> class TilePool;
+}
+
+/**
+ * @brief Recycle tile objects rather than allocating one for every tile
+ *
+ * Tiles are acquired from the pool as handles which return the tile to the
+ * pool when they go out of scope, so the memory of a tile is reused by the
+ * next tile instead of being freed and allocated again.  A recycled tile
+ * keeps the data of its previous use: it should be completely overwritten,
+ * for instance by `TerrainTiler::createTile(const TileCoordinate &,
+ * TerrainTile &)`.
+ *
+ * A pool isn't thread safe and is intended to be used by a single thread,
+ * each thread having its own pool.  The pool must outlive its handles.
+ */
+template <class T>
+class ctb::TilePool {
+public:
+
+  /// Return a tile to its pool
+  class Releaser {
+  public:
+    Releaser(TilePool<T> *pool = NULL):
+      mPool(pool)
+    {}
+
+    void
+    operator()(T *tile) const {
+      if (mPool != NULL)
+        mPool->release(tile);
+      else
+        delete tile;
+    }
+
+  private:
+    TilePool<T> *mPool;         ///< The pool owning the tile
+  };
+
+  /// A tile owned by the pool
+  typedef std::unique_ptr<T, Releaser> Handle;
+
+  /// Create a pool retaining up to a number of unused tiles
+  TilePool(size_t capacity = 4):
+    mCapacity(capacity),
+    mAllocations(0)
+  {}
+
+  /// Delete the unused tiles
+  ~TilePool() {
+    for (T *tile : mFree) {
+      delete tile;
+    }
+  }
+
+  /// Get a tile for a coordinate, reusing an unused tile if there is one
+  Handle
+  acquire(const TileCoordinate &coord) {
+    if (mFree.empty()) {
+      ++mAllocations;
+      return Handle(new T(coord), Releaser(this));
+    }
+
+    T *tile = mFree.back();
+    mFree.pop_back();
+    static_cast<TileCoordinate &>(*tile) = coord;
+
+    return Handle(tile, Releaser(this));
+  }
+
+  /// Return a tile to the pool, deleting it if the pool is full
+  void
+  release(T *tile) {
+    if (tile == NULL)
+      return;
+
+    if (mFree.size() < mCapacity) {
+      mFree.push_back(tile);
+    } else {
+      delete tile;
+    }
+  }
+
+  /// Get the number of tiles the pool has allocated
+  inline size_t
+  allocations() const {
+    return mAllocations;
+  }
+
+private:
+
+  /// The maximum number of unused tiles retained
+  size_t mCapacity;
+
+  /// The number of tiles allocated
+  size_t mAllocations;
+
+  /// The unused tiles
+  std::vector<T *> mFree;
+
+  /// The pool owns its tiles so it can't be copied
+  TilePool(const TilePool &);
+  TilePool &operator=(const TilePool &);
+};
+
+#endif /* TILEPOOL_HPP */
@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TileScheduler.cpp
+ * @brief This defines the `TileScheduler` class
+ */
+
+#include <algorithm>            // for std::min, std::max
+
+#include "CTBException.hpp"
+#include "TileScheduler.hpp"
+
+using namespace ctb;
+
+TileScheduler::TileScheduler(const GridIterator &iter, unsigned int workerCount, i_tile chunkSize)
+{
+  if (workerCount < 1) {
+    throw CTBException("A tile scheduler requires at least one worker");
+  }
+
+  for (unsigned int i = 0; i < workerCount; ++i) {
+    mWorkers.push_back(std::unique_ptr<Worker>(new Worker()));
+  }
+
+  // Divide each zoom level between the workers, starting with the zoom level
+  // that is iterated over first
+  for (i_zoom zoom = iter.getStartZoom(); ; --zoom) {
+    const TileBounds &bounds = iter.getZoomBounds(zoom);
+    const i_tile columnSize = bounds.getHeight() + 1,
+      zoomSize = (bounds.getWidth() + 1) * columnSize,
+      offset = iter.getZoomOffset(zoom);
+
+    i_tile zoomChunkSize = chunkSize;
+    if (zoomChunkSize == 0) {
+      zoomChunkSize = std::max<i_tile>(1, zoomSize / (workerCount * CHUNKS_PER_WORKER));
+    }
+
+    // Prefer chunks composed of whole columns so they cover a rectangle
+    if (zoomChunkSize > columnSize) {
+      zoomChunkSize -= zoomChunkSize % columnSize;
+    }
+
+    // Hand out contiguous runs of chunks to each worker
+    const i_tile chunkCount = (zoomSize + zoomChunkSize - 1) / zoomChunkSize;
+    for (i_tile chunk = 0; chunk < chunkCount; ++chunk) {
+      const i_tile start = offset + (chunk * zoomChunkSize),
+        end = std::min(start + zoomChunkSize, offset + zoomSize);
+      const unsigned int worker = (unsigned int) (((unsigned long long) chunk * workerCount) / chunkCount);
+
+      mWorkers[worker]->chunks.push_back(TileRange(start, end));
+    }
+
+    if (zoom == iter.getEndZoom())
+      break;
+  }
+}
+
+/**
+ * @details This is called repeatedly by a worker thread to obtain the tiles it
+ * should process.  The worker's own chunks are exhausted before any work is
+ * stolen from other workers.
+ */
+bool
+TileScheduler::next(unsigned int worker, i_tile &index) {
+  Worker &self = *mWorkers[worker];
+
+  {
+    std::lock_guard<std::mutex> lock(self.mutex);
+
+    if (self.current.size() == 0 && !self.chunks.empty()) {
+      self.current = self.chunks.front();
+      self.chunks.pop_front();
+    }
+
+    if (self.current.size() > 0) {
+      index = self.current.start++;
+      return true;
+    }
+  }
+
+  // Our own work is done: try and take some from the other workers
+  TileRange stolen;
+  if (!steal(worker, stolen)) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(self.mutex);
+  index = stolen.start++;
+  self.current = stolen;
+
+  return true;
+}
+
+/**
+ * @details The victim with the most outstanding chunks is chosen so that a
+ * thief is likely to obtain a substantial amount of work, reducing the
+ * number of subsequent steals.  Only when no chunks remain anywhere are the
+ * chunks currently being processed split.
+ */
+bool
+TileScheduler::steal(unsigned int thief, TileRange &range) {
+  const unsigned int workerCount = mWorkers.size();
+
+  while (true) {
+    unsigned int victim = thief;
+    size_t mostChunks = 0;
+    i_tile mostTiles = 1;       // there's no point in splitting a single tile
+    bool split = false;
+
+    // Find the most heavily loaded worker.  This is a heuristic: the load may
+    // change before the victim is locked.
+    for (unsigned int i = 1; i < workerCount; ++i) {
+      const unsigned int candidate = (thief + i) % workerCount;
+      Worker &worker = *mWorkers[candidate];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+
+      if (worker.chunks.size() > mostChunks) {
+        mostChunks = worker.chunks.size();
+        victim = candidate;
+        split = false;
+      } else if (mostChunks == 0 && worker.current.size() > mostTiles) {
+        mostTiles = worker.current.size();
+        victim = candidate;
+        split = true;
+      }
+    }
+
+    if (victim == thief) {
+      return false;             // there is nothing left to steal
+    }
+
+    Worker &worker = *mWorkers[victim];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+
+    if (!split && !worker.chunks.empty()) {
+      range = worker.chunks.back();
+      worker.chunks.pop_back();
+      return true;
+    } else if (split && worker.current.size() > 1) {
+      const i_tile middle = worker.current.start + (worker.current.size() / 2);
+      range = TileRange(middle, worker.current.end);
+      worker.current.end = middle;
+      return true;
+    }
+
+    // The victim's work was taken by someone else in the meantime: try again
+  }
+}
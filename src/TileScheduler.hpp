@@ -0,0 +1,132 @@
+#ifndef TILESCHEDULER_HPP
+#define TILESCHEDULER_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TileScheduler.hpp
+ * @brief This declares the `TileScheduler` class
+ */
+
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+#include "config.hpp"           // for CTB_DLL
+#include "types.hpp"
+#include "GridIterator.hpp"
+
+namespace ctb {
+  struct TileRange;
+  class TileScheduler;
+}
+
+/// A half open range of linear tile indices as used by `GridIterator::seek`
+struct ctb::TileRange {
+  /// Create an empty range
+  TileRange():
+    start(0),
+    end(0)
+  {}
+
+  /// Create a range from the first index and one past the last index
+  TileRange(i_tile start, i_tile end):
+    start(start),
+    end(end)
+  {}
+
+  /// Get the number of tiles in the range
+  inline i_tile
+  size() const {
+    return (end > start) ? end - start : 0;
+  }
+
+  i_tile start;                 ///< The first index in the range
+  i_tile end;                   ///< One past the last index in the range
+};
+
+/**
+ * @brief Share the tiles of a `GridIterator` between worker threads
+ *
+ * The tile indices of an iterator are split into chunks which are distributed
+ * between per worker deques.  Each zoom level is divided separately and every
+ * worker is given a contiguous run of chunks from each level: as tiles are
+ * indexed column by column this means that a worker processes adjacent strips
+ * of tiles, repeatedly reading the same blocks of the source dataset.
+ *
+ * A worker takes chunks from the front of its own deque.  When its deque is
+ * empty it steals a chunk from the back of another worker's deque (the chunk
+ * that worker would reach last) or, failing that, the upper half of the chunk
+ * that worker is currently processing.  Cheap tiles (e.g. those over the ocean)
+ * and expensive tiles (e.g. steep reprojected areas) are therefore balanced
+ * between workers without a single point of contention.
+ *
+ * e.g.
+ *
+ * \code
+ *    TileScheduler scheduler(iter, threadCount);
+ *    // in each worker thread
+ *    i_tile index;
+ *    while (scheduler.next(worker, index)) {
+ *      iter.seek(index);
+ *      // do stuff with the tile
+ *    }
+ * \endcode
+ */
+class CTB_DLL ctb::TileScheduler {
+public:
+
+  /**
+   * @brief Instantiate a scheduler over all tiles in an iterator
+   *
+   * If `chunkSize` is `0` a chunk size is chosen for each zoom level such that
+   * every worker receives a number of chunks from the level.
+   */
+  TileScheduler(const GridIterator &iter, unsigned int workerCount, i_tile chunkSize = 0);
+
+  /// Get the next tile index for a worker, returning `false` when all are taken
+  bool
+  next(unsigned int worker, i_tile &index);
+
+  /// Get the number of workers sharing the tiles
+  inline unsigned int
+  workerCount() const {
+    return mWorkers.size();
+  }
+
+  /// The number of chunks each worker is initially given from a zoom level
+  static const unsigned int CHUNKS_PER_WORKER = 16;
+
+protected:
+
+  /// The tiles belonging to an individual worker
+  struct Worker {
+    std::mutex mutex;             ///< Guards access by the owner and thieves
+    TileRange current;            ///< The chunk currently being processed
+    std::deque<TileRange> chunks; ///< Chunks waiting to be processed
+  };
+
+  /// Take work from another worker, returning `false` if there is none left
+  bool
+  steal(unsigned int thief, TileRange &range);
+
+  /// The workers sharing the tiles
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+};
+
+#endif /* TILESCHEDULER_HPP */
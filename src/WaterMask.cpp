@@ -0,0 +1,431 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file WaterMask.cpp
+ * @brief This defines the `WaterMask` class
+ */
+
+#include <string.h>             // for memset, strlen
+#include <algorithm>            // for std::sort, std::unique, std::min, std::max
+#include <atomic>
+#include <cmath>
+
+#include "gdal_alg.h"           // for GDALRasterizeGeometries
+#include "ogrsf_frmts.h"
+
+#include "CTBException.hpp"
+#include "WaterMask.hpp"
+
+using namespace ctb;
+
+/// The number of cells in a water mask
+static const unsigned int MASK_CELL_COUNT = MASK_SIZE * MASK_SIZE;
+
+/// The mask value of a land cell
+static const unsigned char LAND = 0;
+
+/// The mask value of a water cell
+static const unsigned char WATER = 255;
+
+/// The identifier of the next `WaterMask` instance
+static std::atomic<unsigned int> nextId(1);
+
+namespace {
+  /// The GDAL datasets a thread uses to create the masks of a `WaterMask`
+  struct ThreadDatasets {
+    unsigned int owner = 0;       ///< The `WaterMask` the datasets belong to
+    GDALDatasetH hLandDS = NULL;  ///< The thread's handle on the land raster
+    GDALDatasetH hMaskDS = NULL;  ///< The in memory mask polygons are rasterized into
+
+    ~ThreadDatasets() {
+      close();
+    }
+
+    void
+    close() {
+      if (hLandDS != NULL)
+        GDALClose(hLandDS);
+      if (hMaskDS != NULL)
+        GDALClose(hMaskDS);
+
+      hLandDS = hMaskDS = NULL;
+    }
+  };
+}
+
+/// Get the datasets of the calling thread, closing those of another instance
+static ThreadDatasets &
+threadDatasets(unsigned int owner) {
+  static thread_local ThreadDatasets datasets;
+
+  if (datasets.owner != owner) {
+    datasets.close();
+    datasets.owner = owner;
+  }
+
+  return datasets;
+}
+
+/**
+ * @details The dataset is opened as either a raster or a vector.  A raster
+ * uses its first band; a vector uses the polygons and multipolygons of its
+ * first layer, which are read and indexed before the constructor returns.
+ */
+WaterMask::WaterMask(const char *fileName, const Grid &grid):
+  mFileName(fileName),
+  mGrid(grid),
+  mId(nextId++),
+  mIsRaster(false),
+  mCellWidth(0),
+  mCellHeight(0),
+  mColumns(0),
+  mRows(0),
+  mHasNoData(false),
+  mNoDataValue(0)
+{
+  GDALDataset *poDataset = (GDALDataset *) GDALOpenEx(fileName, GDAL_OF_RASTER | GDAL_OF_VECTOR | GDAL_OF_READONLY,
+                                                      NULL, NULL, NULL);
+  if (poDataset == NULL) {
+    throw CTBException("Could not open the water mask dataset");
+  }
+
+  try {
+    if (poDataset->GetRasterCount() > 0) {
+      mIsRaster = true;
+      checkRaster(poDataset);
+    } else if (poDataset->GetLayerCount() > 0) {
+      loadPolygons(poDataset);
+    } else {
+      throw CTBException("The water mask dataset contains neither a raster nor a vector layer");
+    }
+  } catch (CTBException &) {
+    GDALClose(poDataset);
+    for (OGRGeometry *poPolygon : mPolygons)
+      OGRGeometryFactory::destroyGeometry(poPolygon);
+    throw;
+  }
+
+  GDALClose(poDataset);
+}
+
+WaterMask::~WaterMask() {
+  for (OGRGeometry *poPolygon : mPolygons) {
+    OGRGeometryFactory::destroyGeometry(poPolygon);
+  }
+}
+
+/**
+ * @details The mask of an all land or all water tile collapses to a single
+ * value (see `Terrain::setWaterMask`).
+ */
+void
+WaterMask::apply(TerrainTile &tile) const {
+  static thread_local unsigned char mask[MASK_CELL_COUNT];
+
+  createMask(tile, mask);
+  tile.setWaterMask(mask);
+}
+
+/**
+ * @details The mask has `MASK_SIZE` by `MASK_SIZE` cells covering the tile
+ * without any overlap, in rows from north to south.
+ */
+void
+WaterMask::createMask(const TileCoordinate &coord, unsigned char *mask) const {
+  const CRSBounds bounds = mGrid.tileBounds(coord);
+
+  if (mIsRaster) {
+    sampleMask(bounds, mask);
+  } else {
+    rasterizeMask(bounds, mask);
+  }
+}
+
+/**
+ * @details Polygons in another SRS are transformed to the grid SRS, and those
+ * which can't be transformed or lie outside the grid extent are dropped.  The
+ * index has roughly one cell per polygon, up to 1024 by 1024 cells, with each
+ * polygon being listed in every cell its envelope intersects.
+ */
+void
+WaterMask::loadPolygons(GDALDataset *poDataset) {
+  OGRLayer *poLayer = poDataset->GetLayer(0);
+  OGRSpatialReference gridSRS = mGrid.getSRS();
+  OGRCoordinateTransformation *transformer = NULL;
+
+  const OGRSpatialReference *layerSRS = poLayer->GetSpatialRef();
+  if (layerSRS != NULL && !layerSRS->IsSame(&gridSRS)) {
+    OGRSpatialReference srcSRS = *layerSRS;
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,0,0)
+    // Keep coordinates in easting, northing order like the grid
+    srcSRS.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+    gridSRS.SetAxisMappingStrategy(OAMS_TRADITIONAL_GIS_ORDER);
+#endif
+
+    transformer = OGRCreateCoordinateTransformation(&srcSRS, &gridSRS);
+    if (transformer == NULL) {
+      throw CTBException("The water mask to tile grid coordinate transformation could not be created");
+    }
+  }
+
+  const CRSBounds &extent = mGrid.getExtent();
+  OGRFeature *poFeature;
+
+  poLayer->ResetReading();
+  while ((poFeature = poLayer->GetNextFeature()) != NULL) {
+    OGRGeometry *poGeometry = poFeature->StealGeometry();
+    OGRFeature::DestroyFeature(poFeature);
+
+    if (poGeometry == NULL)
+      continue;
+
+    const OGRwkbGeometryType type = wkbFlatten(poGeometry->getGeometryType());
+    OGREnvelope envelope;
+
+    bool keep = (type == wkbPolygon || type == wkbMultiPolygon) && !poGeometry->IsEmpty()
+      && (transformer == NULL || poGeometry->transform(transformer) == OGRERR_NONE);
+
+    if (keep) {
+      poGeometry->getEnvelope(&envelope);
+      keep = envelope.MaxX > extent.getMinX() && envelope.MinX < extent.getMaxX()
+        && envelope.MaxY > extent.getMinY() && envelope.MinY < extent.getMaxY();
+    }
+
+    if (!keep) {
+      OGRGeometryFactory::destroyGeometry(poGeometry);
+      continue;
+    }
+
+    mPolygons.push_back(poGeometry);
+    mEnvelopes.push_back(envelope);
+    mIndexExtent.Merge(envelope);
+  }
+
+  delete transformer;
+
+  if (mPolygons.empty())
+    return;                     // everything is water
+
+  // Index the polygons on a grid of their envelopes
+  const unsigned int side = (unsigned int) std::min(1024.0, std::max(1.0, std::sqrt((double) mPolygons.size())));
+  mColumns = mRows = side;
+  mCellWidth = std::max((mIndexExtent.MaxX - mIndexExtent.MinX) / side, 1e-9);
+  mCellHeight = std::max((mIndexExtent.MaxY - mIndexExtent.MinY) / side, 1e-9);
+  mCells.assign(mColumns * mRows, std::vector<unsigned int>());
+
+  for (unsigned int i = 0; i < mEnvelopes.size(); ++i) {
+    unsigned int minColumn, minRow, maxColumn, maxRow;
+    indexCells(mEnvelopes[i], minColumn, minRow, maxColumn, maxRow);
+
+    for (unsigned int row = minRow; row <= maxRow; ++row) {
+      for (unsigned int column = minColumn; column <= maxColumn; ++column) {
+        mCells[(row * mColumns) + column].push_back(i);
+      }
+    }
+  }
+}
+
+void
+WaterMask::checkRaster(GDALDataset *poDataset) {
+  if (poDataset->GetGeoTransform(mRasterTransform) != CE_None) {
+    throw CTBException("Could not get transformation information from the water mask dataset");
+  } else if (mRasterTransform[2] != 0 || mRasterTransform[4] != 0) {
+    throw CTBException("The water mask raster must be north up");
+  }
+
+  const char *srcWKT = poDataset->GetProjectionRef();
+  if (strlen(srcWKT)) {
+    OGRSpatialReference srcSRS = OGRSpatialReference(srcWKT);
+    OGRSpatialReference gridSRS = mGrid.getSRS();
+
+    if (!srcSRS.IsSame(&gridSRS)) {
+      throw CTBException("The water mask raster must be in the spatial reference system of the tiles");
+    }
+  }
+
+  int hasNoData = FALSE;
+  mNoDataValue = poDataset->GetRasterBand(1)->GetNoDataValue(&hasNoData);
+  mHasNoData = hasNoData;
+}
+
+/**
+ * @details The candidate polygons are gathered from the index cells covering
+ * the tile, and those whose envelopes intersect the tile are burnt as land
+ * into a mask dataset belonging to the calling thread.
+ */
+void
+WaterMask::rasterizeMask(const CRSBounds &bounds, unsigned char *mask) const {
+  static thread_local std::vector<unsigned int> candidates;
+  static thread_local std::vector<OGRGeometryH> geometries;
+  static thread_local std::vector<double> burnValues;
+
+  OGREnvelope tile;
+  tile.MinX = bounds.getMinX();
+  tile.MinY = bounds.getMinY();
+  tile.MaxX = bounds.getMaxX();
+  tile.MaxY = bounds.getMaxY();
+
+  candidates.clear();
+  geometries.clear();
+
+  if (!mPolygons.empty() && tile.Intersects(mIndexExtent)) {
+    unsigned int minColumn, minRow, maxColumn, maxRow;
+    indexCells(tile, minColumn, minRow, maxColumn, maxRow);
+
+    for (unsigned int row = minRow; row <= maxRow; ++row) {
+      for (unsigned int column = minColumn; column <= maxColumn; ++column) {
+        const std::vector<unsigned int> &cell = mCells[(row * mColumns) + column];
+        candidates.insert(candidates.end(), cell.begin(), cell.end());
+      }
+    }
+
+    // Polygons spanning several cells are only rasterized once
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+    for (unsigned int i : candidates) {
+      if (mEnvelopes[i].Intersects(tile))
+        geometries.push_back((OGRGeometryH) mPolygons[i]);
+    }
+  }
+
+  memset(mask, WATER, MASK_CELL_COUNT);
+  if (geometries.empty())
+    return;                     // no land touches the tile
+
+  ThreadDatasets &datasets = threadDatasets(mId);
+  if (datasets.hMaskDS == NULL) {
+    datasets.hMaskDS = GDALCreate(GDALGetDriverByName("MEM"), "", MASK_SIZE, MASK_SIZE, 1, GDT_Byte, NULL);
+    if (datasets.hMaskDS == NULL) {
+      throw CTBException("Could not create the water mask raster");
+    }
+  }
+
+  double adfGeoTransform[6] = {
+    bounds.getMinX(), bounds.getWidth() / MASK_SIZE, 0,
+    bounds.getMaxY(), 0, -bounds.getHeight() / MASK_SIZE
+  };
+  GDALSetGeoTransform(datasets.hMaskDS, adfGeoTransform);
+
+  GDALRasterBandH hBand = GDALGetRasterBand(datasets.hMaskDS, 1);
+  GDALFillRaster(hBand, WATER, 0);
+
+  int bandList[1] = { 1 };
+  burnValues.assign(geometries.size(), LAND);
+
+  if (GDALRasterizeGeometries(datasets.hMaskDS, 1, bandList, (int) geometries.size(), geometries.data(),
+                              NULL, NULL, burnValues.data(), NULL, NULL, NULL) != CE_None) {
+    throw CTBException("Could not rasterize the water mask");
+  }
+
+  if (GDALRasterIO(hBand, GF_Read, 0, 0, MASK_SIZE, MASK_SIZE,
+                   mask, MASK_SIZE, MASK_SIZE, GDT_Byte, 0, 0) != CE_None) {
+    throw CTBException("Could not read the water mask raster");
+  }
+}
+
+/**
+ * @details The raster window containing the cell centres is read in one
+ * operation, decimated by GDAL if it has more pixels than the mask.  Pixels
+ * that are zero, nodata or outside the raster are water.
+ */
+void
+WaterMask::sampleMask(const CRSBounds &bounds, unsigned char *mask) const {
+  static thread_local std::vector<float> pixels;
+
+  ThreadDatasets &datasets = threadDatasets(mId);
+  if (datasets.hLandDS == NULL) {
+    datasets.hLandDS = GDALOpen(mFileName.c_str(), GA_ReadOnly);
+    if (datasets.hLandDS == NULL) {
+      throw CTBException("Could not open the water mask dataset");
+    }
+  }
+
+  memset(mask, WATER, MASK_CELL_COUNT);
+
+  const double *gt = mRasterTransform;
+  const double cellWidth = bounds.getWidth() / MASK_SIZE,
+    cellHeight = bounds.getHeight() / MASK_SIZE;
+  const double rasterX = GDALGetRasterXSize(datasets.hLandDS),
+    rasterY = GDALGetRasterYSize(datasets.hLandDS);
+
+  // The raster pixel coordinates of the cell centres, by column and by row
+  double columns[MASK_SIZE], rows[MASK_SIZE];
+  for (unsigned int i = 0; i < MASK_SIZE; ++i) {
+    columns[i] = std::floor((bounds.getMinX() + ((i + 0.5) * cellWidth) - gt[0]) / gt[1]);
+    rows[i] = std::floor((bounds.getMaxY() - ((i + 0.5) * cellHeight) - gt[3]) / gt[5]);
+  }
+
+  // The window of pixels containing the cell centres
+  const double minX = std::max(0.0, std::min(columns[0], columns[MASK_SIZE - 1])),
+    maxX = std::min(rasterX - 1, std::max(columns[0], columns[MASK_SIZE - 1])),
+    minY = std::max(0.0, std::min(rows[0], rows[MASK_SIZE - 1])),
+    maxY = std::min(rasterY - 1, std::max(rows[0], rows[MASK_SIZE - 1]));
+
+  if (minX > maxX || minY > maxY)
+    return;                     // the tile is outside the raster
+
+  const int windowX = (int) minX, windowY = (int) minY,
+    windowWidth = (int) (maxX - minX) + 1, windowHeight = (int) (maxY - minY) + 1,
+    bufferWidth = std::min<int>(windowWidth, MASK_SIZE),
+    bufferHeight = std::min<int>(windowHeight, MASK_SIZE);
+
+  pixels.resize(bufferWidth * bufferHeight);
+  if (GDALRasterIO(GDALGetRasterBand(datasets.hLandDS, 1), GF_Read,
+                   windowX, windowY, windowWidth, windowHeight,
+                   pixels.data(), bufferWidth, bufferHeight, GDT_Float32, 0, 0) != CE_None) {
+    throw CTBException("Could not read the water mask raster");
+  }
+
+  const float noData = (float) mNoDataValue;
+
+  for (unsigned int row = 0; row < MASK_SIZE; ++row) {
+    if (rows[row] < minY || rows[row] > maxY)
+      continue;
+
+    const int bufferRow = (int) (((rows[row] - minY) * bufferHeight) / windowHeight);
+    const float *pixelRow = pixels.data() + (bufferRow * bufferWidth);
+    unsigned char *maskRow = mask + (row * MASK_SIZE);
+
+    for (unsigned int column = 0; column < MASK_SIZE; ++column) {
+      if (columns[column] < minX || columns[column] > maxX)
+        continue;
+
+      const float value = pixelRow[(int) (((columns[column] - minX) * bufferWidth) / windowWidth)];
+      if (value != 0 && !std::isnan(value) && !(mHasNoData && value == noData))
+        maskRow[column] = LAND;
+    }
+  }
+}
+
+/**
+ * @details The envelope must intersect the extent of the index; cells beyond
+ * the extent are clamped to its edges.
+ */
+void
+WaterMask::indexCells(const OGREnvelope &envelope, unsigned int &minColumn, unsigned int &minRow,
+                      unsigned int &maxColumn, unsigned int &maxRow) const {
+  const auto cell = [](double offset, double size, unsigned int count) {
+    const double index = std::floor(offset / size);
+    return (unsigned int) std::max(0.0, std::min<double>(count - 1, index));
+  };
+
+  minColumn = cell(envelope.MinX - mIndexExtent.MinX, mCellWidth, mColumns);
+  maxColumn = cell(envelope.MaxX - mIndexExtent.MinX, mCellWidth, mColumns);
+  minRow = cell(envelope.MinY - mIndexExtent.MinY, mCellHeight, mRows);
+  maxRow = cell(envelope.MaxY - mIndexExtent.MinY, mCellHeight, mRows);
+}
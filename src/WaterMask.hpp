@@ -0,0 +1,151 @@
+#ifndef WATERMASK_HPP
+#define WATERMASK_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file WaterMask.hpp
+ * @brief This declares the `WaterMask` class
+ */
+
+#include <string>
+#include <vector>
+
+#include "ogr_geometry.h"
+
+#include "config.hpp"
+#include "Grid.hpp"
+#include "TerrainTile.hpp"
+
+namespace ctb {
+  class WaterMask;
+}
+
+/**
+ * @brief Set the water masks of terrain tiles from a land dataset
+ *
+ * The land is either described by the polygons of an OGR vector layer, such
+ * as coastline derived land polygons, or by a GDAL raster in which non zero
+ * pixels are land.  Everything outside the land is water.
+ *
+ * Vector polygons are read into memory once, transformed to the grid SRS and
+ * indexed on a regular grid of their envelopes.  The mask of a tile is created
+ * by rasterizing only the polygons whose envelopes intersect the tile, and
+ * tiles intersecting no polygons are all water without being rasterized.
+ * Large polygons should be split (as in the split land polygons derived from
+ * OpenStreetMap) so that few vertices are rasterized for each tile.
+ *
+ * A raster must be north up and in the grid SRS.  It is sampled at the centre
+ * of each mask cell.
+ *
+ * The polygons and their index are not modified after they are loaded, and
+ * each thread rasterizes into, or reads from, its own GDAL datasets, so
+ * `WaterMask::apply` can be called by any number of threads at once without
+ * locking.
+ */
+class CTB_DLL ctb::WaterMask {
+public:
+
+  /// Load the land of a vector or raster dataset for tiles of a grid
+  WaterMask(const char *fileName, const Grid &grid);
+
+  /// Release the land polygons
+  ~WaterMask();
+
+  WaterMask(const WaterMask &) = delete;
+  WaterMask &operator=(const WaterMask &) = delete;
+
+  /// Set the water mask of a tile
+  void
+  apply(TerrainTile &tile) const;
+
+  /// Create the water mask of a tile, 0 for land and 255 for water
+  void
+  createMask(const TileCoordinate &coord, unsigned char *mask) const;
+
+  /// Is the land described by a raster rather than by polygons?
+  inline bool
+  isRaster() const {
+    return mIsRaster;
+  }
+
+  /// Get the number of land polygons loaded
+  inline size_t
+  polygonCount() const {
+    return mPolygons.size();
+  }
+
+protected:
+
+  /// Read and index the polygons of a vector layer
+  void
+  loadPolygons(GDALDataset *poDataset);
+
+  /// Check that a raster can be sampled in the grid SRS
+  void
+  checkRaster(GDALDataset *poDataset);
+
+  /// Rasterize the polygons intersecting a tile into its mask
+  void
+  rasterizeMask(const CRSBounds &bounds, unsigned char *mask) const;
+
+  /// Sample the land raster at the cells of a tile mask
+  void
+  sampleMask(const CRSBounds &bounds, unsigned char *mask) const;
+
+  /// Get the index cells covering an envelope
+  void
+  indexCells(const OGREnvelope &envelope, unsigned int &minColumn, unsigned int &minRow,
+             unsigned int &maxColumn, unsigned int &maxRow) const;
+
+  /// The land dataset, reopened by each thread reading a raster
+  std::string mFileName;
+
+  /// The grid of the tiles
+  Grid mGrid;
+
+  /// Distinguishes the per thread datasets of each instance
+  unsigned int mId;
+
+  /// Is the land a raster?
+  bool mIsRaster;
+
+  /// The land polygons in the grid SRS
+  std::vector<OGRGeometry *> mPolygons;
+
+  /// The envelope of each land polygon
+  std::vector<OGREnvelope> mEnvelopes;
+
+  /// The extent and cell size of the polygon index
+  OGREnvelope mIndexExtent;
+  double mCellWidth, mCellHeight;
+  unsigned int mColumns, mRows;
+
+  /// The polygons whose envelopes intersect each index cell, by row
+  std::vector<std::vector<unsigned int>> mCells;
+
+  /// The geo transform of the land raster
+  double mRasterTransform[6];
+
+  /// Does the land raster have a nodata value?
+  bool mHasNoData;
+
+  /// The nodata value of the land raster, which is treated as water
+  double mNoDataValue;
+};
+
+#endif /* WATERMASK_HPP */
@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file WriteQueue.cpp
+ * @brief This defines the `WriteQueue` class
+ */
+
+#include <chrono>
+
+#include "CTBException.hpp"
+#include "WriteQueue.hpp"
+
+using namespace ctb;
+
+typedef std::chrono::steady_clock Clock;
+
+WriteQueue::WriteQueue(unsigned int threadCount, size_t capacity):
+  mCapacity((capacity > 0) ? capacity : 1),
+  mFinishing(false)
+{
+  if (threadCount < 1) {
+    throw CTBException("A write queue requires at least one thread");
+  }
+
+  mStatistics.jobCount = 0;
+  mStatistics.maxDepth = 0;
+  mStatistics.stallSeconds = 0;
+  mStatistics.idleSeconds = 0;
+
+  for (unsigned int i = 0; i < threadCount; ++i) {
+    mThreads.push_back(std::thread(&WriteQueue::run, this));
+  }
+}
+
+/**
+ * @details Any errors are ignored: call `WriteQueue::finish` first in order
+ * to handle them.
+ */
+WriteQueue::~WriteQueue() {
+  try {
+    finish();
+  } catch (CTBException &e) {}
+}
+
+/**
+ * @details This is thread safe.  The time spent blocked waiting for space in
+ * the queue is recorded as stall time.
+ */
+void
+WriteQueue::push(Job job) {
+  std::unique_lock<std::mutex> lock(mMutex);
+
+  if (mJobs.size() >= mCapacity && mError.empty() && !mFinishing) {
+    const Clock::time_point start = Clock::now();
+    mSpaceAvailable.wait(lock, [this]{
+        return mJobs.size() < mCapacity || !mError.empty() || mFinishing;
+      });
+    mStatistics.stallSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+  }
+
+  if (!mError.empty()) {
+    throw CTBException(mError.c_str());
+  } else if (mFinishing) {
+    throw CTBException("The write queue has finished");
+  }
+
+  mJobs.push_back(std::move(job));
+  if (mJobs.size() > mStatistics.maxDepth)
+    mStatistics.maxDepth = mJobs.size();
+
+  lock.unlock();
+  mJobAvailable.notify_one();
+}
+
+/**
+ * @details Calling this more than once has no effect other than rethrowing
+ * any error.
+ */
+void
+WriteQueue::finish() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFinishing = true;
+  }
+
+  mJobAvailable.notify_all();
+  mSpaceAvailable.notify_all();
+
+  for (auto &thread : mThreads) {
+    if (thread.joinable())
+      thread.join();
+  }
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (!mError.empty()) {
+    throw CTBException(mError.c_str());
+  }
+}
+
+WriteQueue::Statistics
+WriteQueue::statistics() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStatistics;
+}
+
+/**
+ * @details This is the body of each I/O thread.  The remaining jobs are
+ * performed once the queue is finishing, unless a job has failed.
+ */
+void
+WriteQueue::run() {
+  std::unique_lock<std::mutex> lock(mMutex);
+
+  while (true) {
+    if (mJobs.empty() && !mFinishing && mError.empty()) {
+      const Clock::time_point start = Clock::now();
+      mJobAvailable.wait(lock, [this]{
+          return !mJobs.empty() || mFinishing || !mError.empty();
+        });
+      mStatistics.idleSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    if (!mError.empty() || mJobs.empty())
+      return;                   // failed or finished
+
+    Job job = std::move(mJobs.front());
+    mJobs.pop_front();
+    lock.unlock();
+    mSpaceAvailable.notify_one();
+
+    std::string error;
+    try {
+      job();
+    } catch (CTBException &e) {
+      error = e.what();
+    }
+
+    lock.lock();
+    ++mStatistics.jobCount;
+
+    if (!error.empty() && mError.empty()) {
+      mError = error;
+      mJobs.clear();
+      mJobAvailable.notify_all();
+      mSpaceAvailable.notify_all();
+    }
+  }
+}
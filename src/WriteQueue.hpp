@@ -0,0 +1,139 @@
+#ifndef WRITEQUEUE_HPP
+#define WRITEQUEUE_HPP
+
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file WriteQueue.hpp
+ * @brief This declares the `WriteQueue` class
+ */
+
+#include <deque>
+#include <vector>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "config.hpp"
+
+namespace ctb {
+  class WriteQueue;
+}
+
+/**
+ * @brief Perform write operations using a dedicated pool of I/O threads
+ *
+ * This decouples the creation of tiles from writing them out: the threads
+ * creating tiles push a job persisting each tile on to the queue and carry on
+ * with the next tile, whilst the I/O threads perform the jobs.  The queue is
+ * bounded, so if the I/O threads fall behind the tile creating threads block
+ * until there is space, limiting the memory held by pending tiles.
+ *
+ * Statistics on the queue depth and the time spent waiting are kept so the
+ * balance between creating and writing tiles can be tuned.
+ *
+ * If a job throws a `CTBException` the queue stops performing jobs and the
+ * error is rethrown by the next call to `WriteQueue::push` or
+ * `WriteQueue::finish`.
+ */
+class CTB_DLL ctb::WriteQueue {
+public:
+
+  /// A write operation
+  typedef std::function<void()> Job;
+
+  /// Statistics describing the use of the queue
+  struct Statistics {
+    unsigned long int jobCount;   ///< The number of jobs performed
+    size_t maxDepth;              ///< The greatest number of jobs waiting
+    double stallSeconds;          ///< The time spent waiting for space in the queue
+    double idleSeconds;           ///< The time I/O threads spent waiting for jobs
+  };
+
+  /// Create the queue and start the I/O threads
+  WriteQueue(unsigned int threadCount, size_t capacity);
+
+  /// Wait for the jobs to finish and stop the I/O threads
+  ~WriteQueue();
+
+  /// Add a job to the queue, blocking while the queue is full
+  void
+  push(Job job);
+
+  /// Wait for all queued jobs to be performed and stop the I/O threads
+  void
+  finish();
+
+  /// Get the statistics for the queue so far
+  Statistics
+  statistics() const;
+
+  /// Get the number of I/O threads
+  inline unsigned int
+  threadCount() const {
+    return mThreads.size();
+  }
+
+  /// Get the maximum number of jobs that can wait in the queue
+  inline size_t
+  capacity() const {
+    return mCapacity;
+  }
+
+protected:
+
+  /// Perform jobs until the queue is finished
+  void
+  run();
+
+  /// The jobs waiting to be performed
+  std::deque<Job> mJobs;
+
+  /// The maximum number of waiting jobs
+  size_t mCapacity;
+
+  /// The I/O threads
+  std::vector<std::thread> mThreads;
+
+  /// Protects the queue and the statistics
+  mutable std::mutex mMutex;
+
+  /// Signals the I/O threads that there are jobs or the queue is finishing
+  std::condition_variable mJobAvailable;
+
+  /// Signals the producers that there is space in the queue
+  std::condition_variable mSpaceAvailable;
+
+  /// Has the queue been asked to finish?
+  bool mFinishing;
+
+  /// The error that stopped the queue, if any
+  std::string mError;
+
+  /// The statistics so far
+  Statistics mStatistics;
+
+private:
+
+  /// The queue owns threads so it can't be copied
+  WriteQueue(const WriteQueue &);
+  WriteQueue &operator=(const WriteQueue &);
+};
+
+#endif /* WRITEQUEUE_HPP */
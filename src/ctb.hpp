@@ -83,12 +83,18 @@
  * tilesets created by grids and tilers.  For instance, the
  * `ctb::TerrainIterator` class provides a simple interface for iterating over
  * all valid tiles represented by a `ctb::TerrainTiler`, and likewise the
- * `ctb::RasterIterator` over a `ctb::GDALTiler` instance.
+ * `ctb::RasterIterator` over a `ctb::GDALTiler` instance.  Iterators can be
+ * moved directly to any tile, allowing the `ctb::TileScheduler` class to share
+ * out the tiles of an iterator between multiple threads.  The
+ * `ctb::QuadtreeIterator` class visits tiles depth first, children before
+ * their parents, so that a pyramid can be built upwards from the most
+ * detailed zoom level.
  *
  * See the `README.md` file distributed with the source code for further
  * details.
  */
 
+#include "ctb/config.hpp"
 #include "ctb/Bounds.hpp"
 #include "ctb/Coordinate.hpp"
 #include "ctb/CTBException.hpp"
@@ -96,16 +102,31 @@
 #include "ctb/GDALTiler.hpp"
 #include "ctb/GlobalGeodetic.hpp"
 #include "ctb/GlobalMercator.hpp"
+#include "ctb/HeightConverter.hpp"
 #include "ctb/Grid.hpp"
 #include "ctb/GridIterator.hpp"
+#ifdef CTB_WITH_MBTILES
+#include "ctb/MBTilesWriter.hpp"
+#endif
+#include "ctb/QuadtreeIterator.hpp"
+#include "ctb/QuantizedMesh.hpp"
+#include "ctb/QuantizedMeshTiler.hpp"
 #include "ctb/RasterIterator.hpp"
 #include "ctb/RasterTiler.hpp"
+#include "ctb/TerrainArchive.hpp"
+#include "ctb/TerrainBatchReader.hpp"
 #include "ctb/TerrainIterator.hpp"
 #include "ctb/TerrainTile.hpp"
 #include "ctb/TerrainTiler.hpp"
+#include "ctb/TileAvailability.hpp"
 #include "ctb/TileCoordinate.hpp"
 #include "ctb/Tile.hpp"
+#include "ctb/TileJournal.hpp"
+#include "ctb/TilePool.hpp"
 #include "ctb/TilerIterator.hpp"
+#include "ctb/TileScheduler.hpp"
 #include "ctb/types.hpp"
+#include "ctb/WaterMask.hpp"
+#include "ctb/WriteQueue.hpp"
 
 #endif /* CTB_HPP */
@@ -23,6 +23,7 @@
  */
 
 #include <cstdint>              // uint16_t
+#include <utility>              // std::pair
 
 #include "Bounds.hpp"
 
@@ -41,6 +42,7 @@ namespace ctb {
   typedef Coordinate<double> CRSPoint; ///< A Coordinate Reference System coordinate
   typedef Bounds<double> CRSBounds;       ///< Extents in CRS coordinates
   typedef Coordinate<i_tile> TilePoint;   ///< The location of a tile
+  typedef std::pair<uint64_t, uint64_t> TerrainHash; ///< A 128 bit hash of terrain data
 
 }
 
@@ -0,0 +1,97 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file HeightConverterBenchmark.cpp
+ * @brief Benchmark the height conversions of every supported instruction set
+ *
+ * Heights are converted in blocks of one terrain tile, as the tilers convert
+ * them, and the throughput of each conversion is reported in millions of
+ * heights per second.  The number of heights and of repeats can be given as
+ * arguments.
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "config.hpp"
+#include "HeightConverter.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The number of heights in a terrain tile
+static const size_t TILE_CELLS = TILE_SIZE * TILE_SIZE;
+
+/// Time a conversion over the heights in blocks of one tile, in millions per second
+template <typename Function>
+static double
+throughput(Function convert, size_t count, unsigned int repeats) {
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  for (unsigned int repeat = 0; repeat < repeats; ++repeat) {
+    for (size_t i = 0; i < count; i += TILE_CELLS) {
+      convert(i, (count - i < TILE_CELLS) ? count - i : TILE_CELLS);
+    }
+  }
+
+  const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+  return (double) count * repeats / elapsed.count() / 1e6;
+}
+
+int
+main(int argc, char *argv[]) {
+  const size_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : TILE_CELLS * 4096;
+  const unsigned int repeats = (argc > 2) ? atoi(argv[2]) : 10;
+  const char *instructionSets[] = {"scalar", "sse2", "avx2"};
+
+  // Heights within and beyond the terrain range, with some missing data
+  mt19937 random(42);
+  uniform_real_distribution<float> inRange(-1100.0f, 12200.0f);
+  vector<float> meters(count), converted(count);
+  vector<i_terrain_height> heights(count);
+
+  for (size_t i = 0; i < count; ++i) {
+    meters[i] = (i % 97) ? inRange(random) : numeric_limits<float>::quiet_NaN();
+  }
+
+  cout << count << " heights, " << repeats << " repeats (millions of heights per second)" << endl;
+  cout << setw(10) << "kernel" << setw(18) << "toTerrainHeights" << setw(12) << "toMeters" << endl;
+
+  for (const char *instructionSet: instructionSets) {
+    if (!HeightConverter::setInstructionSet(instructionSet)) {
+      cout << setw(10) << instructionSet << "  not supported" << endl;
+      continue;
+    }
+
+    const double toHeights = throughput([&](size_t i, size_t n) {
+        HeightConverter::toTerrainHeights(meters.data() + i, heights.data() + i, n);
+      }, count, repeats);
+    const double toMeters = throughput([&](size_t i, size_t n) {
+        HeightConverter::toMeters(heights.data() + i, converted.data() + i, n);
+      }, count, repeats);
+
+    cout << setw(10) << instructionSet << fixed << setprecision(1)
+         << setw(18) << toHeights << setw(12) << toMeters << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,201 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file HeightConverterTest.cpp
+ * @brief Test the height conversions of every supported instruction set
+ *
+ * The vector conversions are compared with the scalar conversions over
+ * lengths which are not a multiple of the vector width, halfway values,
+ * values at and beyond the limits of a terrain height, and values which are
+ * not finite.  The scalar conversions are themselves checked against known
+ * results.  It exits with `0` on success or `1` otherwise.
+ */
+
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "HeightConverter.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The number of failed checks
+static unsigned int failures = 0;
+
+/// Report a terrain height which differs from the one expected
+static void
+checkHeight(const char *instructionSet, const char *what, size_t index, float meters,
+            i_terrain_height height, i_terrain_height expected) {
+  if (height != expected) {
+    cerr << instructionSet << ": " << what << " " << index << ": " << meters
+         << " meters gives " << height << " rather than " << expected << endl;
+    ++failures;
+  }
+}
+
+/// Check the scalar conversion of heights with known terrain heights
+static void
+checkKnownHeights() {
+  const float inf = numeric_limits<float>::infinity(),
+    nan = numeric_limits<float>::quiet_NaN(),
+    max = numeric_limits<float>::max();
+  const struct {
+    float meters;
+    i_terrain_height height;
+  } known[] = {
+    {0.0f, 5000},
+    {-1000.0f, 0},              // the lower limit
+    {-1000.1f, 0},
+    {-1e6f, 0},
+    {-max, 0},
+    {-inf, 0},
+    {12107.0f, 65535},          // the upper limit
+    {12107.1f, 65535},
+    {1e6f, 65535},
+    {max, 65535},
+    {inf, 65535},
+    {nan, HeightConverter::SEA_LEVEL},
+    {-nan, HeightConverter::SEA_LEVEL},
+    {-999.5f, 2},               // 2.5 rounds to even
+    {-998.5f, 8},               // 7.5 rounds to even
+    {0.5f, 5002},               // 5002.5 rounds to even
+    {1.5f, 5008},               // 5007.5 rounds to even
+    {12106.5f, 65532},          // 65532.5 rounds to even
+    {12107.5f, 65535},          // 65537.5 is clamped
+  };
+
+  for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); ++i) {
+    i_terrain_height height;
+
+    HeightConverter::toTerrainHeightsScalar(&known[i].meters, &height, 1);
+    checkHeight("scalar", "known height", i, known[i].meters, height, known[i].height);
+  }
+}
+
+/// Heights which are halfway between terrain heights, at the limits or beyond
+static vector<float>
+edgeHeights() {
+  const float inf = numeric_limits<float>::infinity(),
+    nan = numeric_limits<float>::quiet_NaN(),
+    max = numeric_limits<float>::max(),
+    min = numeric_limits<float>::denorm_min();
+  vector<float> heights = {
+    0.0f, -0.0f, min, -min, nan, -nan, inf, -inf, max, -max,
+    -1000.0f, -1000.1f, -1000.2f, -1000.3f, -1001.0f, -1e6f, -1e30f,
+    12107.0f, 12107.1f, 12107.2f, 12107.3f, 12108.0f, 1e6f, 1e30f,
+    -999.9f, 12106.9f, 32767.0f, 32768.0f, -32768.0f
+  };
+
+  // Meters that are a whole number and a half above -1000 meters convert to
+  // exact halfway values, which round to even
+  for (float meters = -1000.5f; meters < 12108.0f; meters += 1.0f) {
+    heights.push_back(meters);
+  }
+
+  return heights;
+}
+
+/// Compare the conversions of the current instruction set with the scalar ones
+static void
+checkInstructionSet(const vector<float> &edges) {
+  const char *instructionSet = HeightConverter::instructionSet();
+  mt19937 random(42);
+  uniform_real_distribution<float> inRange(-1100.0f, 12200.0f);
+  uniform_int_distribution<size_t> edge(0, edges.size() - 1);
+
+  // Every length up to several vector widths, and some longer ones, starting
+  // at an aligned and an unaligned address, with edge heights in each lane
+  vector<size_t> lengths;
+  for (size_t length = 0; length <= 67; ++length) {
+    lengths.push_back(length);
+  }
+  lengths.push_back(65 * 65);
+  lengths.push_back(edges.size());
+
+  for (size_t length: lengths) {
+    for (size_t start = 0; start < 2; ++start) {
+      vector<float> meters(length + start);
+      vector<i_terrain_height> heights(length + start, 0xDEAD), expected(length + start, 0xDEAD);
+
+      for (size_t i = 0; i < meters.size(); ++i) {
+        meters[i] = (i % 3) ? edges[edge(random)] : inRange(random);
+      }
+
+      HeightConverter::toTerrainHeights(meters.data() + start, heights.data() + start, length);
+      HeightConverter::toTerrainHeightsScalar(meters.data() + start, expected.data() + start, length);
+
+      for (size_t i = 0; i < meters.size(); ++i) {
+        checkHeight(instructionSet, "height", i, meters[i], heights[i], expected[i]);
+      }
+    }
+  }
+
+  // Every edge height in order, so that each is converted in every lane
+  for (size_t start = 0; start < 16; ++start) {
+    const size_t length = edges.size() - start;
+    vector<i_terrain_height> heights(length), expected(length);
+
+    HeightConverter::toTerrainHeights(edges.data() + start, heights.data(), length);
+    HeightConverter::toTerrainHeightsScalar(edges.data() + start, expected.data(), length);
+
+    for (size_t i = 0; i < length; ++i) {
+      checkHeight(instructionSet, "edge height", start + i, edges[start + i], heights[i], expected[i]);
+    }
+  }
+
+  // Every terrain height back to meters
+  vector<i_terrain_height> heights(65536 + 7);
+  vector<float> meters(heights.size()), expected(heights.size());
+
+  for (size_t i = 0; i < heights.size(); ++i) {
+    heights[i] = (i_terrain_height) i;
+  }
+
+  HeightConverter::toMeters(heights.data(), meters.data(), heights.size());
+  HeightConverter::toMetersScalar(heights.data(), expected.data(), heights.size());
+
+  for (size_t i = 0; i < heights.size(); ++i) {
+    if (meters[i] != expected[i]) {
+      cerr << instructionSet << ": terrain height " << heights[i] << " gives "
+           << meters[i] << " meters rather than " << expected[i] << endl;
+      ++failures;
+    }
+  }
+}
+
+int
+main() {
+  const vector<float> edges = edgeHeights();
+  const char *instructionSets[] = {"scalar", "sse2", "avx2"};
+
+  checkKnownHeights();
+
+  for (const char *instructionSet: instructionSets) {
+    if (!HeightConverter::setInstructionSet(instructionSet)) {
+      cout << instructionSet << ": not supported" << endl;
+      continue;
+    }
+
+    const unsigned int previousFailures = failures;
+    checkInstructionSet(edges);
+    cout << instructionSet << ": " << ((failures == previousFailures) ? "passed" : "FAILED") << endl;
+  }
+
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/*******************************************************************************
+ * Copyright 2014 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file QuantizedMeshBenchmark.cpp
+ * @brief Benchmark the creation of quantized mesh tiles
+ *
+ * A synthetic terrain of several octaves of ridges, with a corner without
+ * data, is created in memory and every tile of its maximum zoom level is
+ * meshed on a single thread.  The tiles and triangles per second are reported
+ * for a range of mesh error factors.  The size of the terrain in pixels can be
+ * given as an argument.
+ */
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include "gdal_priv.h"
+
+#include "config.hpp"
+#include "CTBException.hpp"
+#include "GlobalGeodetic.hpp"
+#include "QuantizedMeshTiler.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The nodata value of the synthetic terrain
+static const double NODATA = -9999;
+
+/// Create a synthetic terrain in degrees north east of the origin
+static GDALDataset *
+createTerrain(int size) {
+  GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+  if (poDriver == NULL) {
+    throw CTBException("Could not retrieve the GDAL MEM driver");
+  }
+
+  GDALDataset *poDataset = poDriver->Create("", size, size, 1, GDT_Float32, NULL);
+  if (poDataset == NULL) {
+    throw CTBException("Could not create the terrain dataset");
+  }
+
+  // A pixel of about 300 meters, as in global elevation models
+  const double resolution = 1.0 / 360;
+  double adfGeoTransform[6] = {0, resolution, 0, size * resolution, 0, -resolution};
+  poDataset->SetGeoTransform(adfGeoTransform);
+
+  char *pszWKT = NULL;
+  if (GlobalGeodetic().getSRS().exportToWkt(&pszWKT) != OGRERR_NONE
+      || poDataset->SetProjection(pszWKT) != CE_None) {
+    CPLFree(pszWKT);
+    GDALClose(poDataset);
+    throw CTBException("Could not set the terrain projection");
+  }
+  CPLFree(pszWKT);
+
+  GDALRasterBand *poBand = poDataset->GetRasterBand(1);
+  poBand->SetNoDataValue(NODATA);
+
+  vector<float> row(size);
+  for (int y = 0; y < size; y++) {
+    for (int x = 0; x < size; x++) {
+      double height = 0, amplitude = 2000, frequency = 2 * M_PI / size;
+
+      for (int octave = 0; octave < 6; octave++) {
+        height += amplitude * (1 - std::fabs(sin(frequency * x) * cos(frequency * y * 1.3)));
+        amplitude /= 2.2;
+        frequency *= 2.1;
+      }
+
+      row[x] = (x < size / 8 && y < size / 8) ? (float) NODATA : (float) (height - 1000);
+    }
+
+    if (poBand->RasterIO(GF_Write, 0, y, size, 1, row.data(), size, 1, GDT_Float32, 0, 0) != CE_None) {
+      GDALClose(poDataset);
+      throw CTBException("Could not write the terrain dataset");
+    }
+  }
+
+  return poDataset;
+}
+
+int
+main(int argc, char *argv[]) {
+  const int size = (argc > 1) ? atoi(argv[1]) : 2048;
+  const double errorFactors[] = {0.25, 1, 4};
+
+  GDALAllRegister();
+
+  GDALDataset *poDataset;
+  try {
+    poDataset = createTerrain(size);
+  } catch (CTBException &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  const GlobalGeodetic grid;
+  cout << setw(14) << "Error factor" << setw(8) << "Tiles" << setw(12) << "Tiles/s"
+       << setw(14) << "Triangles" << setw(16) << "Triangles/s" << endl;
+
+  try {
+    for (double errorFactor : errorFactors) {
+      TilerOptions options;
+      options.threadBudget = 1;
+      options.meshErrorFactor = errorFactor;
+
+      const QuantizedMeshTiler tiler(poDataset, grid, options);
+      const i_zoom zoom = tiler.maxZoomLevel();
+      const TileBounds bounds = tiler.tileBoundsForZoom(zoom);
+      QuantizedMeshTile mesh(TileCoordinate(zoom, bounds.getMinX(), bounds.getMinY()));
+      unsigned long long tiles = 0, triangles = 0;
+
+      const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+      for (i_tile y = bounds.getMinY(); y <= bounds.getMaxY(); y++) {
+        for (i_tile x = bounds.getMinX(); x <= bounds.getMaxX(); x++) {
+          tiler.createTile(TileCoordinate(zoom, x, y), mesh);
+          triangles += mesh.triangleCount();
+          tiles++;
+        }
+      }
+
+      const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      cout << setw(14) << errorFactor << setw(8) << tiles << fixed << setprecision(1)
+           << setw(12) << (tiles / elapsed.count()) << setw(14) << triangles
+           << setw(16) << (triangles / elapsed.count()) << endl;
+      cout.unsetf(ios::fixed);
+    }
+  } catch (CTBException &e) {
+    cerr << "Error: " << e.what() << endl;
+    GDALClose(poDataset);
+    return 1;
+  }
+
+  GDALClose(poDataset);
+  return 0;
+}
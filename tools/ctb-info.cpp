@@ -20,9 +20,14 @@
  *
  * This tool takes a terrain file and optionally extracts height, child tile
  * and water mask information. It exits with `0` on success or `1` otherwise.
+ *
+ * Alternatively it can benchmark the terrain compression methods over a set
+ * of terrain files.
  */
 
 #include <iostream>
+#include <iomanip>
+#include <chrono>
 
 #include "gdal_priv.h"
 #include "commander.hpp"
@@ -41,7 +46,8 @@ public:
     Command(name, version),
     mShowHeights(false),
     mShowChildren(true),
-    mShowType(true)
+    mShowType(true),
+    mBenchmark(false)
   {}
 
   void
@@ -53,6 +59,8 @@ public:
       cerr << "  Error: The terrain file must be specified" << endl;
       break;
     default:
+      if (mBenchmark)
+        return;                 // benchmark a set of files
       cerr << "  Error: Only one command line argument must be specified" << endl;
       break;
     }
@@ -75,24 +83,96 @@ public:
     static_cast<TerrainInfo *>(Command::self(command))->mShowType = false;
   }
 
+  static void
+  setBenchmark(command_t *command) {
+    static_cast<TerrainInfo *>(Command::self(command))->mBenchmark = true;
+  }
+
   const char *
   getInputFilename() const {
     return  (command->argc == 1) ? command->argv[0] : NULL;
   }
 
+  int
+  getInputCount() const {
+    return command->argc;
+  }
+
+  const char *
+  getInputFilename(int index) const {
+    return command->argv[index];
+  }
+
   bool mShowHeights;
   bool mShowChildren;
   bool mShowType;
+  bool mBenchmark;
 };
 
+/**
+ * Report the throughput and output size of each terrain compression method
+ *
+ * Each method encodes the whole set of terrain repeatedly for at least half a
+ * second.  The throughput is measured in megabytes of uncompressed terrain
+ * encoded per second.
+ */
+static void
+benchmarkCompression(const vector<Terrain> &corpus) {
+  const char *methods[] = {
+    "none",
+    "zlib:1", "zlib:6", "zlib:9",
+#ifdef CTB_WITH_LIBDEFLATE
+    "libdeflate:1", "libdeflate:6", "libdeflate:12",
+#endif
+  };
+  const int methodCount = sizeof(methods) / sizeof(methods[0]);
+  vector<unsigned char> buffer;
+
+  // The size of the uncompressed terrain
+  size_t terrainBytes = 0;
+  for (const Terrain &terrain : corpus) {
+    terrain.encode(buffer, TerrainCompression::parse("none"));
+    terrainBytes += buffer.size();
+  }
+
+  cout << "Benchmarking " << corpus.size() << " tiles (" << terrainBytes << " bytes uncompressed)" << endl
+       << setw(16) << left << "Method" << setw(12) << right << "MB/s"
+       << setw(14) << "Bytes" << setw(10) << "Ratio" << endl;
+
+  for (int i = 0; i < methodCount; ++i) {
+    const TerrainCompression compression = TerrainCompression::parse(methods[i]);
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    chrono::duration<double> elapsed;
+    size_t encodedBytes = 0;
+    int passes = 0;
+
+    do {
+      encodedBytes = 0;
+      for (const Terrain &terrain : corpus) {
+        terrain.encode(buffer, compression);
+        encodedBytes += buffer.size();
+      }
+
+      ++passes;
+      elapsed = chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 0.5);
+
+    cout << setw(16) << left << methods[i] << setw(12) << right << fixed << setprecision(1)
+         << ((terrainBytes * (double) passes) / (1024 * 1024) / elapsed.count())
+         << setw(14) << encodedBytes << setw(9) << setprecision(1)
+         << ((100.0 * encodedBytes) / terrainBytes) << "%" << endl;
+  }
+}
+
 int
 main(int argc, char *argv[]) {
   // Set up the command interface
   TerrainInfo command = TerrainInfo(argv[0], version.cstr);
-  command.setUsage("[options] TERRAIN_FILE");
+  command.setUsage("[options] TERRAIN_FILE...");
   command.option("-e", "--show-heights", "show the height information as an ASCII raster", TerrainInfo::showHeights);
   command.option("-c", "--no-child", "hide information about child tiles", TerrainInfo::hideChildInfo);
   command.option("-t", "--no-type", "hide information about the tile type (i.e. water/land)", TerrainInfo::hideType);
+  command.option("-b", "--benchmark", "benchmark the terrain compression methods, reporting their speed and output size. Any number of terrain files can be specified.", TerrainInfo::setBenchmark);
 
   // Parse and check the arguments
   command.parse(argc, argv);
@@ -100,6 +180,23 @@ main(int argc, char *argv[]) {
 
   GDALAllRegister();
 
+  // Benchmark compression over all the terrain files
+  if (command.mBenchmark) {
+    vector<Terrain> corpus;
+
+    try {
+      for (int i = 0; i < command.getInputCount(); ++i) {
+        corpus.push_back(Terrain(command.getInputFilename(i)));
+      }
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      return 1;
+    }
+
+    benchmarkCompression(corpus);
+    return 0;
+  }
+
   // Read the terrain data from the filesystem
   Terrain terrain;
   try {
@@ -111,9 +208,9 @@ main(int argc, char *argv[]) {
 
   // Print out the heights if required
   if (command.mShowHeights) {
-    const std::vector<ctb::i_terrain_height> & heights = terrain.getHeights();
+    const Terrain::Heights & heights = terrain.getHeights();
     cout << "Heights:";
-    for (std::vector<ctb::i_terrain_height>::const_iterator iter = heights.begin(); iter != heights.end(); ++iter) {
+    for (Terrain::Heights::const_iterator iter = heights.begin(); iter != heights.end(); ++iter) {
       if ((iter - heights.begin()) % TILE_SIZE == 0) cout << endl;
       cout << *iter << " ";
     }
@@ -22,8 +22,9 @@
  * terrain tiles which are written to an output directory on the filesystem.
  *
  * In the case of a multiband raster, only the first band is used to create the
- * terrain heights.  No water mask is currently set and all tiles are flagged
- * as being 'all land'.
+ * terrain heights.  All tiles are flagged as being 'all land' unless a land
+ * dataset is given with the `--water-mask` flag, from which the water mask of
+ * each tile is created.
  *
  * It is recommended that the input raster is in the EPSG 4326 spatial
  * reference system. If this is not the case then the tiles will be reprojected
@@ -31,25 +32,52 @@
  *
  * Using the `--output-format` flag this tool can also be used to create tiles
  * in other raster formats that are supported by GDAL.
+ *
+ * Using the `--container` flag terrain tiles can instead be written to a
+ * single MBTiles database or terrain archive in the output directory.
  */
 
 #include <iostream>
+#include <iomanip>              // for setw
 #include <sstream>
 #include <string.h>             // for strcmp
 #include <stdlib.h>             // for atoi
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <future>
+#include <chrono>
+#include <array>
+#include <memory>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <unistd.h>             // for link, symlink
+#endif
 
+#include "cpl_conv.h"           // for CPLGetBasename
 #include "cpl_multiproc.h"      // for CPLGetNumCPUs
 #include "cpl_vsi.h"            // for virtual filesystem
 #include "gdal_priv.h"
 #include "commander.hpp"        // for cli parsing
 #include "concat.hpp"
 
+#include "config.hpp"
 #include "GlobalMercator.hpp"
+#ifdef CTB_WITH_MBTILES
+#include "MBTilesWriter.hpp"
+#endif
+#include "QuadtreeIterator.hpp"
+#include "QuantizedMeshTiler.hpp"
 #include "RasterIterator.hpp"
+#include "TerrainArchive.hpp"
 #include "TerrainIterator.hpp"
+#include "TileAvailability.hpp"
+#include "TileJournal.hpp"
+#include "TilePool.hpp"
+#include "TileScheduler.hpp"
+#include "WaterMask.hpp"
+#include "WriteQueue.hpp"
 
 using namespace std;
 using namespace ctb;
@@ -68,12 +96,21 @@ public:
     outputDir("."),
     outputFormat("Terrain"),
     profile("geodetic"),
+    scheduler("stealing"),
+    linkDuplicates(NULL),
+    container("directory"),
+    waterMask(NULL),
     threadCount(-1),
+    ioThreadCount(0),
+    ioQueueSize(0),
     tileSize(0),
     startZoom(-1),
     endZoom(-1),
     verbosity(1),
-    resume(false)
+    resume(false),
+    downsample(false),
+    skipEmpty(false),
+    benchmark(false)
   {}
 
   void
@@ -107,11 +144,53 @@ public:
     static_cast<TerrainBuild *>(Command::self(command))->profile = command->arg;
   }
 
+  static void
+  setScheduler(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->scheduler = command->arg;
+  }
+
+  static void
+  setLinkDuplicates(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->linkDuplicates = command->arg;
+  }
+
+  static void
+  setContainer(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->container = command->arg;
+  }
+
+  static void
+  setWaterMask(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->waterMask = command->arg;
+  }
+
+  static void
+  setCompression(command_t *command) {
+    TerrainBuild *self = static_cast<TerrainBuild *>(Command::self(command));
+
+    try {
+      self->compression = TerrainCompression::parse(command->arg);
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << ": " << command->arg << endl;
+      self->help();             // exit
+    }
+  }
+
   static void
   setThreadCount(command_t *command) {
     static_cast<TerrainBuild *>(Command::self(command))->threadCount = atoi(command->arg);
   }
 
+  static void
+  setIOThreadCount(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->ioThreadCount = atoi(command->arg);
+  }
+
+  static void
+  setIOQueueSize(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->ioQueueSize = atoi(command->arg);
+  }
+
   static void
   setTileSize(command_t *command) {
     static_cast<TerrainBuild *>(Command::self(command))->tileSize = atoi(command->arg);
@@ -142,6 +221,28 @@ public:
     static_cast<TerrainBuild *>(Command::self(command))->resume = true;
   }
 
+  static void
+  setDownsample(command_t* command) {
+    static_cast<TerrainBuild *>(Command::self(command))->downsample = true;
+  }
+
+  static void
+  setSkipEmpty(command_t* command) {
+    TerrainBuild *self = static_cast<TerrainBuild *>(Command::self(command));
+    self->skipEmpty = true;
+    self->tilerOptions.dataCoverage = true;
+  }
+
+  static void
+  setBenchmark(command_t* command) {
+    static_cast<TerrainBuild *>(Command::self(command))->benchmark = true;
+  }
+
+  static void
+  setIntegerWarp(command_t* command) {
+    static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.terrainUnits = true;
+  }
+
   static void
   setResampleAlg(command_t *command) {
     GDALResampleAlg eResampleAlg;
@@ -188,6 +289,16 @@ public:
     static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.errorThreshold = atof(command->arg);
   }
 
+  static void
+  setMeshErrorFactor(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.meshErrorFactor = atof(command->arg);
+  }
+
+  static void
+  setMetatileSize(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.metatileSize = atoi(command->arg);
+  }
+
   static void
   setWarpMemory(command_t *command) {
     static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.warpMemoryLimit = atof(command->arg);
@@ -200,58 +311,59 @@ public:
 
   const char *outputDir,
     *outputFormat,
-    *profile;
+    *profile,
+    *scheduler,
+    *linkDuplicates,
+    *container,
+    *waterMask;
 
   int threadCount,
+    ioThreadCount,
+    ioQueueSize,
     tileSize,
     startZoom,
     endZoom,
     verbosity;
 
-  bool resume;
+  bool resume,
+    downsample,
+    skipEmpty,
+    benchmark;
 
   CPLStringList creationOptions;
   TilerOptions tilerOptions;
+  TerrainCompression compression;
 };
 
-/**
- * Create a filename for a tile coordinate
- *
- * This also creates the tile directory structure.
- */
-static string
-getTileFilename(const TileCoordinate *coord, const string dirname, const char *extension) {
-  static mutex mutex;
-  VSIStatBufL stat;
-  string filename = concat(dirname, coord->zoom, osDirSep, coord->x);
+#ifdef CTB_WITH_MBTILES
+/// The database terrain tiles are written to when using the MBTiles container
+static MBTilesWriter *mbtilesWriter = NULL;
+#endif
 
-  lock_guard<std::mutex> lock(mutex);
+/// The archive terrain tiles are written to when using the archive container
+static TerrainArchiveWriter *archiveWriter = NULL;
 
-  // Check whether the `{zoom}/{x}` directory exists or not
-  if (VSIStatExL(filename.c_str(), &stat, VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG)) {
-    filename = concat(dirname, coord->zoom);
+/// How terrain tiles are compressed
+static TerrainCompression compression;
 
-    // Check whether the `{zoom}` directory exists or not
-    if (VSIStatExL(filename.c_str(), &stat, VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG)) {
-      // Create the `{zoom}` directory
-      if (VSIMkdir(filename.c_str(), 0755))
-        throw CTBException("Could not create the zoom level directory");
+/// The queue tile files are written through when using dedicated I/O threads
+static WriteQueue *writeQueue = NULL;
 
-    } else if (!VSI_ISDIR(stat.st_mode)) {
-      throw CTBException("Zoom level file path is not a directory");
-    }
+/// The journal recording the tiles completed when using the directory container
+static TileJournal *tileJournal = NULL;
 
-    // Create the `{zoom}/{x}` directory
-    filename += concat(osDirSep, coord->x);
-    if (VSIMkdir(filename.c_str(), 0755))
-      throw CTBException("Could not create the x level directory");
+/// Are tiles being created for a benchmark, without writing them?
+static bool benchmarkOnly = false;
 
-  } else if (!VSI_ISDIR(stat.st_mode)) {
-    throw CTBException("X level file path is not a directory");
-  }
+/// The tiles available in the tileset, written to `layer.json` for terrain tile files
+static TileAvailability *tileAvailability = NULL;
 
-  // Create the filename itself, adding the extension if required
-  filename += concat(osDirSep, coord->y);
+/// Create a filename for a tile coordinate
+static string
+getTileFilename(const TileCoordinate *coord, const string dirname, const char *extension) {
+  string filename = concat(dirname, coord->zoom, osDirSep, coord->x, osDirSep, coord->y);
+
+  // Add the extension if required
   if (extension != NULL) {
     filename += ".";
     filename += extension;
@@ -261,43 +373,154 @@ getTileFilename(const TileCoordinate *coord, const string dirname, const char *e
 }
 
 /**
- * Increment a TilerIterator whilst cooperating between threads
+ * Create a directory if it doesn't already exist
  *
- * This function maintains an global index on an iterator and when called
- * ensures the iterator is incremented to point to the next global index.  This
- * can therefore be called with different tiler iterators by different threads
- * to ensure all tiles are iterated over consecutively.  It assumes individual
- * tile iterators point to the same source GDAL dataset.
+ * Another process or thread creating the directory first is not an error.
  */
-template<typename T> int
-incrementIterator(T &iter, int currentIndex) {
-  static int globalIteratorIndex = 0; // keep track of where we are globally
-  static mutex mutex;        // ensure iterations occur serially between threads
+static void
+makeDirectory(const string &dirname, const char *description) {
+  VSIStatBufL stat;
 
-  lock_guard<std::mutex> lock(mutex);
+  if (VSIMkdir(dirname.c_str(), 0755) != 0) {
+    if (VSIStatExL(dirname.c_str(), &stat, VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG)) {
+      throw CTBException(concat("Could not create the ", description, " directory").c_str());
+    } else if (!VSI_ISDIR(stat.st_mode)) {
+      throw CTBException(concat(description, " file path is not a directory").c_str());
+    }
+  }
+}
 
-  while (currentIndex < globalIteratorIndex) {
-    ++iter;
-    ++currentIndex;
+/**
+ * The `{zoom}/{x}` directories known to exist
+ *
+ * A flag is held for every column of tiles in every zoom level of the tileset.
+ * The table is sized before tiling starts and flags are only ever set, so
+ * checking whether the directory of a tile exists is a single atomic load
+ * without any locking or filesystem access.
+ */
+static struct TileDirectories {
+  vector<TileBounds> bounds;                   ///< The tile extent of each zoom level
+  vector<unique_ptr<atomic<bool>[]>> columns; ///< The flags for each zoom level
+
+  /// Get the flag for the directory of a tile, or `NULL` if there isn't one
+  atomic<bool> *
+  flag(const TileCoordinate &coord) {
+    if (coord.zoom >= columns.size() || !columns[coord.zoom]
+        || coord.x < bounds[coord.zoom].getMinX() || coord.x > bounds[coord.zoom].getMaxX())
+      return NULL;
+
+    return &columns[coord.zoom][coord.x - bounds[coord.zoom].getMinX()];
   }
-  ++globalIteratorIndex;
+} tileDirectories;
 
-  return currentIndex;
+/**
+ * Prepare the `{zoom}/{x}` directories for the tiles of a tileset
+ *
+ * If `create` is set the whole directory skeleton is created up front,
+ * otherwise directories are created as the first tile in each is written,
+ * which avoids empty directories when tiles are skipped.
+ */
+static void
+prepareTileDirectories(const GDALTiler &tiler, const string &dirname,
+                       i_zoom startZoom, i_zoom endZoom, bool create) {
+  tileDirectories.bounds.resize(startZoom + 1);
+  tileDirectories.columns.resize(startZoom + 1);
+
+  for (i_zoom zoom = endZoom; zoom <= startZoom; ++zoom) {
+    const TileBounds zoomBounds = tiler.tileBoundsForZoom(zoom);
+    const i_tile columnCount = zoomBounds.getMaxX() - zoomBounds.getMinX() + 1;
+
+    tileDirectories.bounds[zoom] = zoomBounds;
+    tileDirectories.columns[zoom].reset(new atomic<bool>[columnCount]);
+
+    for (i_tile i = 0; i < columnCount; ++i) {
+      tileDirectories.columns[zoom][i] = false;
+    }
+
+    if (create) {
+      const string zoomDirname = concat(dirname, zoom);
+      makeDirectory(zoomDirname, "zoom level");
+
+      for (i_tile i = 0; i < columnCount; ++i) {
+        makeDirectory(concat(zoomDirname, osDirSep, zoomBounds.getMinX() + i), "x level");
+        tileDirectories.columns[zoom][i] = true;
+      }
+    }
+  }
 }
 
-/// Get a handle on the total number of tiles to be created
-static int iteratorSize = 0;    // the total number of tiles
-template<typename T> void
-setIteratorSize(T &iter) {
-  static mutex mutex;
+/**
+ * Ensure the `{zoom}/{x}` directory structure containing a tile file exists
+ *
+ * Directories that have been prepared are only checked once, after which this
+ * requires neither a lock nor a `stat` call.
+ */
+static void
+createTileDirectory(const TileCoordinate &coord, const string &filename) {
+  atomic<bool> *exists = tileDirectories.flag(coord);
 
-  lock_guard<std::mutex> lock(mutex);
+  if (exists != NULL && exists->load(memory_order_acquire))
+    return;
+
+  const string xDirname = CPLGetPath(filename.c_str()),
+    zoomDirname = CPLGetPath(xDirname.c_str());
+
+  makeDirectory(zoomDirname, "zoom level");
+  makeDirectory(xDirname, "x level");
+
+  if (exists != NULL)
+    exists->store(true, memory_order_release);
+}
+
+/// The work stealing scheduler sharing tiles between threads, if used
+static TileScheduler *tileScheduler = NULL;
 
-  if (iteratorSize == 0) {
-    iteratorSize = iter.getSize();
+/// The global index used to share tiles between threads without a scheduler
+static atomic<i_tile> globalIteratorIndex(0);
+
+/**
+ * Increment a TilerIterator whilst cooperating between threads
+ *
+ * This moves the iterator directly to the next tile to be processed by a
+ * worker thread, returning the index of that tile.  This can therefore be
+ * called with different tiler iterators by different threads to ensure all
+ * tiles are iterated over exactly once.  It assumes individual tile iterators
+ * point to the same source GDAL dataset.
+ *
+ * Tiles are obtained from the `TileScheduler` if one is in use.  Otherwise
+ * the function maintains a global index on the iterators and atomically claims
+ * the next index when called.
+ */
+template<typename T> i_tile
+incrementIterator(T &iter, unsigned int worker) {
+  i_tile currentIndex;
+
+  if (tileScheduler == NULL) {
+    currentIndex = globalIteratorIndex++;
+  } else if (!tileScheduler->next(worker, currentIndex)) {
+    currentIndex = iter.getSize(); // no tiles remain
+  }
+
+  iter.seek(currentIndex);
+
+  return currentIndex;
+}
+
+/// Share out the tiles of an iterator between the threads
+static void
+scheduleTiles(const GridIterator &iter, const char *scheduler, int threadCount) {
+  delete tileScheduler;
+  tileScheduler = NULL;
+  globalIteratorIndex = 0;
+
+  if (strcmp(scheduler, "stealing") == 0) {
+    tileScheduler = new TileScheduler(iter, threadCount);
   }
 }
 
+static i_tile iteratorSize = 0;    // the total number of tiles
+static atomic<i_tile> tileCount(0); // the number of tiles processed so far
+
 /// A thread safe wrapper around `GDALTermProgress`
 static int
 CPL_STDCALL termProgress(double dfComplete, const char *pszMessage, void *pProgressArg) {
@@ -325,12 +548,12 @@ static GDALProgressFunc progressFunc = termProgress;
 
 /// Output the progress of the tiling operation
 int
-showProgress(int currentIndex, string filename) {
+showProgress(string filename, const char *action = "created") {
   stringstream stream;
-  stream << "created " << filename << " in thread " << this_thread::get_id();
+  stream << action << " " << filename << " in thread " << this_thread::get_id();
   string message = stream.str();
 
-  return progressFunc(currentIndex / (double) iteratorSize, message.c_str(), NULL);
+  return progressFunc(++tileCount / (double) iteratorSize, message.c_str(), NULL);
 }
 
 static bool
@@ -339,9 +562,123 @@ fileExists(const std::string& filename) {
   return VSIStatExL(filename.c_str(), &statbuf, VSI_STAT_EXISTS_FLAG) == 0;
 }
 
+/**
+ * Was a tile created by the tiling operation being resumed?
+ *
+ * This is looked up in the journal of the previous operation if there is one,
+ * otherwise the filesystem is checked and existing tiles are recorded in the
+ * new journal so the next resume doesn't need to check them again.
+ */
+static bool
+tileExists(const TerrainBuild *command, const TileCoordinate &coord, const string &filename) {
+  if (!command->resume)
+    return false;
+
+  if (tileJournal != NULL && tileJournal->loaded()) {
+    if (!tileJournal->isComplete(coord))
+      return false;
+  } else {
+    if (!fileExists(filename))
+      return false;
+
+    if (tileJournal != NULL)
+      tileJournal->complete(coord);
+  }
+
+  if (tileAvailability != NULL)
+    tileAvailability->add(coord);
+
+  return true;
+}
+
+/// Record a tile as being complete once it has been written
+static void
+recordTile(const TileCoordinate &coord) {
+  if (tileJournal != NULL)
+    tileJournal->complete(coord);
+
+  if (tileAvailability != NULL)
+    tileAvailability->add(coord);
+}
+
+/**
+ * Create a GDAL tile in memory and queue writing it to the filesystem
+ *
+ * The tile is created under `/vsimem` so the I/O threads only have to copy
+ * the bytes out: this includes any auxiliary files created by the driver
+ * alongside the tile (e.g. a world file), which are written to the same
+ * directory.
+ */
+static void
+queueGDALTile(GDALDriver *poDriver, GDALDataset *poSrcDS,
+              const TileCoordinate &coordinate, const string &filename,
+              CPLStringList &creationOptions) {
+  static atomic<unsigned long int> memoryId(0);
+  const string memDirname = concat("/vsimem/ctb-tile/", memoryId++);
+  const string memFilename = concat(memDirname, "/", CPLGetFilename(filename.c_str()));
+
+  GDALDataset *poDstDS = poDriver->CreateCopy(memFilename.c_str(), poSrcDS, FALSE,
+                                              creationOptions.List(), NULL, NULL );
+  if (poDstDS == NULL) {
+    throw CTBException("Could not create GDAL tile");
+  }
+
+  char **fileList = poDstDS->GetFileList();
+  GDALClose(poDstDS);
+
+  vector<string> memFiles;
+  for (char **file = fileList; file != NULL && *file != NULL; ++file) {
+    memFiles.push_back(*file);
+  }
+  CSLDestroy(fileList);
+
+  const TileCoordinate coord = coordinate;
+  writeQueue->push([memFiles, coord, filename]() {
+      const string dirname = CPLGetPath(filename.c_str());
+      string error;
+
+      createTileDirectory(coord, filename);
+
+      for (const string &memFile : memFiles) {
+        vsi_l_offset size = 0;
+        GByte *data = VSIGetMemFileBuffer(memFile.c_str(), &size, TRUE);
+        if (data == NULL) continue;
+
+        const string outFilename = CPLFormFilename(dirname.c_str(), CPLGetFilename(memFile.c_str()), NULL);
+        const string temp_filename = concat(outFilename, ".tmp");
+        FILE *fp = fopen(temp_filename.c_str(), "wb");
+
+        if (fp == NULL) {
+          error = "Failed to open file";
+        } else {
+          const bool written = fwrite(data, 1, (size_t) size, fp) == (size_t) size;
+          if (fclose(fp) != 0 || !written) {
+            error = "Failed to write GDAL tile";
+          } else if (VSIRename(temp_filename.c_str(), outFilename.c_str()) != 0) {
+            error = "Could not rename temporary file";
+          }
+        }
+
+        CPLFree(data);
+        if (error.size()) break;
+      }
+
+      // Release any memory files that weren't written
+      for (const string &memFile : memFiles) {
+        VSIUnlink(memFile.c_str());
+      }
+
+      if (error.size()) {
+        throw CTBException(error.c_str());
+      }
+
+      recordTile(coord);
+    });
+}
+
 /// Output GDAL tiles represented by a tiler to a directory
 static void
-buildGDAL(const RasterTiler &tiler, TerrainBuild *command) {
+buildGDAL(const RasterTiler &tiler, TerrainBuild *command, unsigned int worker) {
   GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName(command->outputFormat);
 
   if (poDriver == NULL) {
@@ -358,68 +695,589 @@ buildGDAL(const RasterTiler &tiler, TerrainBuild *command) {
     endZoom = (command->endZoom < 0) ? 0 : command->endZoom;
 
   RasterIterator iter(tiler, startZoom, endZoom);
-  int currentIndex = incrementIterator(iter, 0);
-  setIteratorSize(iter);
+  incrementIterator(iter, worker);
 
   while (!iter.exhausted()) {
     const TileCoordinate *coordinate = iter.GridIterator::operator*();
     GDALDataset *poDstDS;
     const string filename = getTileFilename(coordinate, dirname, extension);
 
-    
-    if( !command->resume || !fileExists(filename) ) {
+    if (!tileExists(command, *coordinate, filename)) {
       GDALTile *tile = *iter;
-      const string temp_filename = concat(filename, ".tmp");
-      poDstDS = poDriver->CreateCopy(temp_filename.c_str(), tile->dataset, FALSE,
-                                     command->creationOptions.List(), NULL, NULL );
-      delete tile;
-
-      // Close the datasets, flushing data to destination
-      if (poDstDS == NULL) {
-        throw CTBException("Could not create GDAL tile");
+
+      if (writeQueue != NULL) {
+        queueGDALTile(poDriver, tile->dataset, *coordinate, filename, command->creationOptions);
+        delete tile;
+      } else {
+        const string temp_filename = concat(filename, ".tmp");
+
+        createTileDirectory(*coordinate, filename);
+        poDstDS = poDriver->CreateCopy(temp_filename.c_str(), tile->dataset, FALSE,
+                                       command->creationOptions.List(), NULL, NULL );
+        delete tile;
+
+        // Close the datasets, flushing data to destination
+        if (poDstDS == NULL) {
+          throw CTBException("Could not create GDAL tile");
+        }
+
+        GDALClose(poDstDS);
+
+        if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
+          throw CTBException("Could not rename temporary file");
+        }
+
+        recordTile(*coordinate);
       }
+    }
+
+    incrementIterator(iter, worker);
+    showProgress(filename);
+  }
+}
+
+/// How duplicate terrain tiles are linked to the first identical tile, if at all
+static const char *linkDuplicates = NULL;
+
+/// The first terrain tile written with particular terrain data
+struct CanonicalTile {
+  TileCoordinate coord;         ///< The tile coordinate
+  string filename;              ///< The file the tile is written to
+  bool ready;                   ///< Is the file in place?
+};
+
+/// Hash a `TerrainHash` for an unordered container
+struct TerrainHashHasher {
+  size_t
+  operator()(const TerrainHash &hash) const {
+    return (size_t) (hash.first ^ hash.second);
+  }
+};
 
-      GDALClose(poDstDS);
+/// The number of independently locked parts of the canonical tile index
+static const unsigned int CANONICAL_SHARD_COUNT = 64;
 
-      if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
-        throw new CTBException("Could not rename temporary file");
+/// Part of the index of canonical tiles by the hash of their terrain data
+static struct CanonicalShard {
+  std::mutex mutex;
+  unordered_map<TerrainHash, CanonicalTile, TerrainHashHasher> tiles;
+} canonicalShards[CANONICAL_SHARD_COUNT];
+
+static atomic<i_tile> terrainCount(0); // the number of terrain tiles written
+static atomic<i_tile> linkCount(0);    // the number of those that are links
+
+/**
+ * Link a terrain tile to an identical tile that has already been written
+ *
+ * This returns `false` if the link could not be created, in which case the
+ * tile should be written as normal.
+ */
+static bool
+linkTerrainTile(const CanonicalTile &canonical, const string &filename) {
+#ifdef _WIN32
+  return false;                 // links aren't supported
+#else
+  if (strcmp(linkDuplicates, "hard") == 0) {
+    return link(canonical.filename.c_str(), filename.c_str()) == 0;
+  }
+
+  // Symbolic links are relative to the `{zoom}/{x}` directory so the tileset
+  // can be moved
+  const string target = concat("..", osDirSep, "..", osDirSep,
+                               canonical.coord.zoom, osDirSep,
+                               canonical.coord.x, osDirSep,
+                               canonical.coord.y, ".terrain");
+  return symlink(target.c_str(), filename.c_str()) == 0;
+#endif
+}
+
+/**
+ * Store encoded terrain data in a tile file via a temporary file
+ *
+ * If duplicate tiles are being linked then the tile is linked to the first
+ * tile written with the same terrain data.  The first tile is only linked to
+ * once it is in place, so a tile identical to one still being written by
+ * another thread is written in full.  Likewise if the link fails (e.g. the
+ * file system limit on hard links is reached) the tile is written in full
+ * and becomes the tile that subsequent duplicates link to.
+ */
+static void
+storeTerrainTile(const TileCoordinate &coord, const vector<unsigned char> &data,
+                 const TerrainHash &hash, const string &filename) {
+  const string temp_filename = concat(filename, ".tmp");
+  bool canonical = true, linked = false;
+
+  // The directory must exist for a link to it, as it isn't created up front
+  // when empty tiles are skipped
+  createTileDirectory(coord, filename);
+
+  if (linkDuplicates != NULL) {
+    CanonicalTile existing;
+    CanonicalShard &shard = canonicalShards[hash.first % CANONICAL_SHARD_COUNT];
+
+    {
+      lock_guard<std::mutex> lock(shard.mutex);
+      auto found = shard.tiles.find(hash);
+
+      if (found == shard.tiles.end()) {
+        CanonicalTile &entry = shard.tiles[hash];
+        entry.coord = coord;
+        entry.filename = filename;
+        entry.ready = false;
+      } else {
+        canonical = false;
+        if (found->second.ready)
+          existing = found->second;
       }
     }
 
-    currentIndex = incrementIterator(iter, currentIndex);
-    showProgress(currentIndex, filename);
+    if (!canonical && existing.filename.size()) {
+      linked = linkTerrainTile(existing, temp_filename);
+      canonical = !linked;    // replace the tile that couldn't be linked to
+    }
+  }
+
+  if (linked) {
+    ++linkCount;
+  } else {
+    FILE *fp = fopen(temp_filename.c_str(), "wb");
+
+    if (fp == NULL) {
+      throw CTBException("Failed to open file");
+    }
+
+    const bool written = fwrite(data.data(), 1, data.size(), fp) == data.size();
+
+    if (fclose(fp) != 0 || !written) {
+      throw CTBException("Failed to write terrain data");
+    }
+  }
+
+  if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
+    throw CTBException("Could not rename temporary file");
+  }
+
+  recordTile(coord);
+
+  // Duplicates can now be linked to this tile
+  if (linkDuplicates != NULL && canonical) {
+    CanonicalShard &shard = canonicalShards[hash.first % CANONICAL_SHARD_COUNT];
+    lock_guard<std::mutex> lock(shard.mutex);
+    CanonicalTile &entry = shard.tiles[hash];
+
+    entry.coord = coord;
+    entry.filename = filename;
+    entry.ready = true;
+  }
+}
+
+/**
+ * Write a terrain tile to its container or the filesystem
+ *
+ * When writing to the filesystem with an I/O queue the tile is encoded here
+ * and the file is written by an I/O thread, otherwise it is written directly.
+ * When benchmarking the tile is encoded but not written.
+ */
+static void
+writeTerrainTile(const TerrainTile &tile, const string &filename) {
+  ++terrainCount;
+
+  // Encode the tile as it would be written
+  if (benchmarkOnly) {
+    static thread_local vector<unsigned char> data;
+    tile.encode(data, compression);
+    return;
+  }
+
+#ifdef CTB_WITH_MBTILES
+  // Hand the tile over to the database writer thread
+  if (mbtilesWriter != NULL) {
+    vector<unsigned char> data;
+    tile.encode(data, compression);
+    mbtilesWriter->writeTile(tile, move(data));
+    recordTile(tile);
+    return;
+  }
+#endif
+
+  // Append the tile to the archive
+  if (archiveWriter != NULL) {
+    archiveWriter->writeTile(tile);
+    recordTile(tile);
+    return;
+  }
+
+  TerrainHash hash;
+  if (linkDuplicates != NULL) {
+    hash = tile.hash();
+  }
+
+  if (writeQueue != NULL) {
+    const TileCoordinate coord = tile;
+    shared_ptr<vector<unsigned char>> data = make_shared<vector<unsigned char>>();
+
+    tile.encode(*data, compression);
+    writeQueue->push([coord, data, hash, filename]() {
+        storeTerrainTile(coord, *data, hash, filename);
+      });
+  } else {
+    static thread_local vector<unsigned char> data;
+
+    tile.encode(data, compression);
+    storeTerrainTile(tile, data, hash, filename);
+  }
+}
+
+/// The number of triangles in the quantized mesh tiles created
+static atomic<unsigned long long> meshTriangleCount(0);
+
+/**
+ * Write a quantized mesh tile to its container or the filesystem
+ *
+ * This mirrors `writeTerrainTile`, except that mesh tiles can't be archived
+ * or linked.
+ */
+static void
+writeMeshTile(const QuantizedMeshTile &mesh, const string &filename) {
+  meshTriangleCount += mesh.triangleCount();
+
+  if (benchmarkOnly) {
+    static thread_local vector<unsigned char> data;
+    mesh.encode(data, compression);
+    return;
+  }
+
+#ifdef CTB_WITH_MBTILES
+  if (mbtilesWriter != NULL) {
+    vector<unsigned char> data;
+    mesh.encode(data, compression);
+    mbtilesWriter->writeTile(mesh, move(data));
+    recordTile(mesh);
+    return;
+  }
+#endif
+
+  if (writeQueue != NULL) {
+    const TileCoordinate coord = mesh;
+    shared_ptr<vector<unsigned char>> data = make_shared<vector<unsigned char>>();
+
+    mesh.encode(*data, compression);
+    writeQueue->push([coord, data, filename]() {
+        storeTerrainTile(coord, *data, TerrainHash(), filename);
+      });
+  } else {
+    static thread_local vector<unsigned char> data;
+
+    mesh.encode(data, compression);
+    storeTerrainTile(mesh, data, TerrainHash(), filename);
   }
 }
 
+/**
+ * The pools of the terrain tiles created when downsampling, one for each
+ * worker.  A worker only acquires tiles from its own pool, and tiles are only
+ * given back to a pool by its worker or when no workers are running.
+ */
+static vector<unique_ptr<TilePool<TerrainTile>>> levelPools;
+
+/**
+ * The terrain tiles of the zoom level last built, indexed by their position in
+ * the zoom level.  These are retained when downsampling in order to create the
+ * next zoom level.
+ */
+static vector<TilePool<TerrainTile>::Handle> levelTiles;
+
+/**
+ * Should a terrain tile be skipped as the dataset contains no data for it?
+ *
+ * The tiles at zoom level 0 are never skipped as clients need them as the
+ * roots of the tileset.
+ */
+static bool
+isEmptyTile(const TerrainTiler &tiler, const TerrainBuild *command, const TileCoordinate &coord) {
+  return command->skipEmpty && coord.zoom > 0 && !tiler.tileHasData(coord);
+}
+
 /// Output terrain tiles represented by a tiler to a directory
 static void
-buildTerrain(const TerrainTiler &tiler, TerrainBuild *command) {
+buildTerrain(const TerrainTiler &tiler, TerrainBuild *command, unsigned int worker) {
   const string dirname = string(command->outputDir) + osDirSep;
   i_zoom startZoom = (command->startZoom < 0) ? tiler.maxZoomLevel() : command->startZoom,
     endZoom = (command->endZoom < 0) ? 0 : command->endZoom;
 
   TerrainIterator iter(tiler, startZoom, endZoom);
-  int currentIndex = incrementIterator(iter, 0);
-  setIteratorSize(iter);
+  TilePool<TerrainTile> pool;
+  incrementIterator(iter, worker);
 
   while (!iter.exhausted()) {
     const TileCoordinate *coordinate = iter.GridIterator::operator*();
     const string filename = getTileFilename(coordinate, dirname, "terrain");
+    const char *action = "created";
+
+    if (isEmptyTile(tiler, command, *coordinate)) {
+      action = "skipped";
+    } else if (!tileExists(command, *coordinate, filename)) {
+      writeTerrainTile(*iter.createTile(pool), filename);
+    }
 
-    if( !command->resume || !fileExists(filename) ) {
-      TerrainTile *tile = *iter;
-      const string temp_filename = concat(filename, ".tmp");
+    incrementIterator(iter, worker);
+    showProgress(filename, action);
+  }
+}
 
-      tile->writeFile(temp_filename.c_str());
-      delete tile;
+/// The number of zoom levels spanned by the tiles along the side of a metatile
+static i_zoom metatileDepth = 0;
 
-      if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
-        throw new CTBException("Could not rename temporary file");
+/**
+ * Output terrain tiles a metatile at a time
+ *
+ * The tiles in a metatile are the descendants of a tile `metatileDepth` zoom
+ * levels below them, so the metatiles are shared between the threads by
+ * sharing out these tiles.  The tiles of each metatile are created in turn,
+ * allowing the tiler to warp the whole metatile in one operation.  Zoom levels
+ * smaller than a metatile are not built here.
+ */
+static void
+buildMetatiles(const TerrainTiler &tiler, TerrainBuild *command, unsigned int worker) {
+  if (command->startZoom < metatileDepth)
+    return;
+
+  const string dirname = string(command->outputDir) + osDirSep;
+  TilePool<TerrainTile> pool;
+  GridIterator roots(tiler.grid(), tiler.bounds(),
+                     command->startZoom - metatileDepth,
+                     max<int>(command->endZoom, metatileDepth) - metatileDepth);
+  incrementIterator(roots, worker);
+
+  while (!roots.exhausted()) {
+    const TileCoordinate *root = *roots;
+    const i_zoom zoom = root->zoom + metatileDepth;
+    const TileBounds zoomBounds = tiler.tileBoundsForZoom(zoom);
+    const i_tile minX = max(zoomBounds.getMinX(), root->x << metatileDepth),
+      maxX = min(zoomBounds.getMaxX(), ((root->x + 1) << metatileDepth) - 1),
+      minY = max(zoomBounds.getMinY(), root->y << metatileDepth),
+      maxY = min(zoomBounds.getMaxY(), ((root->y + 1) << metatileDepth) - 1);
+
+    for (i_tile x = minX; x <= maxX; ++x) {
+      for (i_tile y = minY; y <= maxY; ++y) {
+        const TileCoordinate coordinate(zoom, x, y);
+        const string filename = getTileFilename(&coordinate, dirname, "terrain");
+        const char *action = "created";
+
+        if (isEmptyTile(tiler, command, coordinate)) {
+          action = "skipped";
+        } else if (!tileExists(command, coordinate, filename)) {
+          TilePool<TerrainTile>::Handle tile = pool.acquire(coordinate);
+          tiler.createTile(coordinate, *tile);
+          writeTerrainTile(*tile, filename);
+        }
+
+        showProgress(filename, action);
       }
     }
 
-    currentIndex = incrementIterator(iter, currentIndex);
-    showProgress(currentIndex, filename);
+    incrementIterator(roots, worker);
+  }
+}
+
+/// Output quantized mesh tiles represented by a tiler to a directory
+static void
+buildMesh(const QuantizedMeshTiler &tiler, TerrainBuild *command, unsigned int worker) {
+  const string dirname = string(command->outputDir) + osDirSep;
+  GridIterator iter(tiler.grid(), tiler.bounds(), command->startZoom, command->endZoom);
+  TilePool<QuantizedMeshTile> pool;
+  incrementIterator(iter, worker);
+
+  while (!iter.exhausted()) {
+    const TileCoordinate *coordinate = *iter;
+    const string filename = getTileFilename(coordinate, dirname, "terrain");
+
+    if (!tileExists(command, *coordinate, filename)) {
+      TilePool<QuantizedMeshTile>::Handle mesh = pool.acquire(*coordinate);
+      tiler.createTile(*coordinate, *mesh);
+      writeMeshTile(*mesh, filename);
+    }
+
+    incrementIterator(iter, worker);
+    showProgress(filename);
+  }
+}
+
+/// Output the terrain tiles for a range of zoom levels using a single thread
+static void
+buildTerrainLevels(const TerrainTiler &tiler, TerrainBuild *command, i_zoom startZoom, i_zoom endZoom) {
+  const string dirname = string(command->outputDir) + osDirSep;
+  TilePool<TerrainTile> pool;
+
+  for (TerrainIterator iter(tiler, startZoom, endZoom); !iter.exhausted(); ++iter) {
+    const TileCoordinate *coordinate = iter.GridIterator::operator*();
+    const string filename = getTileFilename(coordinate, dirname, "terrain");
+    const char *action = "created";
+
+    if (isEmptyTile(tiler, command, *coordinate)) {
+      action = "skipped";
+    } else if (!tileExists(command, *coordinate, filename)) {
+      writeTerrainTile(*iter.createTile(pool), filename);
+    }
+
+    showProgress(filename, action);
+  }
+}
+
+/// The zoom level of the subtrees shared between threads when downsampling
+static i_zoom subtreeZoom;
+
+/**
+ * Choose the zoom level of the subtrees shared between threads
+ *
+ * This is the lowest zoom level providing enough subtrees for the work to be
+ * balanced between the threads: the fewer the subtrees, the fewer the tiles
+ * that must be held in memory until the zoom levels below them are built.
+ */
+static i_zoom
+chooseSubtreeZoom(const TerrainTiler &tiler, i_zoom startZoom, i_zoom endZoom, int threadCount) {
+  // Each subtree should contain whole metatiles
+  const i_zoom maxZoom = (startZoom - endZoom > metatileDepth) ? startZoom - metatileDepth : endZoom;
+
+  for (i_zoom zoom = endZoom; zoom < maxZoom; ++zoom) {
+    GridIterator iter(tiler.grid(), tiler.bounds(), zoom, zoom);
+
+    if (iter.getSize() >= (i_tile) threadCount * 4)
+      return zoom;
+  }
+
+  return maxZoom;
+}
+
+/// Are any of the child tiles of a tile present?
+template<typename T> static bool
+hasChildren(const T &children) {
+  for (const auto &child : children) {
+    if (child)
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * Output terrain tiles for whole subtrees of the tile pyramid
+ *
+ * The tiles at the root of each subtree are shared between the threads.  Each
+ * subtree is then traversed depth first: tiles at the start zoom level are
+ * created from the source dataset and every other tile is downsampled from
+ * its children as soon as they have been built.  Only the up to four pending
+ * children at each zoom level are held in memory, whatever the size of the
+ * zoom levels.  The root tiles are retained in `levelTiles` to create the
+ * zoom levels below the subtrees.
+ */
+static void
+buildSubtrees(const TerrainTiler &tiler, TerrainBuild *command, unsigned int worker) {
+  const string dirname = string(command->outputDir) + osDirSep;
+  const i_zoom startZoom = command->startZoom;
+  TilePool<TerrainTile> &pool = *levelPools[worker];
+
+  // The children waiting for their parent, indexed by zoom level and position
+  vector<array<TilePool<TerrainTile>::Handle, 4>> pending(startZoom - subtreeZoom + 1);
+
+  GridIterator roots(tiler.grid(), tiler.bounds(), subtreeZoom, subtreeZoom);
+  i_tile rootIndex = incrementIterator(roots, worker);
+
+  while (!roots.exhausted()) {
+    for (QuadtreeIterator iter(tiler.grid(), tiler.bounds(), **roots, startZoom); !iter.exhausted(); ++iter) {
+      const TileCoordinate *coordinate = *iter;
+      const string filename = getTileFilename(coordinate, dirname, "terrain");
+      const char *action = "created";
+      TilePool<TerrainTile>::Handle tile;
+
+      if (command->skipEmpty && coordinate->zoom > 0 &&
+          (coordinate->zoom == startZoom
+           ? !tiler.tileHasData(*coordinate)
+           : !hasChildren(pending[coordinate->zoom + 1 - subtreeZoom]))) {
+        action = "skipped";     // `NULL` marks the tile as missing to its parent
+      } else if (!tileExists(command, *coordinate, filename)) {
+        tile = pool.acquire(*coordinate);
+
+        if (coordinate->zoom == startZoom) {
+          tiler.createTile(*coordinate, *tile);
+        } else {
+          const array<TilePool<TerrainTile>::Handle, 4> &children = pending[coordinate->zoom + 1 - subtreeZoom];
+          tiler.createTileFromChildren(*coordinate, children[0].get(), children[1].get(),
+                                       children[2].get(), children[3].get(), *tile);
+        }
+
+        writeTerrainTile(*tile, filename);
+      } else {
+        // the existing tile is needed to create the zoom level below
+        tile = pool.acquire(*coordinate);
+        tile->readFile(filename.c_str());
+      }
+
+      // The children are no longer needed, so go back to the pool
+      if (coordinate->zoom < startZoom) {
+        for (auto &child : pending[coordinate->zoom + 1 - subtreeZoom]) {
+          child.reset();
+        }
+      }
+
+      if (coordinate->zoom == subtreeZoom) {
+        levelTiles[rootIndex] = move(tile);
+      } else {
+        pending[coordinate->zoom - subtreeZoom][(coordinate->x % 2) + ((coordinate->y % 2) * 2)] = move(tile);
+      }
+
+      showProgress(filename, action);
+    }
+
+    rootIndex = incrementIterator(roots, worker);
+  }
+}
+
+/**
+ * Output terrain tiles for a zoom level by downsampling the level above
+ *
+ * The child tiles are obtained from `levelTiles` and the new tiles are stored
+ * in `parents`, being acquired from the worker's pool.
+ */
+static void
+buildParents(const TerrainTiler &tiler, TerrainBuild *command, i_zoom zoom,
+             vector<TilePool<TerrainTile>::Handle> &parents, unsigned int worker) {
+  const string dirname = string(command->outputDir) + osDirSep;
+  TilePool<TerrainTile> &pool = *levelPools[worker];
+  const GridIterator childIter(tiler.grid(), tiler.bounds(), zoom + 1, zoom + 1);
+  GridIterator iter(tiler.grid(), tiler.bounds(), zoom, zoom);
+  i_tile currentIndex = incrementIterator(iter, worker);
+
+  while (!iter.exhausted()) {
+    const TileCoordinate *coordinate = *iter;
+    const string filename = getTileFilename(coordinate, dirname, "terrain");
+    const char *action = "created";
+    TilePool<TerrainTile>::Handle tile;
+
+    // Get the SW, SE, NW and NE child tiles
+    const TerrainTile *children[4];
+    for (unsigned short int i = 0; i < 4; i++) {
+      const TileCoordinate child(zoom + 1,
+                                 (coordinate->x * 2) + (i % 2),
+                                 (coordinate->y * 2) + (i / 2));
+      children[i] = childIter.contains(child) ? levelTiles[childIter.indexOf(child)].get() : NULL;
+    }
+
+    if (command->skipEmpty && zoom > 0 && !hasChildren(children)) {
+      action = "skipped";       // all the children were skipped
+    } else if (!tileExists(command, *coordinate, filename)) {
+      tile = pool.acquire(*coordinate);
+      tiler.createTileFromChildren(*coordinate, children[0], children[1], children[2], children[3], *tile);
+      writeTerrainTile(*tile, filename);
+    } else {
+      tile = pool.acquire(*coordinate);
+      tile->readFile(filename.c_str());
+    }
+
+    parents[currentIndex] = move(tile);
+
+    currentIndex = incrementIterator(iter, worker);
+    showProgress(filename, action);
   }
 }
 
@@ -429,7 +1287,7 @@ buildTerrain(const TerrainTiler &tiler, TerrainBuild *command) {
  * This function is designed to be run in a separate thread.
  */
 static int
-runTiler(TerrainBuild *command, Grid *grid) {
+runTiler(TerrainBuild *command, Grid *grid, unsigned int worker) {
   GDALDataset  *poDataset = (GDALDataset *) GDALOpen(command->getInputFilename(), GA_ReadOnly);
   if (poDataset == NULL) {
     cerr << "Error: could not open GDAL dataset" << endl;
@@ -438,15 +1296,27 @@ runTiler(TerrainBuild *command, Grid *grid) {
 
   try {
     if (strcmp(command->outputFormat, "Terrain") == 0) {
-      const TerrainTiler tiler(poDataset, *grid);
-      buildTerrain(tiler, command);
+      const TerrainTiler tiler(poDataset, *grid, command->tilerOptions);
+
+      if (command->downsample) {
+        buildSubtrees(tiler, command, worker);
+      } else if (metatileDepth > 0) {
+        buildMetatiles(tiler, command, worker);
+      } else {
+        buildTerrain(tiler, command, worker);
+      }
+    } else if (strcmp(command->outputFormat, "Mesh") == 0) {
+      const QuantizedMeshTiler tiler(poDataset, *grid, command->tilerOptions);
+      buildMesh(tiler, command, worker);
     } else {                    // it's a GDAL format
       const RasterTiler tiler(poDataset, *grid, command->tilerOptions);
-      buildGDAL(tiler, command);
+      buildGDAL(tiler, command, worker);
     }
 
   } catch (CTBException &e) {
     cerr << "Error: " << e.what() << endl;
+    GDALClose(poDataset);
+    return 1;
   }
 
   GDALClose(poDataset);
@@ -454,23 +1324,234 @@ runTiler(TerrainBuild *command, Grid *grid) {
   return 0;
 }
 
+/// Did a thread fail to downsample a zoom level?
+static atomic<bool> downsampleFailed(false);
+
+/**
+ * Perform a downsampling operation for a zoom level
+ *
+ * This function is designed to be run in a separate thread.
+ */
+static void
+runParentTiler(TerrainBuild *command, const TerrainTiler *tiler, i_zoom zoom,
+               vector<TilePool<TerrainTile>::Handle> *parents, unsigned int worker) {
+  try {
+    buildParents(*tiler, command, zoom, *parents, worker);
+  } catch (CTBException &e) {
+    cerr << "Error: " << e.what() << endl;
+    downsampleFailed = true;
+  }
+}
+
+/**
+ * Create the tiles below a zoom level from the tiles above them
+ *
+ * The tiles of the zoom level must be present in `levelTiles`.  Each zoom
+ * level is built in turn using the threads, and the tiles of the level above
+ * are given back to their pools once the threads have finished.
+ */
+static void
+downsampleLevels(TerrainBuild *command, const TerrainTiler &tiler, i_zoom startZoom, i_zoom endZoom, int threadCount) {
+  for (i_zoom zoom = startZoom; zoom > endZoom; ) {
+    --zoom;
+
+    GridIterator iter(tiler.grid(), tiler.bounds(), zoom, zoom);
+    vector<TilePool<TerrainTile>::Handle> parents(iter.getSize());
+    vector<thread> threads;
+
+    scheduleTiles(iter, command->scheduler, threadCount);
+    for (int i = 0; i < threadCount; ++i) {
+      threads.push_back(thread(runParentTiler, command, &tiler, zoom, &parents, i));
+    }
+
+    for (auto &thread : threads) {
+      thread.join();
+    }
+
+    // The children are no longer needed
+    levelTiles.swap(parents);
+  }
+
+  levelTiles.clear();
+}
+
+/// Share out the tiles to be built between the threads
+static void
+scheduleBuild(TerrainBuild &command, const TerrainTiler &tiler, int threadCount) {
+  const Grid &grid = tiler.grid();
+
+  if (command.downsample) {
+    // Subtrees of the pyramid are shared between the threads, with their
+    // roots being retained to create the zoom levels below them
+    subtreeZoom = chooseSubtreeZoom(tiler, command.startZoom, command.endZoom, threadCount);
+
+    GridIterator iter(grid, tiler.bounds(), subtreeZoom, subtreeZoom);
+    levelTiles.clear();
+    levelTiles.resize(iter.getSize());
+    while (levelPools.size() < (size_t) threadCount) {
+      levelPools.emplace_back(new TilePool<TerrainTile>());
+    }
+    scheduleTiles(iter, command.scheduler, threadCount);
+  } else if (metatileDepth > 0) {
+    // Share out the metatiles of the zoom levels large enough to contain them
+    if (command.startZoom >= metatileDepth) {
+      GridIterator iter(grid, tiler.bounds(),
+                        command.startZoom - metatileDepth,
+                        max<int>(command.endZoom, metatileDepth) - metatileDepth);
+      scheduleTiles(iter, command.scheduler, threadCount);
+    }
+  } else {
+    GridIterator iter(grid, tiler.bounds(), command.startZoom, command.endZoom);
+    scheduleTiles(iter, command.scheduler, threadCount);
+  }
+}
+
+/**
+ * Build the scheduled tiles using a number of threads
+ *
+ * This returns the first non zero value returned by a thread, or 1 if a tile
+ * of the remaining zoom levels couldn't be created.
+ */
+static int
+runBuild(TerrainBuild &command, Grid &grid, const TerrainTiler &tiler, int threadCount) {
+  vector<future<int>> tasks;
+
+  // Instantiate the threads using futures from a packaged_task
+  for (int i = 0; i < threadCount ; ++i) {
+    packaged_task<int(TerrainBuild *, Grid *, unsigned int)> task(runTiler); // wrap the function
+    tasks.push_back(task.get_future());                        // get a future
+    thread(move(task), &command, &grid, i).detach(); // launch on a thread
+  }
+
+  // Synchronise the completion of the threads
+  for (auto &task : tasks) {
+    task.wait();
+  }
+
+  // Create the remaining zoom levels from the tiles already built
+  int retval = 0;
+  if (command.downsample) {
+    downsampleLevels(&command, tiler, subtreeZoom, command.endZoom, threadCount);
+    if (downsampleFailed)
+      retval = 1;
+  } else if (metatileDepth > 0 && command.endZoom < metatileDepth) {
+    // Each zoom level smaller than a metatile is contained in a single
+    // metatile, so there is no advantage in using multiple threads
+    try {
+      buildTerrainLevels(tiler, &command,
+                         min<i_zoom>(command.startZoom, metatileDepth - 1), command.endZoom);
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      retval = 1;
+    }
+  }
+
+  // Return the first problem encountered by a thread
+  for (auto &task : tasks) {
+    const int taskRetval = task.get();
+    if (taskRetval)
+      return taskRetval;
+  }
+
+  return retval;
+}
+
+/**
+ * Report the throughput of building the tiles with each scheduler and warp
+ * threading
+ *
+ * The tiles are built in full, including encoding them, but are not written,
+ * so the results don't depend on the filesystem.  The GDAL block cache is
+ * emptied before each run so that every run reads the same source blocks.
+ *
+ * Each scheduler is combined with warps that share the CPUs between the
+ * threads (the default), warps that are single threaded and warps that each
+ * use all the CPUs.  The triangles per second are also reported for quantized
+ * mesh tiles.
+ */
+static int
+benchmarkBuild(TerrainBuild &command, Grid &grid, const TerrainTiler &tiler, int threadCount) {
+  const char *schedulers[] = { "stealing", "global" };
+  const unsigned int cpuCount = CPLGetNumCPUs();
+  const struct {
+    const char *name;
+    unsigned int threadBudget, tilerCount;
+  } warpThreads[] = {
+    { "shared", cpuCount, (unsigned int) threadCount },
+    { "single", 1, 1 },
+    { "all CPUs", cpuCount, 1 }
+  };
+
+  const bool isMesh = strcmp(command.outputFormat, "Mesh") == 0;
+
+  cout << "Benchmarking " << iteratorSize << " tiles from zoom level " << command.startZoom
+       << " to " << command.endZoom << " using " << threadCount << " threads on "
+       << cpuCount << " CPUs" << endl
+       << setw(12) << left << "Scheduler" << setw(14) << "Warp threads"
+       << setw(12) << right << "Seconds" << setw(14) << "Tiles/s";
+  if (isMesh)
+    cout << setw(16) << "Triangles/s";
+  cout << endl;
+
+  for (const char *scheduler : schedulers) {
+    for (const auto &warp : warpThreads) {
+      command.scheduler = scheduler;
+      command.tilerOptions.threadBudget = warp.threadBudget;
+      command.tilerOptions.tilerCount = warp.tilerCount;
+      tileCount = 0;
+      meshTriangleCount = 0;
+      while (GDALFlushCacheBlock()) {}
+
+      const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      scheduleBuild(command, tiler, threadCount);
+
+      const int retval = runBuild(command, grid, tiler, threadCount);
+      if (retval)
+        return retval;
+
+      const chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      cout << setw(12) << left << scheduler << setw(14) << warp.name
+           << setw(12) << right << fixed << setprecision(2) << elapsed.count()
+           << setw(14) << setprecision(1) << (tileCount / elapsed.count());
+      if (isMesh)
+        cout << setw(16) << (meshTriangleCount / elapsed.count());
+      cout << endl;
+    }
+  }
+
+  return 0;
+}
+
 int
 main(int argc, char *argv[]) {
   // Specify the command line interface
   TerrainBuild command = TerrainBuild(argv[0], version.cstr);
   command.setUsage("[options] GDAL_DATASOURCE");
   command.option("-o", "--output-dir <dir>", "specify the output directory for the tiles (defaults to working directory)", TerrainBuild::setOutputDir);
-  command.option("-f", "--output-format <format>", "specify the output format for the tiles. This is either `Terrain` (the default) or any format listed by `gdalinfo --formats`", TerrainBuild::setOutputFormat);
+  command.option("-f", "--output-format <format>", "specify the output format for the tiles. This is either `Terrain` (the default), `Mesh` for quantized-mesh tiles or any format listed by `gdalinfo --formats`", TerrainBuild::setOutputFormat);
   command.option("-p", "--profile <profile>", "specify the TMS profile for the tiles. This is either `geodetic` (the default) or `mercator`", TerrainBuild::setProfile);
   command.option("-c", "--thread-count <count>", "specify the number of threads to use for tile generation. On multicore machines this defaults to the number of CPUs", TerrainBuild::setThreadCount);
+  command.option("-w", "--io-threads <count>", "specify the number of dedicated threads writing tile files, so tile generation doesn't wait on the filesystem. Defaults to 0, where each thread writes the tiles it generates. Only valid for the directory container.", TerrainBuild::setIOThreadCount);
+  command.option("-W", "--io-queue <size>", "specify the maximum number of generated tiles waiting to be written by the I/O threads, after which tile generation pauses. Defaults to 64 per I/O thread.", TerrainBuild::setIOQueueSize);
+  command.option("-k", "--scheduler <scheduler>", "specify how tiles are shared between threads. This is either `stealing` (the default) where threads work on spatially adjacent tiles and take work from busy threads when idle, or `global` where each tile is claimed in turn from a single global index", TerrainBuild::setScheduler);
   command.option("-t", "--tile-size <size>", "specify the size of the tiles in pixels. This defaults to 65 for terrain tiles and 256 for other GDAL formats", TerrainBuild::setTileSize);
   command.option("-s", "--start-zoom <zoom>", "specify the zoom level to start at. This should be greater than the end zoom level", TerrainBuild::setStartZoom);
   command.option("-e", "--end-zoom <zoom>", "specify the zoom level to end at. This should be less than the start zoom level and >= 0", TerrainBuild::setEndZoom);
   command.option("-r", "--resampling-method <algorithm>", "specify the raster resampling algorithm.  One of: nearest; bilinear; cubic; cubicspline; lanczos; average; mode; max; min; med; q1; q3. Defaults to average.", TerrainBuild::setResampleAlg);
   command.option("-n", "--creation-option <option>", "specify a GDAL creation option for the output dataset in the form NAME=VALUE. Can be specified multiple times. Not valid for Terrain tiles.", TerrainBuild::addCreationOption);
   command.option("-z", "--error-threshold <threshold>", "specify the error threshold in pixel units for transformation approximation. Larger values should mean faster transforms. Defaults to 0.125", TerrainBuild::setErrorThreshold);
+  command.option("-M", "--metatile <size>", "warp blocks of size x size adjacent tiles in one operation, cutting the tiles from the result. The size must be a power of 2. Larger sizes reduce the per tile warping overhead at the expense of memory. Defaults to 1. Only valid for Terrain tiles.", TerrainBuild::setMetatileSize);
   command.option("-m", "--warp-memory <bytes>", "The memory limit in bytes used for warp operations. Higher settings should be faster. Defaults to a conservative GDAL internal setting.", TerrainBuild::setWarpMemory);
-  command.option("-R", "--resume", "Do not overwrite existing files", TerrainBuild::setResume);
+  command.option("-g", "--mesh-error <factor>", "scale the maximum geometric error of Mesh tiles at each zoom level. The error at zoom level 0 is about 77km, halving at each level, and is multiplied by this factor. Larger values give simpler meshes. Defaults to 1.", TerrainBuild::setMeshErrorFactor);
+  command.option("-d", "--downsample", "create the zoom levels below the start zoom level by downsampling the tiles of the level above rather than resampling the source dataset. This is much faster for large datasets. Only valid for Terrain tiles.", TerrainBuild::setDownsample);
+  command.option("-l", "--link-duplicates <type>", "write terrain tiles identical to a tile already written as links to that tile. The link type is either `hard` or `symbolic`. Not supported on Windows.", TerrainBuild::setLinkDuplicates);
+  command.option("-S", "--skip-empty", "do not create terrain tiles for which the dataset contains no data, as determined from its nodata value or mask. Parent tiles only flag the children that are created. Only valid for Terrain tiles.", TerrainBuild::setSkipEmpty);
+  command.option("-i", "--integer-warp", "warp the dataset straight into terrain height units rather than via floating point heights, halving the memory used by the warp. Heights are clamped to the terrain height range as usual, but halfway values are rounded up rather than to even. Only valid for Terrain tiles.", TerrainBuild::setIntegerWarp);
+  command.option("-a", "--water-mask <source>", "set the water masks of terrain tiles from a dataset describing the land: either a vector dataset whose first layer contains land polygons, such as those derived from a coastline, or a raster in the tile SRS whose non zero pixels are land. Everything else is water. Only valid for Terrain tiles.", TerrainBuild::setWaterMask);
+  command.option("-C", "--container <type>", "specify how terrain tiles are stored. This is either `directory` (the default) where each tile is a file in a `{zoom}/{x}/{y}.terrain` directory structure, or `mbtiles` where all tiles are written to a `terrain.mbtiles` SQLite database in the output directory, or `archive` where all tiles are appended to a `terrain.archive` file in the output directory, sharing the data of identical tiles. Only valid for Terrain tiles.", TerrainBuild::setContainer);
+  command.option("-Z", "--compression <method>", "specify how terrain tiles are compressed as `method[:level]`. The method is `zlib` (the default), `libdeflate` (faster, if available) or `none` for servers that compress tiles themselves. Levels are 0-9 for zlib and 0-12 for libdeflate.", TerrainBuild::setCompression);
+  command.option("-R", "--resume", "Do not overwrite existing files. Completed tiles are looked up in the `ctb-tile.journal` file written to the output directory, falling back to checking for each file if there is no journal for the tileset.", TerrainBuild::setResume);
+  command.option("-B", "--benchmark", "build the tiles once with each scheduler and way of threading the warps without writing them, reporting the time taken and tiles per second. Only valid for Terrain and Mesh tiles in the directory container.", TerrainBuild::setBenchmark);
   command.option("-q", "--quiet", "only output errors", TerrainBuild::setQuiet);
   command.option("-v", "--verbose", "be more noisy", TerrainBuild::setVerbose);
 
@@ -510,30 +1591,355 @@ main(int argc, char *argv[]) {
     return 1;
   }
 
+  // Check the scheduler
+  if (strcmp(command.scheduler, "stealing") != 0 && strcmp(command.scheduler, "global") != 0) {
+    cerr << "Error: Unknown scheduler: " << command.scheduler << endl;
+    return 1;
+  }
+
+  // Downsampling only applies to terrain tiles
+  if (command.downsample && strcmp(command.outputFormat, "Terrain") != 0) {
+    cerr << "Error: Only Terrain tiles can be downsampled" << endl;
+    return 1;
+  }
+
+  // Only terrain tiles are warped into terrain heights
+  if (command.tilerOptions.terrainUnits && strcmp(command.outputFormat, "Terrain") != 0) {
+    cerr << "Error: The integer warp is only valid for Terrain tiles" << endl;
+    return 1;
+  }
+
+  // Only terrain tiles have water masks
+  if (command.waterMask != NULL && strcmp(command.outputFormat, "Terrain") != 0) {
+    cerr << "Error: Water masks are only valid for Terrain tiles" << endl;
+    return 1;
+  }
+
+  // Only terrain tiles can be skipped
+  if (command.skipEmpty && strcmp(command.outputFormat, "Terrain") != 0) {
+    cerr << "Error: Only empty Terrain tiles can be skipped" << endl;
+    return 1;
+  }
+
+  // Check the duplicate link type
+  if (command.linkDuplicates != NULL) {
+    if (strcmp(command.linkDuplicates, "hard") != 0 && strcmp(command.linkDuplicates, "symbolic") != 0) {
+      cerr << "Error: Unknown link type: " << command.linkDuplicates << endl;
+      return 1;
+    } else if (strcmp(command.outputFormat, "Terrain") != 0) {
+      cerr << "Error: Only Terrain tiles can be linked" << endl;
+      return 1;
+    }
+
+    linkDuplicates = command.linkDuplicates;
+  }
+
+  compression = command.compression;
+
+  // Check the tile container
+  if (strcmp(command.container, "mbtiles") == 0) {
+#ifdef CTB_WITH_MBTILES
+    if (strcmp(command.outputFormat, "Terrain") != 0 && strcmp(command.outputFormat, "Mesh") != 0) {
+      cerr << "Error: Only Terrain and Mesh tiles can be written to an MBTiles container" << endl;
+      return 1;
+    } else if (command.resume || command.linkDuplicates != NULL) {
+      cerr << "Error: Tiles in an MBTiles container can't be resumed or linked" << endl;
+      return 1;
+    }
+#else
+    cerr << "Error: This build doesn't support MBTiles as SQLite wasn't available" << endl;
+    return 1;
+#endif
+  } else if (strcmp(command.container, "archive") == 0) {
+    if (strcmp(command.outputFormat, "Terrain") != 0) {
+      cerr << "Error: Only Terrain tiles can be written to an archive" << endl;
+      return 1;
+    } else if (command.resume || command.linkDuplicates != NULL) {
+      cerr << "Error: Tiles in an archive can't be resumed or linked" << endl;
+      return 1;
+    }
+  } else if (strcmp(command.container, "directory") != 0) {
+    cerr << "Error: Unknown container: " << command.container << endl;
+    return 1;
+  }
+
+  // Check the I/O threads
+  if (command.ioThreadCount < 0) {
+    cerr << "Error: The number of I/O threads can't be negative" << endl;
+    return 1;
+  } else if (command.ioThreadCount > 0 && strcmp(command.container, "directory") != 0) {
+    cerr << "Error: I/O threads are only used for the directory container" << endl;
+    return 1;
+  }
+
+  // Benchmarks build the tiles without writing them anywhere
+  if (command.benchmark) {
+    if (strcmp(command.outputFormat, "Terrain") != 0 && strcmp(command.outputFormat, "Mesh") != 0) {
+      cerr << "Error: Benchmarks are only supported for Terrain and Mesh tiles" << endl;
+      return 1;
+    } else if (strcmp(command.container, "directory") != 0 || command.ioThreadCount > 0) {
+      cerr << "Error: Benchmarks don't write tiles, so can't use a container or I/O threads" << endl;
+      return 1;
+    } else if (command.resume || command.linkDuplicates != NULL) {
+      cerr << "Error: Benchmarks can't be combined with resuming or linking duplicate tiles" << endl;
+      return 1;
+    }
+
+    benchmarkOnly = true;
+    progressFunc = GDALDummyProgress;
+  }
+
+  // Quantized mesh tiles are in geographic coordinates
+  if (strcmp(command.outputFormat, "Mesh") == 0 && strcmp(command.profile, "geodetic") != 0) {
+    cerr << "Error: Mesh tiles can only be created with the geodetic profile" << endl;
+    return 1;
+  }
+
+  // Check the metatile size
+  const unsigned int metatileSize = command.tilerOptions.metatileSize;
+  if (metatileSize < 1 || (metatileSize & (metatileSize - 1)) != 0) {
+    cerr << "Error: The metatile size must be a power of 2" << endl;
+    return 1;
+  } else if (metatileSize > 1 && strcmp(command.outputFormat, "Terrain") != 0) {
+    cerr << "Error: Only Terrain tiles can be metatiled" << endl;
+    return 1;
+  }
+
+  while ((1u << metatileDepth) < metatileSize) {
+    ++metatileDepth;
+  }
+
   // Run the tilers in separate threads
-  vector<future<int>> tasks;
   int threadCount = (command.threadCount > 0) ? command.threadCount : CPLGetNumCPUs();
 
-  // Instantiate the threads using futures from a packaged_task
-  for (int i = 0; i < threadCount ; ++i) {
-    packaged_task<int(TerrainBuild *, Grid *)> task(runTiler); // wrap the function
-    tasks.push_back(task.get_future());                        // get a future
-    thread(move(task), &command, &grid).detach(); // launch on a thread
+  // Share the CPUs between the warp operations of the threads rather than
+  // each warp using all of them
+  command.tilerOptions.threadBudget = CPLGetNumCPUs();
+  command.tilerOptions.tilerCount = threadCount;
+
+  // Open the dataset to determine the tiles that are to be created so they can
+  // be shared out between the threads
+  GDALDataset *poDataset = (GDALDataset *) GDALOpen(command.getInputFilename(), GA_ReadOnly);
+  if (poDataset == NULL) {
+    cerr << "Error: could not open GDAL dataset" << endl;
+    return 1;
   }
 
-  // Synchronise the completion of the threads
-  for (auto &task : tasks) {
-    task.wait();
+  TerrainTiler *tiler;
+  WaterMask *waterMask = NULL;
+  try {
+    // Load the land once, to be shared by the tilers of all the threads
+    if (command.waterMask != NULL) {
+      waterMask = new WaterMask(command.waterMask, grid);
+      command.tilerOptions.waterMask = waterMask;
+
+      if (command.verbosity > 0) {
+        if (waterMask->isRaster()) {
+          cout << "Creating water masks from the land raster " << command.waterMask << endl;
+        } else {
+          cout << "Creating water masks from " << waterMask->polygonCount() << " land polygons" << endl;
+        }
+      }
+    }
+
+    tiler = new TerrainTiler(poDataset, grid, command.tilerOptions);
+
+    if (command.startZoom < 0)
+      command.startZoom = tiler->maxZoomLevel();
+    if (command.endZoom < 0)
+      command.endZoom = 0;
+
+    iteratorSize = GridIterator(grid, tiler->bounds(), command.startZoom, command.endZoom).getSize();
+
+#ifdef CTB_WITH_MBTILES
+    if (strcmp(command.container, "mbtiles") == 0) {
+      mbtilesWriter = new MBTilesWriter(concat(command.outputDir, osDirSep, "terrain.mbtiles").c_str());
+      mbtilesWriter->setMetadata("name", CPLGetBasename(command.getInputFilename()));
+      mbtilesWriter->setMetadata("format", strcmp(command.outputFormat, "Mesh") == 0 ? "quantized-mesh" : "terrain");
+      mbtilesWriter->setMetadata("minzoom", concat(command.endZoom));
+      mbtilesWriter->setMetadata("maxzoom", concat(command.startZoom));
+
+      // The bounds are only in longitude and latitude for the geodetic profile
+      if (strcmp(command.profile, "geodetic") == 0) {
+        const CRSBounds &bounds = tiler->bounds();
+        mbtilesWriter->setMetadata("bounds", concat(bounds.getMinX(), ",", bounds.getMinY(), ",",
+                                                    bounds.getMaxX(), ",", bounds.getMaxY()));
+      }
+    }
+#endif
+
+    // Create the directory skeleton before tiling, unless tiles are being
+    // skipped, when directories are only created for the tiles written
+    if (!command.benchmark && strcmp(command.container, "directory") == 0) {
+      prepareTileDirectories(*tiler, concat(command.outputDir, osDirSep),
+                             command.startZoom, command.endZoom, !command.skipEmpty);
+
+      // Record the tiles completed so the operation can be resumed quickly
+      tileJournal = new TileJournal(concat(command.outputDir, osDirSep, "ctb-tile.journal").c_str(),
+                                    *tiler, command.startZoom, command.endZoom, command.resume);
+
+      if (command.resume && command.verbosity > 0) {
+        if (tileJournal->loaded()) {
+          cout << "Resuming with " << tileJournal->loadedCount() << " of "
+               << tileJournal->tileCount() << " tiles recorded as complete" << endl;
+        } else {
+          cout << "Resuming by checking for existing tiles as there is no journal for this tileset" << endl;
+        }
+      }
+    }
+
+    // Collect the tiles written so clients can be told which are available.
+    // The `layer.json` tile template only addresses tile files, so it isn't
+    // written for the other containers.
+    if (!command.benchmark && strcmp(command.container, "directory") == 0 &&
+        (strcmp(command.outputFormat, "Terrain") == 0 || strcmp(command.outputFormat, "Mesh") == 0)) {
+      tileAvailability = new TileAvailability(*tiler, command.startZoom, command.endZoom);
+    }
+
+    if (strcmp(command.container, "archive") == 0) {
+      archiveWriter = new TerrainArchiveWriter(concat(command.outputDir, osDirSep, "terrain.archive").c_str(),
+                                               true, compression);
+    }
+
+    if (!command.benchmark) {
+      scheduleBuild(command, *tiler, threadCount);
+    }
+  } catch (CTBException &e) {
+    cerr << "Error: " << e.what() << endl;
+#ifdef CTB_WITH_MBTILES
+    delete mbtilesWriter;
+#endif
+    delete archiveWriter;
+    delete tileJournal;
+    delete tileAvailability;
+    delete waterMask;
+    GDALClose(poDataset);
+    return 1;
   }
 
-  // Get the value from the futures
-  for (auto &task : tasks) {
-    int retval = task.get();
+  // Hand the writing of tile files over to the I/O threads
+  if (command.ioThreadCount > 0) {
+    const size_t capacity = (command.ioQueueSize > 0) ? command.ioQueueSize : 64 * command.ioThreadCount;
+    writeQueue = new WriteQueue(command.ioThreadCount, capacity);
+  }
 
-    // return on the first encountered problem
-    if (retval)
-      return retval;
+  // Measure each way of building the tiles rather than writing them
+  if (command.benchmark) {
+    const int retval = benchmarkBuild(command, grid, *tiler, threadCount);
+    delete tileScheduler;
+    delete tiler;
+    delete waterMask;
+    GDALClose(poDataset);
+    return retval;
   }
 
-  return 0;
+  chrono::steady_clock::time_point startTime = chrono::steady_clock::now();
+  const int retval = runBuild(command, grid, *tiler, threadCount);
+
+  // Wait for the remaining tile files to be written
+  bool writeFailed = false;
+  if (writeQueue != NULL) {
+    try {
+      writeQueue->finish();
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      writeFailed = true;
+    }
+  }
+
+  // Record the last of the completed tiles
+  if (tileJournal != NULL) {
+    try {
+      tileJournal->close();
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      writeFailed = true;
+    }
+  }
+
+  // Describe the available tiles to terrain servers and clients
+  if (tileAvailability != NULL) {
+    const string filename = concat(command.outputDir, osDirSep, "layer.json");
+
+    try {
+      tileAvailability->writeLayerJson(filename.c_str(), CPLGetBasename(command.getInputFilename()),
+                                       (strcmp(command.outputFormat, "Mesh") == 0) ? "quantized-mesh-1.0" : "heightmap-1.0");
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      writeFailed = true;
+    }
+
+    delete tileAvailability;
+  }
+
+  delete tiler;
+  delete waterMask;
+  GDALClose(poDataset);
+
+#ifdef CTB_WITH_MBTILES
+  // Wait for the remaining tiles to be written to the database
+  if (mbtilesWriter != NULL) {
+    try {
+      mbtilesWriter->close();
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      writeFailed = true;
+    }
+
+    delete mbtilesWriter;
+    mbtilesWriter = NULL;
+  }
+#endif
+
+  // Write the archive index
+  if (archiveWriter != NULL) {
+    try {
+      archiveWriter->close();
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      writeFailed = true;
+    }
+  }
+
+  // Report the throughput of the tiling operation
+  if (command.verbosity > 0) {
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - startTime;
+    cout << "Created " << tileCount << " tiles in " << elapsed.count() << " seconds ("
+         << (tileCount / elapsed.count()) << " tiles per second) using "
+         << threadCount << " threads and the " << command.scheduler << " scheduler" << endl;
+
+    if (meshTriangleCount > 0) {
+      cout << "Created " << meshTriangleCount << " mesh triangles ("
+           << (meshTriangleCount / elapsed.count()) << " triangles per second)" << endl;
+    }
+
+    if (linkDuplicates != NULL && terrainCount > 0) {
+      cout << "Linked " << linkCount << " duplicate tiles out of " << terrainCount
+           << " terrain tiles written (" << ((100.0 * linkCount) / terrainCount) << "%)" << endl;
+    } else if (archiveWriter != NULL && archiveWriter->tileCount() > 0) {
+      cout << "Shared the data of " << archiveWriter->duplicateCount() << " duplicate tiles out of "
+           << archiveWriter->tileCount() << " terrain tiles archived ("
+           << ((100.0 * archiveWriter->duplicateCount()) / archiveWriter->tileCount()) << "%)" << endl;
+    }
+
+    if (writeQueue != NULL) {
+      const WriteQueue::Statistics stats = writeQueue->statistics();
+      cout << "Wrote " << stats.jobCount << " tiles using " << writeQueue->threadCount()
+           << " I/O threads: the queue reached a depth of " << stats.maxDepth << " out of "
+           << writeQueue->capacity() << ", tile generation stalled for " << stats.stallSeconds
+           << " seconds and the I/O threads were idle for " << stats.idleSeconds << " seconds" << endl;
+    }
+  }
+
+  delete archiveWriter;
+  delete writeQueue;
+  delete tileJournal;
+
+  delete tileScheduler;
+
+  // return on the first encountered problem
+  if (retval)
+    return retval;
+
+  return writeFailed ? 1 : 0;
 }